@@ -0,0 +1,82 @@
+/* Compares the daemon's base64 encoder against g_base64_encode over image
+ * sizes seen in practice, from icons to screenshots. Before timing anything it
+ * checks that both give the same bytes, for every length up to a few blocks
+ * and for each benchmarked size, and fails if they do not.
+ *
+ * Usage: base64-encode [SIZE_KB...] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "../src/base64.h"
+
+#define MIN_RUNS 20
+#define MIN_TIME_US 200000
+
+static gboolean check(const guchar *data, gsize size) {
+	gchar *expected = g_base64_encode(data, size);
+	gchar *actual = base64_encode_new(data, size);
+	gboolean same = !strcmp(expected, actual);
+	if (!same) fprintf(stderr, "Output differs from GLib for %zu bytes\n", size);
+	g_free(expected);
+	g_free(actual);
+	return same;
+}
+
+static gchar *encode_glib(const guchar *data, gsize size) {
+	return g_base64_encode(data, size);
+}
+
+/* Returns the throughput of encode in MB/s of input. */
+static double measure(gchar *(*encode)(const guchar *, gsize), const guchar *data, gsize size) {
+	int runs = 0;
+	gint64 start = g_get_monotonic_time();
+	gint64 elapsed;
+	do {
+		g_free(encode(data, size));
+		++runs;
+		elapsed = g_get_monotonic_time() - start;
+	} while (runs < MIN_RUNS || elapsed < MIN_TIME_US);
+	return (double)size * runs / elapsed;
+}
+
+int main(int argc, char **argv) {
+	static const gsize default_sizes[] = { 4, 64, 256, 1024, 4096 };
+	size_t count = argc > 1 ? (size_t)argc - 1 : G_N_ELEMENTS(default_sizes);
+	gsize max_size = 256;
+	for (size_t i = 0; i < count; ++i) {
+		gsize size = (argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes[i]) << 10;
+		if (size > max_size) max_size = size;
+	}
+
+	// Compressed image data looks random to the encoder
+	GRand *rand = g_rand_new_with_seed(1);
+	guchar *data = g_malloc(max_size);
+	for (gsize i = 0; i < max_size; ++i) data[i] = g_rand_int(rand);
+	g_rand_free(rand);
+
+	gboolean ok = TRUE;
+	for (gsize size = 0; size < 256; ++size) ok &= check(data, size);
+	for (size_t i = 0; i < count; ++i) {
+		gsize size = (argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes[i]) << 10;
+		ok &= check(data, size);
+		if (size > 0) ok &= check(data + 1, size - 1);
+	}
+	if (!ok) return 1;
+
+	for (size_t i = 0; i < count; ++i) {
+		gsize size = (argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes[i]) << 10;
+		double glib = measure(encode_glib, data, size);
+		double ours = measure(base64_encode_new, data, size);
+		printf(
+			"%6zu KB  g_base64_encode %8.1f MB/s  base64_encode %8.1f MB/s  %5.1fx\n",
+			size >> 10,
+			glib,
+			ours,
+			ours / glib
+		);
+	}
+	g_free(data);
+	return 0;
+}
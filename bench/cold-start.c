@@ -0,0 +1,318 @@
+/* Measures how long the daemon takes to answer its first Notify when the bus
+ * starts it, and that it exits again once idle. A private dbus-daemon is given
+ * a service file for org.freedesktop.Notifications that runs DAEMON, and the
+ * daemon a config with idle_exit_ms set. Each round waits for the daemon to
+ * release the name, sends a Notify that the bus has to start it for, and then
+ * a second one to the daemon that is now running.
+ *
+ * Reports the cold and warm reply latency, the daemon's resident memory while
+ * it runs, and how long after its last notification it let go of the name.
+ * Exits with 77, which meson counts as skipped, if dbus-daemon is missing, and
+ * with 1 if the median cold start is over the budget or the daemon does not
+ * exit.
+ *
+ * Usage: cold-start DAEMON [-n ROUNDS] [-b BUDGET_MS] [-t IDLE_EXIT_MS] */
+
+#include <dbus/dbus.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define DEFAULT_ROUNDS 10
+#define DEFAULT_BUDGET_MS 500
+#define DEFAULT_IDLE_EXIT_MS 200
+/* How long past idle_exit_ms the daemon may take to release the name */
+#define EXIT_SLACK_US 5000000
+
+struct Bench {
+	const char *daemon;
+	/* Short enough that every path made in it fits in PATH_MAX */
+	char dir[256];
+	char address[PATH_MAX + 16];
+	pid_t bus;
+	DBusConnection *client;
+	/* The daemon the bus last started, or 0 */
+	pid_t pid;
+	int idle_exit_ms;
+};
+
+static int write_file(const char *path, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static int write_file(const char *path, const char *format, ...) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+	va_list args;
+	va_start(args, format);
+	vfprintf(file, format, args);
+	va_end(args);
+	return fclose(file) == 0;
+}
+
+/* Writes the bus config, the service file and the daemon's config. */
+static int setup(struct Bench *bench) {
+	char path[PATH_MAX];
+	char daemon[PATH_MAX];
+	if (!make_temporary_directory(bench->dir, sizeof(bench->dir))) return 0;
+	// The bus runs services from its own working directory
+	if (realpath(bench->daemon, daemon) == NULL) {
+		perror(bench->daemon);
+		return 0;
+	}
+	snprintf(bench->address, sizeof(bench->address), "unix:path=%s/bus", bench->dir);
+	snprintf(path, sizeof(path), "%s/services", bench->dir);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/config/i-spy-notify", bench->dir);
+	mkdir(path, 0700);
+
+	snprintf(path, sizeof(path), "%s/services/org.freedesktop.Notifications.service", bench->dir);
+	if (!write_file(
+		path,
+		"[D-BUS Service]\n"
+		"Name=org.freedesktop.Notifications\n"
+		"Exec=%s\n",
+		daemon
+	)) {
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s/config/i-spy-notify/i-spy-notify.json", bench->dir);
+	if (!write_file(path, "{\n    \"idle_exit_ms\": %d,\n    \"hooks\": []\n}\n", bench->idle_exit_ms)) {
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s/bus.conf", bench->dir);
+	return write_file(
+		path,
+		"<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+		" \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+		"<busconfig>\n"
+		"  <type>session</type>\n"
+		"  <listen>%s</listen>\n"
+		"  <servicedir>%s/services</servicedir>\n"
+		"  <policy context=\"default\">\n"
+		"    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+		"    <allow eavesdrop=\"true\"/>\n"
+		"    <allow own=\"*\"/>\n"
+		"  </policy>\n"
+		"</busconfig>\n",
+		bench->address,
+		bench->dir
+	);
+}
+
+static int has_owner(struct Bench *bench) {
+	DBusError error = DBUS_ERROR_INIT;
+	int owned = dbus_bus_name_has_owner(bench->client, "org.freedesktop.Notifications", &error);
+	dbus_error_free(&error);
+	return owned;
+}
+
+/* Waits until nothing owns the name, returning when that happened or a
+ * negative number if it did not before deadline. */
+static double wait_for_exit(struct Bench *bench, double deadline) {
+	double now;
+	while ((now = now_us()) < deadline) {
+		if (!has_owner(bench)) return now;
+		usleep(2000);
+	}
+	return -1;
+}
+
+/* Sends a Notify that expires at once, so that the daemon is left idle, and
+ * returns the time to its reply in microseconds, or a negative number. */
+static double notify(struct Bench *bench) {
+	DBusMessage *message = dbus_message_new_method_call(
+		"org.freedesktop.Notifications",
+		"/org/freedesktop/Notifications",
+		"org.freedesktop.Notifications",
+		"Notify"
+	);
+	const char *app_name = "cold-start";
+	const char *app_icon = "";
+	const char *summary = "cold start";
+	const char *body = "";
+	dbus_uint32_t replaces_id = 0;
+	dbus_int32_t expire_timeout = 1;
+	DBusMessageIter iter;
+	DBusMessageIter container;
+	dbus_message_iter_init_append(message, &iter);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &app_name);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &replaces_id);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &app_icon);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &summary);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &body);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &container);
+	dbus_message_iter_close_container(&iter, &container);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &container);
+	dbus_message_iter_close_container(&iter, &container);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &expire_timeout);
+
+	DBusError error = DBUS_ERROR_INIT;
+	double start = now_us();
+	DBusMessage *reply = dbus_connection_send_with_reply_and_block(bench->client, message, 10000, &error);
+	double latency = now_us() - start;
+	dbus_message_unref(message);
+	if (reply == NULL) {
+		fprintf(stderr, "Notify: %s\n", error.message);
+		dbus_error_free(&error);
+		return -1;
+	}
+	dbus_message_unref(reply);
+	return latency;
+}
+
+/* Returns the pid of the name's owner, or 0. */
+static pid_t get_owner_pid(struct Bench *bench) {
+	DBusMessage *message = dbus_message_new_method_call(
+		DBUS_SERVICE_DBUS,
+		DBUS_PATH_DBUS,
+		DBUS_INTERFACE_DBUS,
+		"GetConnectionUnixProcessID"
+	);
+	const char *name = "org.freedesktop.Notifications";
+	dbus_message_append_args(message, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+	DBusMessage *reply = dbus_connection_send_with_reply_and_block(bench->client, message, 1000, NULL);
+	dbus_message_unref(message);
+	dbus_uint32_t pid = 0;
+	if (reply == NULL) return 0;
+	dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, &pid, DBUS_TYPE_INVALID);
+	dbus_message_unref(reply);
+	return pid;
+}
+
+/* Returns the resident memory of a process in KiB, or -1. */
+static long get_rss_kb(pid_t pid) {
+	char path[64];
+	char line[256];
+	long rss_kb = -1;
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) return -1;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "VmRSS: %ld", &rss_kb) == 1) break;
+	}
+	fclose(file);
+	return rss_kb;
+}
+
+static void print_summary(const char *name, double *samples, size_t n, double scale) {
+	qsort(samples, n, sizeof(double), compare);
+	printf(
+		"%-10s %9.1f %9.1f %9.1f\n",
+		name,
+		samples[0] / scale,
+		samples[n / 2] / scale,
+		samples[n - 1] / scale
+	);
+}
+
+/* Runs the rounds, returning 0 if every one completed. */
+static int run(struct Bench *bench, size_t rounds, int budget_ms) {
+	double *cold = calloc(rounds, sizeof(double));
+	double *warm = calloc(rounds, sizeof(double));
+	double *exits = calloc(rounds, sizeof(double));
+	double *rss = calloc(rounds, sizeof(double));
+	size_t n = 0;
+	int status = 0;
+	for (; n < rounds; ++n) {
+		cold[n] = notify(bench);
+		warm[n] = cold[n] >= 0 ? notify(bench) : -1;
+		double replied = now_us();
+		if (warm[n] < 0) {
+			status = 1;
+			break;
+		}
+		bench->pid = get_owner_pid(bench);
+		rss[n] = get_rss_kb(bench->pid);
+		double exited = wait_for_exit(bench, replied + bench->idle_exit_ms * 1e3 + EXIT_SLACK_US);
+		if (exited < 0) {
+			fprintf(stderr, "%s did not exit when idle\n", bench->daemon);
+			status = 1;
+			break;
+		}
+		exits[n] = exited - replied;
+		bench->pid = 0;
+	}
+	if (n > 0) {
+		printf("%-10s %9s %9s %9s\n", "", "min", "p50", "max");
+		print_summary("cold ms", cold, n, 1e3);
+		print_summary("warm ms", warm, n, 1e3);
+		print_summary("rss MB", rss, n, 1024);
+		print_summary("exit ms", exits, n, 1e3);
+		if (cold[n / 2] > budget_ms * 1e3) {
+			fprintf(stderr, "Median cold start is over the budget of %d ms\n", budget_ms);
+			status = 1;
+		}
+	}
+	free(cold);
+	free(warm);
+	free(exits);
+	free(rss);
+	return status;
+}
+
+int main(int argc, char **argv) {
+	struct Bench bench;
+	memset(&bench, 0, sizeof(bench));
+	bench.idle_exit_ms = DEFAULT_IDLE_EXIT_MS;
+	size_t rounds = DEFAULT_ROUNDS;
+	int budget_ms = DEFAULT_BUDGET_MS;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:b:t:")) != -1) {
+		if (opt == 'n') {
+			rounds = strtoul(optarg, NULL, 10);
+		} else if (opt == 'b') {
+			budget_ms = atoi(optarg);
+		} else if (opt == 't') {
+			bench.idle_exit_ms = atoi(optarg);
+		} else {
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind >= argc || rounds == 0 || bench.idle_exit_ms <= 0) {
+		fprintf(stderr, "Usage: %s DAEMON [-n ROUNDS] [-b BUDGET_MS] [-t IDLE_EXIT_MS]\n", argv[0]);
+		return 2;
+	}
+	bench.daemon = argv[optind];
+
+	int status = 0;
+	if (!setup(&bench)) {
+		status = 1;
+	} else {
+		char config[PATH_MAX + 16];
+		snprintf(config, sizeof(config), "--config-file=%s/bus.conf", bench.dir);
+		char *const bus_argv[] = { "dbus-daemon", "--nofork", "--nopidfile", "--print-address=1", config, NULL };
+		// The bus passes its environment on to the services it starts
+		char **env = make_environment(bench.address, bench.dir);
+		int started = start_bus(bus_argv, env, &bench.bus, bench.address, sizeof(bench.address));
+		free_environment(env);
+		if (started <= 0) {
+			status = started == 0 ? 77 : 1;
+		} else if ((bench.client = connect_to_bus(bench.address)) == NULL) {
+			status = 1;
+		}
+	}
+	if (status == 0) status = run(&bench, rounds, budget_ms);
+
+	// The bus does not take the services it started with it
+	if (bench.pid > 0) kill(bench.pid, SIGTERM);
+	if (bench.client != NULL) {
+		dbus_connection_close(bench.client);
+		dbus_connection_unref(bench.client);
+	}
+	if (bench.bus > 0) {
+		kill(bench.bus, SIGTERM);
+		waitpid(bench.bus, NULL, 0);
+	}
+	if (bench.dir[0] != '\0') remove_directory(bench.dir);
+	return status;
+}
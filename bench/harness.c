@@ -0,0 +1,143 @@
+/* What the benchmarks that run the daemon on a private dbus-daemon share. */
+
+#include "harness.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int compare(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int make_temporary_directory(char *dir, size_t size) {
+	char path[PATH_MAX];
+	const char *tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	int length = snprintf(dir, size, "%s/i-spy-notify-bench-XXXXXX", tmp);
+	if (length >= (int)size || mkdtemp(dir) == NULL) {
+		dir[0] = '\0';
+		perror(tmp);
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s/config", dir);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/cache", dir);
+	mkdir(path, 0700);
+	return 1;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+	(void)st;
+	(void)type;
+	(void)ftw;
+	remove(path);
+	return 0;
+}
+
+void remove_directory(const char *dir) {
+	nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+char **make_environment(const char *address, const char *dir) {
+	static const char *const OVERRIDDEN[] = {
+		"DBUS_SESSION_BUS_ADDRESS=",
+		"XDG_CONFIG_HOME=",
+		"XDG_CACHE_HOME=",
+	};
+	size_t n = 0;
+	while (environ[n] != NULL) ++n;
+	char **env = calloc(n + 4, sizeof(char *));
+	size_t out = 0;
+	for (size_t i = 0; i < n; ++i) {
+		int keep = 1;
+		for (size_t j = 0; j < sizeof(OVERRIDDEN) / sizeof(*OVERRIDDEN); ++j) {
+			if (!strncmp(environ[i], OVERRIDDEN[j], strlen(OVERRIDDEN[j]))) keep = 0;
+		}
+		if (keep) env[out++] = strdup(environ[i]);
+	}
+	char value[PATH_MAX + 64];
+	snprintf(value, sizeof(value), "DBUS_SESSION_BUS_ADDRESS=%s", address);
+	env[out++] = strdup(value);
+	snprintf(value, sizeof(value), "XDG_CONFIG_HOME=%s/config", dir);
+	env[out++] = strdup(value);
+	snprintf(value, sizeof(value), "XDG_CACHE_HOME=%s/cache", dir);
+	env[out++] = strdup(value);
+	env[out] = NULL;
+	return env;
+}
+
+void free_environment(char **env) {
+	for (size_t i = 0; env[i] != NULL; ++i) free(env[i]);
+	free(env);
+}
+
+int start_bus(char *const argv[], char **env, pid_t *pid, char *address, size_t size) {
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0) {
+		perror("pipe2");
+		return -1;
+	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+	posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+	int error = posix_spawnp(pid, argv[0], &actions, NULL, argv, env);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	if (error != 0) {
+		close(fds[0]);
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(error));
+		return error == ENOENT ? 0 : -1;
+	}
+	// The address is printed once the bus listens
+	size_t length = 0;
+	ssize_t n;
+	while (
+		length < size - 1 &&
+		(n = read(fds[0], address + length, size - 1 - length)) > 0
+	) {
+		length += n;
+		if (memchr(address, '\n', length) != NULL) break;
+	}
+	close(fds[0]);
+	address[length] = '\0';
+	char *newline = strchr(address, '\n');
+	if (newline == NULL) {
+		fprintf(stderr, "%s did not start\n", argv[0]);
+		return -1;
+	}
+	*newline = '\0';
+	return 1;
+}
+
+DBusConnection *connect_to_bus(const char *address) {
+	DBusError error = DBUS_ERROR_INIT;
+	DBusConnection *conn = dbus_connection_open_private(address, &error);
+	if (conn == NULL || !dbus_bus_register(conn, &error)) {
+		fprintf(stderr, "%s: %s\n", address, error.message);
+		dbus_error_free(&error);
+		if (conn != NULL) {
+			dbus_connection_close(conn);
+			dbus_connection_unref(conn);
+		}
+		return NULL;
+	}
+	return conn;
+}
@@ -0,0 +1,26 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <dbus/dbus.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Returns the monotonic time in microseconds. */
+double now_us(void);
+/* Orders doubles for qsort. */
+int compare(const void *a, const void *b);
+/* Makes a directory under TMPDIR for everything a run reads and writes,
+ * leaving dir empty if it fails. */
+int make_temporary_directory(char *dir, size_t size);
+void remove_directory(const char *dir);
+/* Returns the environment with the session bus at address, and the daemon's
+ * config and cache in dir. */
+char **make_environment(const char *address, const char *dir);
+void free_environment(char **env);
+/* Starts dbus-daemon with argv and env, which has it print its address, and
+ * waits until it listens, reading the address into address. Returns 0 if
+ * dbus-daemon is missing and -1 if it fails. */
+int start_bus(char *const argv[], char **env, pid_t *pid, char *address, size_t size);
+DBusConnection *connect_to_bus(const char *address);
+
+#endif
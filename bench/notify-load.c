@@ -0,0 +1,716 @@
+/* Runs the daemon on a private dbus-daemon and sends it streams of Notify
+ * calls, first with the daemon as the server and then as a monitor beside a
+ * server that this program plays. For each stream it reports the latency from
+ * sending Notify to its reply and to each hook running, the throughput the
+ * daemon sustains when it is kept busy, and the daemon's CPU use and peak RSS.
+ *
+ * Hooks are shell hooks that write the notification's number to a FIFO, so the
+ * hook latency includes starting sh. Everything the daemon reads and writes is
+ * kept in a temporary directory, so nothing needs a network or a desktop.
+ * Exits with 77, which meson counts as skipped, if dbus-daemon is missing, and
+ * with 1 if any notification was lost.
+ *
+ * Usage: notify-load DAEMON [-n COUNT] [-i INTERVAL_US] [-m server|monitor]
+ *                   [STREAM...]
+ *
+ * A stream is one of the names in STREAMS, or a spec such as
+ * body=4096,image=64x64,hints=8,hooks=2. */
+
+#include <dbus/dbus.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define DEFAULT_COUNT 500
+#define DEFAULT_INTERVAL_US 2000
+/* Notifications a flood keeps in flight, which is enough to keep every stage
+ * of the daemon busy without hiding latency behind an unbounded queue */
+#define WINDOW 64
+#define STARTUP_TIMEOUT_US 10000000
+#define DRAIN_TIMEOUT_US 30000000
+
+extern char **environ;
+
+struct Stream {
+	const char *name;
+	size_t body;
+	int width;
+	int height;
+	size_t hints;
+	size_t hooks;
+};
+
+static const struct Stream STREAMS[] = {
+	{ "small", 64, 0, 0, 1, 1 },
+	{ "body-4k", 4096, 0, 0, 2, 1 },
+	{ "icon", 64, 48, 48, 2, 1 },
+	{ "image", 64, 512, 512, 2, 1 },
+	{ "hints", 64, 0, 0, 16, 1 },
+	{ "hooks", 64, 0, 0, 2, 8 },
+};
+
+enum Mode {
+	MODE_SERVER = 1 << 0,
+	MODE_MONITOR = 1 << 1,
+};
+
+struct Sent {
+	double time;
+	dbus_uint32_t serial;
+	int replied;
+	size_t hooks_left;
+};
+
+/* One stream of notifications sent to a running daemon. */
+struct Run {
+	const struct Stream *stream;
+	int flood;
+	struct Sent *sent;
+	size_t n_sent;
+	size_t n_done;
+	double *reply_latencies;
+	size_t n_replies;
+	double *hook_latencies;
+	size_t n_hooks;
+	double last_event;
+};
+
+struct Bench {
+	const char *daemon;
+	/* Short enough that every path made in it fits in PATH_MAX */
+	char dir[256];
+	char fifo_path[PATH_MAX];
+	int fifo;
+	char line[256];
+	size_t line_length;
+	pid_t bus;
+	char address[1024];
+	DBusConnection *client;
+	/* The server a monitoring daemon watches, or NULL */
+	DBusConnection *server;
+	dbus_uint32_t server_ids;
+	pid_t pid;
+	enum Mode mode;
+	size_t count;
+	long interval_us;
+	/* Set when a hook of the startup notification runs */
+	int warmed_up;
+	unsigned char *pixels;
+	char *body;
+};
+
+static int parse_stream(const char *spec, struct Stream *stream) {
+	for (size_t i = 0; i < sizeof(STREAMS) / sizeof(*STREAMS); ++i) {
+		if (!strcmp(STREAMS[i].name, spec)) {
+			*stream = STREAMS[i];
+			return 1;
+		}
+	}
+	*stream = STREAMS[0];
+	stream->name = spec;
+	char *copy = strdup(spec);
+	char *save;
+	int ok = 1;
+	for (char *key = strtok_r(copy, ",", &save); key != NULL; key = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(key, '=');
+		if (value == NULL) {
+			ok = 0;
+			break;
+		}
+		*value++ = '\0';
+		if (!strcmp(key, "body")) {
+			stream->body = strtoul(value, NULL, 10);
+		} else if (!strcmp(key, "image")) {
+			if (sscanf(value, "%dx%d", &stream->width, &stream->height) != 2) ok = 0;
+		} else if (!strcmp(key, "hints")) {
+			stream->hints = strtoul(value, NULL, 10);
+		} else if (!strcmp(key, "hooks")) {
+			stream->hooks = strtoul(value, NULL, 10);
+		} else {
+			ok = 0;
+		}
+	}
+	free(copy);
+	if (!ok || stream->hooks == 0 || stream->width < 0 || stream->height < 0) {
+		fprintf(stderr, "Unknown stream %s\n", spec);
+		return 0;
+	}
+	return 1;
+}
+
+static int write_config(struct Bench *bench, const struct Stream *stream) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/config/i-spy-notify", bench->dir);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/config/i-spy-notify/i-spy-notify.json", bench->dir);
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+	fprintf(file, "{\n    \"hooks\": [\n");
+	for (size_t i = 0; i < stream->hooks; ++i) {
+		fprintf(
+			file,
+			"        {\n"
+			"            \"shell\": true,\n"
+			"            \"command\": \"echo \\\"$1 $2\\\" >> '%s'\",\n"
+			"            \"arguments\": [[\"summary\"], \"%zu\"%s]\n"
+			"        }%s\n",
+			bench->fifo_path,
+			i,
+			// Asking for the image makes the daemon convert it
+			stream->width > 0 ? ", [\"hints\", \"image-data\", \"path\"]" : "",
+			i + 1 < stream->hooks ? "," : ""
+		);
+	}
+	fprintf(file, "    ]\n}\n");
+	return fclose(file) == 0;
+}
+
+static void disconnect(DBusConnection *conn) {
+	dbus_connection_close(conn);
+	dbus_connection_unref(conn);
+}
+
+static int start_daemon(struct Bench *bench) {
+	char *const argv[] = { (char *)bench->daemon, "--headless", NULL };
+	char **env = make_environment(bench->address, bench->dir);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+	int error = posix_spawn(&bench->pid, bench->daemon, &actions, NULL, argv, env);
+	posix_spawn_file_actions_destroy(&actions);
+	free_environment(env);
+	if (error != 0) {
+		fprintf(stderr, "%s: %s\n", bench->daemon, strerror(error));
+		return 0;
+	}
+	return 1;
+}
+
+static void stop_daemon(struct Bench *bench) {
+	kill(bench->pid, SIGTERM);
+	waitpid(bench->pid, NULL, 0);
+	bench->pid = 0;
+}
+
+/* Returns the CPU time the daemon has used in microseconds. */
+static double get_cpu_us(pid_t pid) {
+	char path[64];
+	char buffer[1024];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) return 0;
+	size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+	fclose(file);
+	buffer[n] = '\0';
+	// The command name may hold spaces, so count fields from its end
+	char *fields = strrchr(buffer, ')');
+	unsigned long utime = 0;
+	unsigned long stime = 0;
+	if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+		return 0;
+	}
+	return (double)(utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+/* Returns the daemon's peak resident set in kB. */
+static long get_peak_rss_kb(pid_t pid) {
+	char path[64];
+	char line[256];
+	long kb = 0;
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) return 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "VmHWM: %ld", &kb) == 1) break;
+	}
+	fclose(file);
+	return kb;
+}
+
+static void append_hint(DBusMessageIter *hints, const char *key, int type, const void *value) {
+	char signature[2] = { (char)type, '\0' };
+	DBusMessageIter entry;
+	DBusMessageIter variant;
+	dbus_message_iter_open_container(hints, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+	dbus_message_iter_append_basic(&variant, type, value);
+	dbus_message_iter_close_container(&entry, &variant);
+	dbus_message_iter_close_container(hints, &entry);
+}
+
+static void append_image(DBusMessageIter *hints, const struct Stream *stream, const unsigned char *pixels) {
+	const char *key = "image-data";
+	dbus_int32_t width = stream->width;
+	dbus_int32_t height = stream->height;
+	dbus_int32_t rowstride = width * 4;
+	dbus_bool_t has_alpha = TRUE;
+	dbus_int32_t bits_per_sample = 8;
+	dbus_int32_t channels = 4;
+	int length = rowstride * height;
+	DBusMessageIter entry;
+	DBusMessageIter variant;
+	DBusMessageIter image;
+	DBusMessageIter bytes;
+	dbus_message_iter_open_container(hints, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "(iiibiiay)", &variant);
+	dbus_message_iter_open_container(&variant, DBUS_TYPE_STRUCT, NULL, &image);
+	dbus_message_iter_append_basic(&image, DBUS_TYPE_INT32, &width);
+	dbus_message_iter_append_basic(&image, DBUS_TYPE_INT32, &height);
+	dbus_message_iter_append_basic(&image, DBUS_TYPE_INT32, &rowstride);
+	dbus_message_iter_append_basic(&image, DBUS_TYPE_BOOLEAN, &has_alpha);
+	dbus_message_iter_append_basic(&image, DBUS_TYPE_INT32, &bits_per_sample);
+	dbus_message_iter_append_basic(&image, DBUS_TYPE_INT32, &channels);
+	dbus_message_iter_open_container(&image, DBUS_TYPE_ARRAY, "y", &bytes);
+	dbus_message_iter_append_fixed_array(&bytes, DBUS_TYPE_BYTE, &pixels, length);
+	dbus_message_iter_close_container(&image, &bytes);
+	dbus_message_iter_close_container(&variant, &image);
+	dbus_message_iter_close_container(&entry, &variant);
+	dbus_message_iter_close_container(hints, &entry);
+}
+
+/* Builds a Notify call whose summary is its number, or "warmup". */
+static DBusMessage *new_notify(struct Bench *bench, const struct Stream *stream, const char *summary) {
+	DBusMessage *message = dbus_message_new_method_call(
+		"org.freedesktop.Notifications",
+		"/org/freedesktop/Notifications",
+		"org.freedesktop.Notifications",
+		"Notify"
+	);
+	const char *app_name = "notify-load";
+	const char *app_icon = "";
+	const char *body = bench->body;
+	dbus_uint32_t replaces_id = 0;
+	dbus_int32_t expire_timeout = -1;
+	DBusMessageIter iter;
+	DBusMessageIter actions;
+	DBusMessageIter hints;
+	dbus_message_iter_init_append(message, &iter);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &app_name);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &replaces_id);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &app_icon);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &summary);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &body);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &actions);
+	dbus_message_iter_close_container(&iter, &actions);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &hints);
+	for (size_t i = 0; i < stream->hints; ++i) {
+		unsigned char urgency = 1;
+		const char *category = "im.received";
+		const char *desktop_entry = "notify-load";
+		const char *value = "value";
+		char key[48];
+		if (i == 0) {
+			append_hint(&hints, "urgency", DBUS_TYPE_BYTE, &urgency);
+		} else if (i == 1) {
+			append_hint(&hints, "category", DBUS_TYPE_STRING, &category);
+		} else if (i == 2) {
+			append_hint(&hints, "desktop-entry", DBUS_TYPE_STRING, &desktop_entry);
+		} else {
+			snprintf(key, sizeof(key), "x-notify-load-%zu", i);
+			append_hint(&hints, key, DBUS_TYPE_STRING, &value);
+		}
+	}
+	if (stream->width > 0 && stream->height > 0) {
+		// A different image each time, so that no cache can answer for it
+		memcpy(bench->pixels, summary, strlen(summary));
+		append_image(&hints, stream, bench->pixels);
+	}
+	dbus_message_iter_close_container(&iter, &hints);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &expire_timeout);
+	return message;
+}
+
+static void finish(struct Run *run, struct Sent *sent, double now) {
+	if (!sent->replied || sent->hooks_left > 0) return;
+	++run->n_done;
+	if (now > run->last_event) run->last_event = now;
+}
+
+static struct Sent *find_sent(struct Run *run, dbus_uint32_t serial) {
+	if (run == NULL) return NULL;
+	// Serials only go up, so the calls are sorted by them
+	size_t low = 0;
+	size_t high = run->n_sent;
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		if (run->sent[middle].serial < serial) low = middle + 1;
+		else high = middle;
+	}
+	return low < run->n_sent && run->sent[low].serial == serial ? &run->sent[low] : NULL;
+}
+
+static void read_client(struct Bench *bench, struct Run *run, double now) {
+	DBusMessage *message;
+	while ((message = dbus_connection_pop_message(bench->client)) != NULL) {
+		int type = dbus_message_get_type(message);
+		struct Sent *sent = NULL;
+		if (type == DBUS_MESSAGE_TYPE_METHOD_RETURN || type == DBUS_MESSAGE_TYPE_ERROR) {
+			sent = find_sent(run, dbus_message_get_reply_serial(message));
+		}
+		if (sent != NULL && !sent->replied) {
+			if (type == DBUS_MESSAGE_TYPE_ERROR) {
+				fprintf(stderr, "Notify failed: %s\n", dbus_message_get_error_name(message));
+			} else if (bench->mode == MODE_SERVER) {
+				run->reply_latencies[run->n_replies++] = now - sent->time;
+			}
+			// A failed call counts as answered, and is lost if its
+			// hooks never run
+			sent->replied = 1;
+			finish(run, sent, now);
+		}
+		dbus_message_unref(message);
+	}
+}
+
+/* Plays the notification server that a monitoring daemon watches. */
+static void read_server(struct Bench *bench) {
+	DBusMessage *message;
+	while ((message = dbus_connection_pop_message(bench->server)) != NULL) {
+		if (dbus_message_is_method_call(message, "org.freedesktop.Notifications", "Notify")) {
+			DBusMessage *reply = dbus_message_new_method_return(message);
+			dbus_uint32_t id = ++bench->server_ids;
+			dbus_message_append_args(reply, DBUS_TYPE_UINT32, &id, DBUS_TYPE_INVALID);
+			dbus_connection_send(bench->server, reply, NULL);
+			dbus_message_unref(reply);
+		}
+		dbus_message_unref(message);
+	}
+}
+
+static void read_hook_line(struct Bench *bench, struct Run *run, const char *line, double now) {
+	char *end;
+	unsigned long number = strtoul(line, &end, 10);
+	if (end == line) {
+		if (!strncmp(line, "warmup", 6)) bench->warmed_up = 1;
+		return;
+	}
+	if (run == NULL || number >= run->n_sent || run->sent[number].hooks_left == 0) return;
+	struct Sent *sent = &run->sent[number];
+	run->hook_latencies[run->n_hooks++] = now - sent->time;
+	--sent->hooks_left;
+	finish(run, sent, now);
+}
+
+static void read_hooks(struct Bench *bench, struct Run *run, double now) {
+	ssize_t n;
+	while ((n = read(bench->fifo, bench->line + bench->line_length, sizeof(bench->line) - 1 - bench->line_length)) > 0) {
+		bench->line_length += n;
+		bench->line[bench->line_length] = '\0';
+		char *start = bench->line;
+		char *newline;
+		while ((newline = strchr(start, '\n')) != NULL) {
+			*newline = '\0';
+			read_hook_line(bench, run, start, now);
+			start = newline + 1;
+		}
+		bench->line_length -= start - bench->line;
+		memmove(bench->line, start, bench->line_length);
+		// A line that fills the buffer is not one the hooks wrote
+		if (bench->line_length == sizeof(bench->line) - 1) bench->line_length = 0;
+	}
+}
+
+static void add_connection(struct pollfd *fds, size_t *n, DBusConnection *conn) {
+	int fd;
+	if (conn == NULL || !dbus_connection_get_unix_fd(conn, &fd)) return;
+	fds[*n].fd = fd;
+	fds[*n].events = POLLIN | (dbus_connection_has_messages_to_send(conn) ? POLLOUT : 0);
+	++*n;
+}
+
+/* Waits up to timeout_us for something to happen, and handles it. */
+static void pump(struct Bench *bench, struct Run *run, double timeout_us) {
+	struct pollfd fds[3];
+	size_t n = 0;
+	fds[n].fd = bench->fifo;
+	fds[n].events = POLLIN;
+	++n;
+	add_connection(fds, &n, bench->client);
+	add_connection(fds, &n, bench->server);
+	int timeout_ms = timeout_us <= 0 ? 0 : (int)((timeout_us + 999) / 1000);
+	if (poll(fds, n, timeout_ms) < 0 && errno != EINTR) perror("poll");
+	double now = now_us();
+	read_hooks(bench, run, now);
+	dbus_connection_read_write(bench->client, 0);
+	read_client(bench, run, now);
+	if (bench->server != NULL) {
+		dbus_connection_read_write(bench->server, 0);
+		read_server(bench);
+	}
+}
+
+static int daemon_exited(struct Bench *bench) {
+	int status;
+	if (waitpid(bench->pid, &status, WNOHANG) != bench->pid) return 0;
+	fprintf(stderr, "%s exited with status %d\n", bench->daemon, status);
+	bench->pid = 0;
+	return 1;
+}
+
+/* Sends notifications until a hook runs for one, which is when the daemon
+ * has connected and loaded its config, then lets the rest drain. */
+static int warm_up(struct Bench *bench, const struct Stream *stream) {
+	double start = now_us();
+	double next = start;
+	bench->warmed_up = 0;
+	while (!bench->warmed_up) {
+		double now = now_us();
+		if (now - start > STARTUP_TIMEOUT_US || daemon_exited(bench)) {
+			fprintf(stderr, "%s did not run a hook\n", bench->daemon);
+			return 0;
+		}
+		if (now >= next) {
+			DBusMessage *message = new_notify(bench, stream, "warmup");
+			dbus_connection_send(bench->client, message, NULL);
+			dbus_message_unref(message);
+			next = now + 100000;
+		}
+		pump(bench, NULL, next - now);
+	}
+	double end = now_us() + 300000;
+	for (double now = now_us(); now < end; now = now_us()) pump(bench, NULL, end - now);
+	return 1;
+}
+
+static void send_notification(struct Bench *bench, struct Run *run) {
+	char summary[32];
+	snprintf(summary, sizeof(summary), "%zu", run->n_sent);
+	DBusMessage *message = new_notify(bench, run->stream, summary);
+	struct Sent *sent = &run->sent[run->n_sent++];
+	sent->time = now_us();
+	sent->replied = 0;
+	sent->hooks_left = run->stream->hooks;
+	dbus_connection_send(bench->client, message, &sent->serial);
+	dbus_message_unref(message);
+}
+
+/* Sends count notifications, either one every interval or keeping WINDOW in
+ * flight, and waits for their replies and hooks. */
+static void run_stream(struct Bench *bench, struct Run *run, const struct Stream *stream, int flood) {
+	memset(run, 0, sizeof(*run));
+	run->stream = stream;
+	run->flood = flood;
+	run->sent = calloc(bench->count, sizeof(struct Sent));
+	run->reply_latencies = calloc(bench->count, sizeof(double));
+	run->hook_latencies = calloc(bench->count * stream->hooks, sizeof(double));
+	double start = now_us();
+	double deadline = start + DRAIN_TIMEOUT_US;
+	while (run->n_sent < bench->count) {
+		double now = now_us();
+		double due = start + (double)run->n_sent * bench->interval_us;
+		if (flood ? run->n_sent - run->n_done < WINDOW : now >= due) {
+			send_notification(bench, run);
+			continue;
+		}
+		if (now >= deadline || daemon_exited(bench)) return;
+		size_t done = run->n_done;
+		pump(bench, run, flood ? deadline - now : due - now);
+		if (run->n_done != done) deadline = now_us() + DRAIN_TIMEOUT_US;
+	}
+	deadline = now_us() + DRAIN_TIMEOUT_US;
+	for (double now = now_us(); run->n_done < run->n_sent && now < deadline; now = now_us()) {
+		pump(bench, run, deadline - now);
+	}
+}
+
+static void free_run(struct Run *run) {
+	free(run->sent);
+	free(run->reply_latencies);
+	free(run->hook_latencies);
+}
+
+static void print_percentiles(double *samples, size_t n) {
+	if (n == 0) {
+		printf(" %7s %7s %7s", "-", "-", "-");
+		return;
+	}
+	qsort(samples, n, sizeof(double), compare);
+	printf(" %7.0f %7.0f %7.0f", samples[n / 2], samples[n * 99 / 100], samples[n - 1]);
+}
+
+/* Runs one stream against a fresh daemon, returning how many notifications
+ * were lost or -1 if the daemon could not be run. */
+static long measure(struct Bench *bench, const struct Stream *stream) {
+	if (!write_config(bench, stream)) return -1;
+	if (bench->mode == MODE_MONITOR) {
+		DBusError error = DBUS_ERROR_INIT;
+		bench->server = connect_to_bus(bench->address);
+		if (bench->server == NULL) return -1;
+		if (dbus_bus_request_name(bench->server, "org.freedesktop.Notifications", 0, &error) == -1) {
+			fprintf(stderr, "%s\n", error.message);
+			dbus_error_free(&error);
+			return -1;
+		}
+	}
+	if (!start_daemon(bench) || !warm_up(bench, stream)) return -1;
+
+	// Latency is measured at a steady rate, so that it is not queueing
+	struct Run paced;
+	run_stream(bench, &paced, stream, 0);
+	struct Run flood;
+	double cpu_start = get_cpu_us(bench->pid);
+	run_stream(bench, &flood, stream, 1);
+	double cpu = get_cpu_us(bench->pid) - cpu_start;
+	long rss_kb = get_peak_rss_kb(bench->pid);
+	if (bench->pid != 0) stop_daemon(bench);
+	if (bench->server != NULL) {
+		disconnect(bench->server);
+		bench->server = NULL;
+	}
+
+	double elapsed = flood.n_sent > 0 ? flood.last_event - flood.sent[0].time : 0;
+	printf("%-16s %-7s", stream->name, bench->mode == MODE_SERVER ? "server" : "monitor");
+	print_percentiles(paced.reply_latencies, paced.n_replies);
+	print_percentiles(paced.hook_latencies, paced.n_hooks);
+	printf(
+		" %9.0f %6.1f %7.1f",
+		elapsed > 0 ? flood.n_done * 1e6 / elapsed : 0,
+		elapsed > 0 ? cpu * 100 / elapsed : 0,
+		rss_kb / 1024.0
+	);
+	long lost = (long)(paced.n_sent - paced.n_done + flood.n_sent - flood.n_done);
+	if (lost > 0) printf("  %ld lost", lost);
+	printf("\n");
+	fflush(stdout);
+	free_run(&paced);
+	free_run(&flood);
+	return lost;
+}
+
+static int setup(struct Bench *bench) {
+	if (!make_temporary_directory(bench->dir, sizeof(bench->dir))) return 0;
+	snprintf(bench->fifo_path, sizeof(bench->fifo_path), "%s/hooks", bench->dir);
+	if (mkfifo(bench->fifo_path, 0600) != 0) {
+		perror(bench->fifo_path);
+		return 0;
+	}
+	// Opened for writing too, so that it never reads as closed
+	bench->fifo = open(bench->fifo_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (bench->fifo < 0) {
+		perror(bench->fifo_path);
+		return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	struct Bench bench;
+	memset(&bench, 0, sizeof(bench));
+	bench.fifo = -1;
+	bench.count = DEFAULT_COUNT;
+	bench.interval_us = DEFAULT_INTERVAL_US;
+	unsigned modes = MODE_SERVER | MODE_MONITOR;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:i:m:")) != -1) {
+		if (opt == 'n') {
+			bench.count = strtoul(optarg, NULL, 10);
+		} else if (opt == 'i') {
+			bench.interval_us = strtol(optarg, NULL, 10);
+		} else if (opt == 'm' && !strcmp(optarg, "server")) {
+			modes = MODE_SERVER;
+		} else if (opt == 'm' && !strcmp(optarg, "monitor")) {
+			modes = MODE_MONITOR;
+		} else {
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind >= argc || bench.count == 0) {
+		fprintf(stderr, "Usage: %s DAEMON [-n COUNT] [-i INTERVAL_US] [-m server|monitor] [STREAM...]\n", argv[0]);
+		return 2;
+	}
+	bench.daemon = argv[optind++];
+	size_t n_streams = optind < argc ? (size_t)(argc - optind) : sizeof(STREAMS) / sizeof(*STREAMS);
+	struct Stream *streams = calloc(n_streams, sizeof(struct Stream));
+	size_t body_size = 0;
+	size_t image_size = 0;
+	for (size_t i = 0; i < n_streams; ++i) {
+		if (optind < argc) {
+			if (!parse_stream(argv[optind + i], &streams[i])) return 2;
+		} else {
+			streams[i] = STREAMS[i];
+		}
+		if (streams[i].body > body_size) body_size = streams[i].body;
+		size_t size = (size_t)streams[i].width * streams[i].height * 4;
+		if (size > image_size) image_size = size;
+	}
+	bench.body = malloc(body_size + 1);
+	memset(bench.body, 'x', body_size);
+	bench.body[body_size] = '\0';
+	// Photographs compress about as badly as noise does
+	bench.pixels = malloc(image_size + 32);
+	unsigned state = 1;
+	for (size_t i = 0; i < image_size + 32; ++i) {
+		state = state * 1103515245 + 12345;
+		bench.pixels[i] = state >> 24;
+	}
+
+	int status = 0;
+	if (!setup(&bench)) {
+		status = 1;
+	} else {
+		char listen[PATH_MAX + 16];
+		snprintf(listen, sizeof(listen), "--address=unix:dir=%s", bench.dir);
+		char *const bus_argv[] = {
+			"dbus-daemon", "--session", "--nofork", "--nopidfile", "--print-address=1", listen, NULL
+		};
+		int started = start_bus(bus_argv, environ, &bench.bus, bench.address, sizeof(bench.address));
+		if (started <= 0) {
+			status = started == 0 ? 77 : 1;
+		} else if ((bench.client = connect_to_bus(bench.address)) == NULL) {
+			status = 1;
+		}
+	}
+	if (status == 0) {
+		printf(
+			"%-16s %-7s %23s %23s %9s %6s %7s\n",
+			"",
+			"",
+			"reply us p50/p99/max",
+			"hook us p50/p99/max",
+			"notify/s",
+			"cpu %",
+			"rss MB"
+		);
+		long lost = 0;
+		for (enum Mode mode = MODE_SERVER; mode <= MODE_MONITOR && lost >= 0; mode <<= 1) {
+			if (!(modes & mode)) continue;
+			bench.mode = mode;
+			for (size_t i = 0; i < n_streams && lost >= 0; ++i) {
+				// Each stream gets a fresh daemon, since streams differ
+				// in their hooks
+				lost = measure(&bench, &streams[i]);
+				if (bench.pid != 0) stop_daemon(&bench);
+				if (lost != 0) status = 1;
+			}
+		}
+	}
+
+	if (bench.server != NULL) disconnect(bench.server);
+	if (bench.client != NULL) disconnect(bench.client);
+	if (bench.bus > 0) {
+		kill(bench.bus, SIGTERM);
+		waitpid(bench.bus, NULL, 0);
+	}
+	if (bench.fifo >= 0) close(bench.fifo);
+	if (bench.dir[0] != '\0') remove_directory(bench.dir);
+	free(streams);
+	free(bench.body);
+	free(bench.pixels);
+	return status;
+}
@@ -0,0 +1,100 @@
+/* Compares the latency of starting a hook with fork+execvp, as the daemon used
+ * to, against posix_spawnp, while the process holds a given amount of memory.
+ *
+ * Usage: spawn-latency [RSS_MB...], which defaults to 16, 128 and 512 MB */
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 200
+
+extern char **environ;
+
+static char *const ARGV[] = { "true", NULL };
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Time until the parent may go on, which is what stalls the main loop. */
+static double fork_exec(void) {
+	double start = now_us();
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		abort();
+	}
+	if (pid == 0) {
+		execvp(ARGV[0], ARGV);
+		_exit(127);
+	}
+	double elapsed = now_us() - start;
+	waitpid(pid, NULL, 0);
+	return elapsed;
+}
+
+static double spawn(void) {
+	pid_t pid;
+	double start = now_us();
+	int error = posix_spawnp(&pid, ARGV[0], NULL, NULL, ARGV, environ);
+	double elapsed = now_us() - start;
+	if (error != 0) {
+		fprintf(stderr, "posix_spawnp: %s\n", strerror(error));
+		abort();
+	}
+	waitpid(pid, NULL, 0);
+	return elapsed;
+}
+
+static int compare(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void measure(const char *name, double (*fn)(void), size_t rss_mb) {
+	double samples[RUNS];
+	double total = 0;
+	for (int i = 0; i < RUNS; ++i) {
+		samples[i] = fn();
+		total += samples[i];
+	}
+	qsort(samples, RUNS, sizeof(double), compare);
+	printf(
+		"%-12s %6zu MB  mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n",
+		name,
+		rss_mb,
+		total / RUNS,
+		samples[RUNS / 2],
+		samples[RUNS * 99 / 100]
+	);
+}
+
+int main(int argc, char **argv) {
+	static const size_t default_sizes[] = { 16, 128, 512 };
+	size_t count = argc > 1 ? (size_t)argc - 1 : sizeof(default_sizes) / sizeof(*default_sizes);
+	char *memory = NULL;
+	for (size_t i = 0; i < count; ++i) {
+		size_t rss_mb = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes[i];
+		// Touch every page so that fork has a page table to copy, like a
+		// daemon whose caches have filled up
+		free(memory);
+		memory = malloc(rss_mb << 20);
+		if (memory == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		memset(memory, 1, rss_mb << 20);
+		measure("fork+exec", fork_exec, rss_mb);
+		measure("posix_spawn", spawn, rss_mb);
+	}
+	free(memory);
+	return 0;
+}
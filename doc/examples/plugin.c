@@ -0,0 +1,70 @@
+/* Counts notifications per application and prints the counts when the
+ * configuration is reloaded. Build with:
+ *
+ *     cc -shared -fPIC -o count.so plugin.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <i-spy-notify-plugin.h>
+
+#define MAX_APPS 64
+
+struct State {
+	FILE *file;
+	char *names[MAX_APPS];
+	unsigned long counts[MAX_APPS];
+	size_t n_apps;
+};
+
+static const struct ISpyNotifyHost *host;
+
+static int start(const char *const *argv, void **state) {
+	struct State *counts = calloc(1, sizeof(struct State));
+	if (counts == NULL) return 1;
+	counts->file = argv[1] != NULL ? fopen(argv[1], "a") : stderr;
+	if (counts->file == NULL) {
+		free(counts);
+		return 1;
+	}
+	*state = counts;
+	return 0;
+}
+
+static void notify(void *state, const struct ISpyNotifyNotification *notification) {
+	struct State *counts = state;
+	static const char *const PATH[] = { "app_name" };
+	struct ISpyNotifyValue app_name = host->get(notification, PATH, 1);
+	if (app_name.type != ISPY_NOTIFY_VALUE_STRING) return;
+	size_t i = 0;
+	while (i < counts->n_apps && strcmp(counts->names[i], app_name.string) != 0) ++i;
+	if (i == counts->n_apps) {
+		if (i == MAX_APPS) return;
+		// Strings from the notification do not outlive the call
+		counts->names[i] = strdup(app_name.string);
+		++counts->n_apps;
+	}
+	++counts->counts[i];
+}
+
+static void stop(void *state) {
+	struct State *counts = state;
+	for (size_t i = 0; i < counts->n_apps; ++i) {
+		fprintf(counts->file, "%s\t%lu\n", counts->names[i], counts->counts[i]);
+		free(counts->names[i]);
+	}
+	if (counts->file != stderr) fclose(counts->file);
+	free(counts);
+}
+
+static const struct ISpyNotifyPlugin PLUGIN = {
+	ISPY_NOTIFY_PLUGIN_VERSION,
+	start,
+	notify,
+	stop,
+};
+
+const struct ISpyNotifyPlugin *ispy_notify_plugin_v1(const struct ISpyNotifyHost *daemon) {
+	host = daemon;
+	return &PLUGIN;
+}
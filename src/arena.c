@@ -0,0 +1,107 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "arena.h"
+
+#define ALIGNMENT (sizeof(max_align_t))
+#define ALIGN(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+struct Block {
+	struct Block *next;
+	gsize size;
+	gsize used;
+	max_align_t data[];
+};
+
+struct Adopted {
+	struct Adopted *next;
+	gpointer memory;
+};
+
+struct Arena {
+	struct Block *blocks;
+	struct Adopted *adopted;
+	gsize block_size;
+};
+
+static struct Block *new_block(gsize size) {
+	struct Block *block = g_malloc(sizeof(struct Block) + size);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+struct Arena *arena_new(gsize block_size) {
+	block_size = ALIGN(MAX(block_size, 2 * sizeof(struct Arena)));
+	struct Block *block = new_block(block_size);
+	struct Arena *arena = (struct Arena *)block->data;
+	block->used = ALIGN(sizeof(struct Arena));
+	arena->blocks = block;
+	arena->adopted = NULL;
+	arena->block_size = block_size;
+	return arena;
+}
+
+gpointer arena_alloc(struct Arena *arena, gsize size) {
+	size = ALIGN(size);
+	struct Block *block = arena->blocks;
+	if (block->size - block->used < size) {
+		if (size > arena->block_size / 4) {
+			// Large strings, such as encoded images, get a block of their own
+			// behind the current one, which keeps its free space
+			struct Block *large = new_block(size);
+			large->next = block->next;
+			block->next = large;
+			large->used = size;
+			return large->data;
+		}
+		block = new_block(arena->block_size);
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+	gpointer memory = (char *)block->data + block->used;
+	block->used += size;
+	return memory;
+}
+
+gchar *arena_strdup(struct Arena *arena, const char *s) {
+	if (s == NULL) return NULL;
+	gsize size = strlen(s) + 1;
+	return memcpy(arena_alloc(arena, size), s, size);
+}
+
+gchar *arena_printf(struct Arena *arena, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	va_list copy;
+	va_copy(copy, args);
+	int length = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+	gchar *s = arena_alloc(arena, length + 1);
+	vsnprintf(s, length + 1, format, args);
+	va_end(args);
+	return s;
+}
+
+gchar *arena_adopt(struct Arena *arena, gchar *s) {
+	if (s == NULL) return NULL;
+	struct Adopted *adopted = arena_alloc(arena, sizeof(struct Adopted));
+	adopted->memory = s;
+	adopted->next = arena->adopted;
+	arena->adopted = adopted;
+	return s;
+}
+
+void arena_free(struct Arena *arena) {
+	for (struct Adopted *adopted = arena->adopted; adopted != NULL; adopted = adopted->next) {
+		g_free(adopted->memory);
+	}
+	// The arena itself is in the last block of the list
+	struct Block *block = arena->blocks;
+	while (block != NULL) {
+		struct Block *next = block->next;
+		g_free(block);
+		block = next;
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdarg.h>
+#include <glib.h>
+
+/* Memory for the lifetime of one message, freed all at once. The arena lives
+ * in its own first block, so a message that fits takes a single allocation. */
+struct Arena;
+
+struct Arena *arena_new(gsize block_size);
+gpointer arena_alloc(struct Arena *arena, gsize size);
+gchar *arena_strdup(struct Arena *arena, const char *s);
+gchar *arena_printf(struct Arena *arena, const char *format, ...) G_GNUC_PRINTF(2, 3);
+/* Hands s, allocated with g_malloc, to the arena, which frees it with the
+ * rest. */
+gchar *arena_adopt(struct Arena *arena, gchar *s);
+void arena_free(struct Arena *arena);
+
+#endif
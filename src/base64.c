@@ -0,0 +1,153 @@
+#include "base64.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86
+#endif
+
+static const char ALPHABET[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Encodes whole blocks from the start of data and returns how many input
+ * bytes it consumed, always a multiple of 3. */
+typedef gsize (*EncodeBlocksFunction)(const guchar *data, gsize size, gchar *out);
+
+static gsize encode_blocks_scalar(const guchar *data, gsize size, gchar *out) {
+	gsize done = size - size % 3;
+	for (gsize i = 0; i < done; i += 3) {
+		guint32 bits = (guint32)data[i] << 16 | (guint32)data[i + 1] << 8 | data[i + 2];
+		*out++ = ALPHABET[bits >> 18];
+		*out++ = ALPHABET[(bits >> 12) & 0x3f];
+		*out++ = ALPHABET[(bits >> 6) & 0x3f];
+		*out++ = ALPHABET[bits & 0x3f];
+	}
+	return done;
+}
+
+#ifdef HAVE_X86
+/* The vector encoders follow Muła and Lemire, "Faster Base64 Encoding and
+ * Decoding using AVX2 Instructions". Each lane spreads 12 input bytes over 16
+ * bytes of 6-bit indices, then turns the indices into characters by adding an
+ * offset picked with pshufb. */
+
+__attribute__((target("ssse3")))
+static __m128i split_ssse3(__m128i in) {
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3")))
+static __m128i translate_ssse3(__m128i indices) {
+	// 0..25 map to 13, 26..51 to 0, 52..61 to 1..10, 62 to 11 and 63 to 12
+	__m128i offset = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	__m128i is_upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	offset = _mm_or_si128(offset, _mm_and_si128(is_upper, _mm_set1_epi8(13)));
+	__m128i offsets = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0
+	);
+	return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, offset));
+}
+
+__attribute__((target("ssse3")))
+static gsize encode_blocks_ssse3(const guchar *data, gsize size, gchar *out) {
+	gsize done = 0;
+	// Each load reads 16 bytes to use 12 of them
+	for (; size - done >= 16; done += 12, out += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i *)(data + done));
+		_mm_storeu_si128((__m128i *)out, translate_ssse3(split_ssse3(in)));
+	}
+	return done + encode_blocks_scalar(data + done, size - done, out);
+}
+
+__attribute__((target("avx2")))
+static __m256i split_avx2(__m256i in) {
+	in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1
+	));
+	__m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+	__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+	__m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+	__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(t1, t3);
+}
+
+__attribute__((target("avx2")))
+static __m256i translate_avx2(__m256i indices) {
+	__m256i offset = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+	__m256i is_upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+	offset = _mm256_or_si256(offset, _mm256_and_si256(is_upper, _mm256_set1_epi8(13)));
+	__m256i offsets = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0
+	);
+	return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, offset));
+}
+
+__attribute__((target("avx2")))
+static gsize encode_blocks_avx2(const guchar *data, gsize size, gchar *out) {
+	gsize done = 0;
+	// The upper lane is loaded from 12 bytes in, so 28 bytes are read to use
+	// 24 of them
+	for (; size - done >= 28; done += 24, out += 32) {
+		__m128i low = _mm_loadu_si128((const __m128i *)(data + done));
+		__m128i high = _mm_loadu_si128((const __m128i *)(data + done + 12));
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		_mm256_storeu_si256((__m256i *)out, translate_avx2(split_avx2(in)));
+	}
+	return done + encode_blocks_ssse3(data + done, size - done, out);
+}
+#endif
+
+static EncodeBlocksFunction select_encoder(void) {
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return encode_blocks_avx2;
+	if (__builtin_cpu_supports("ssse3")) return encode_blocks_ssse3;
+#endif
+	return encode_blocks_scalar;
+}
+
+static EncodeBlocksFunction get_encoder(void) {
+	static gsize encoder = 0;
+	if (g_once_init_enter(&encoder)) {
+		g_once_init_leave(&encoder, (gsize)select_encoder());
+	}
+	return (EncodeBlocksFunction)encoder;
+}
+
+gsize base64_encoded_length(gsize size) {
+	return (size + 2) / 3 * 4;
+}
+
+static void encode_with(EncodeBlocksFunction encode_blocks, const guchar *data, gsize size, gchar *out) {
+	gsize done = encode_blocks(data, size, out);
+	out += done / 3 * 4;
+	gsize left = size - done;
+	if (left > 0) {
+		guint32 bits = (guint32)data[done] << 16;
+		if (left > 1) bits |= (guint32)data[done + 1] << 8;
+		*out++ = ALPHABET[bits >> 18];
+		*out++ = ALPHABET[(bits >> 12) & 0x3f];
+		*out++ = left > 1 ? ALPHABET[(bits >> 6) & 0x3f] : '=';
+		*out++ = '=';
+	}
+	*out = '\0';
+}
+
+void base64_encode(const guchar *data, gsize size, gchar *out) {
+	encode_with(get_encoder(), data, size, out);
+}
+
+gchar *base64_encode_new(const guchar *data, gsize size) {
+	gchar *out = g_malloc(base64_encoded_length(size) + 1);
+	base64_encode(data, size, out);
+	return out;
+}
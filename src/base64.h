@@ -0,0 +1,17 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <glib.h>
+
+/* Standard base64 with padding, byte-for-byte the same as g_base64_encode.
+ * Blocks of input are encoded with SSSE3 or AVX2 when the CPU has them. */
+
+/* Bytes base64_encode writes for size bytes of input, not counting the NUL. */
+gsize base64_encoded_length(gsize size);
+/* Writes the encoding of data and a NUL to out, which must have room for
+ * base64_encoded_length(size) + 1 bytes. */
+void base64_encode(const guchar *data, gsize size, gchar *out);
+/* The encoding of data in a buffer allocated with g_malloc. */
+gchar *base64_encode_new(const guchar *data, gsize size);
+
+#endif
@@ -0,0 +1,119 @@
+#include <string.h>
+#include "batch.h"
+
+struct Batch {
+	struct Loop *loop;
+	struct BatchSettings settings;
+	BatchFlushFunction fn;
+	void *data;
+	void *hook;
+	GPtrArray *notifications;
+	unsigned timeout;
+};
+
+/* Returns the id used to coalesce updates. Notifications that replace nothing
+ * are only coalesced with their own updates, through the id the server gave
+ * them. */
+static guint64 get_notification_id(const struct Notification *notification) {
+	struct Value replaces_id = notification_get(notification, SLOT_REPLACES_ID);
+	if (replaces_id.type == VALUE_INT && replaces_id.number != 0) return replaces_id.number;
+	struct Value id = notification_get(notification, SLOT_ID);
+	return id.type == VALUE_INT ? id.number : 0;
+}
+
+static dbus_bool_t coalesces_with(
+	enum Coalesce coalesce,
+	const struct Notification *a,
+	const struct Notification *b
+) {
+	switch (coalesce) {
+	case COALESCE_NONE:
+		return FALSE;
+	case COALESCE_REPLACES_ID: {
+		guint64 id = get_notification_id(a);
+		return id != 0 && id == get_notification_id(b);
+	}
+	case COALESCE_APP_NAME: {
+		// Notifications seen only as they closed have no app_name, and are
+		// never coalesced
+		struct Value name = notification_get(a, SLOT_APP_NAME);
+		struct Value other = notification_get(b, SLOT_APP_NAME);
+		return (
+			name.type == VALUE_STRING &&
+			other.type == VALUE_STRING &&
+			!strcmp(name.string, other.string)
+		);
+	}
+	}
+	return FALSE;
+}
+
+static void on_timeout(void *data) {
+	struct Batch *batch = data;
+	batch->timeout = 0;
+	batch_flush(batch);
+}
+
+struct Batch *batch_new(
+	struct Loop *loop,
+	const struct BatchSettings *settings,
+	BatchFlushFunction fn,
+	void *data,
+	void *hook
+) {
+	struct Batch *batch = g_new0(struct Batch, 1);
+	batch->loop = loop;
+	batch->settings = *settings;
+	if (batch->settings.max_size == 0) batch->settings.max_size = 1;
+	batch->fn = fn;
+	batch->data = data;
+	batch->hook = hook;
+	batch->notifications = g_ptr_array_new_with_free_func((GDestroyNotify)notification_unref);
+	return batch;
+}
+
+void batch_add(struct Batch *batch, struct Notification *notification) {
+	// Only the newest state of a coalesced notification matters
+	for (guint i = 0; i < batch->notifications->len; ++i) {
+		struct Notification *old = g_ptr_array_index(batch->notifications, i);
+		if (coalesces_with(batch->settings.coalesce, old, notification)) {
+			g_ptr_array_remove_index(batch->notifications, i);
+			break;
+		}
+	}
+	g_ptr_array_add(batch->notifications, notification_ref(notification));
+
+	if (batch->notifications->len >= batch->settings.max_size) {
+		batch_flush(batch);
+	} else if (batch->timeout == 0) {
+		batch->timeout = loop_add_timeout(batch->loop, batch->settings.max_delay_ms, on_timeout, batch);
+	}
+}
+
+void batch_flush(struct Batch *batch) {
+	if (batch->timeout != 0) {
+		loop_remove_timeout(batch->loop, batch->timeout);
+		batch->timeout = 0;
+	}
+	if (batch->notifications->len == 0) return;
+
+	json_object *notifications = json_object_new_array_ext(batch->notifications->len);
+	// A batch can be as large as its hook allows, so this is not on the stack
+	struct ImageFile **images = g_new(struct ImageFile *, batch->notifications->len);
+	size_t n_images = 0;
+	for (guint i = 0; i < batch->notifications->len; ++i) {
+		struct Notification *notification = g_ptr_array_index(batch->notifications, i);
+		json_object_array_add(notifications, json_object_get(notification_get_json(notification)));
+		if (notification->image_file != NULL) images[n_images++] = notification->image_file;
+	}
+	batch->fn(notifications, images, n_images, batch->data, batch->hook);
+	g_free(images);
+	json_object_put(notifications);
+	g_ptr_array_set_size(batch->notifications, 0);
+}
+
+void batch_free(struct Batch *batch) {
+	batch_flush(batch);
+	g_ptr_array_unref(batch->notifications);
+	g_free(batch);
+}
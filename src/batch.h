@@ -0,0 +1,49 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <glib.h>
+#include <json-c/json.h>
+#include "image.h"
+#include "loop.h"
+#include "notification.h"
+
+enum Coalesce {
+	COALESCE_NONE,
+	COALESCE_REPLACES_ID,
+	COALESCE_APP_NAME,
+};
+
+struct BatchSettings {
+	size_t max_size;
+	int max_delay_ms;
+	enum Coalesce coalesce;
+};
+
+/* Called with a JSON array of the collected notifications and every image
+ * they refer to. Both are only borrowed. */
+typedef void (*BatchFlushFunction)(
+	json_object *notifications,
+	struct ImageFile *const *images,
+	size_t n_images,
+	void *data,
+	void *hook
+);
+
+/* Collects notifications for a hook and flushes them as one array once
+ * max_size have arrived or max_delay_ms after the first one. */
+struct Batch;
+
+struct Batch *batch_new(
+	struct Loop *loop,
+	const struct BatchSettings *settings,
+	BatchFlushFunction fn,
+	void *data,
+	void *hook
+);
+void batch_add(struct Batch *batch, struct Notification *notification);
+void batch_flush(struct Batch *batch);
+/* Flushes whatever is pending and frees the batch. */
+void batch_free(struct Batch *batch);
+
+#endif
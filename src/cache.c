@@ -0,0 +1,132 @@
+#include <sys/resource.h>
+#include "cache.h"
+#include "stats.h"
+
+struct Cache {
+	/* Guards everything but the fields of entries */
+	GMutex lock;
+	GHashTable *entries;
+	GQueue lru;
+	gsize size;
+	gsize max_size;
+	/* Entries whose image holds an open memfd, which are limited apart from
+	 * their bytes, since many small images would run out of fds first */
+	gsize n_fds;
+	gsize max_fds;
+};
+
+static gboolean holds_fd(const struct CacheEntry *entry) {
+	return entry->image != NULL && entry->image->fd >= 0;
+}
+
+static gsize get_entry_size(struct CacheEntry *entry) {
+	gsize size = sizeof(*entry) + strlen(entry->key) + 1;
+	if (entry->path != NULL) size += strlen(entry->path) + 1;
+	if (entry->base64 != NULL) size += strlen(entry->base64) + 1;
+	if (entry->image != NULL) size += entry->image->size;
+	return size;
+}
+
+static void free_entry(struct CacheEntry *entry) {
+	g_free(entry->key);
+	g_free(entry->path);
+	g_free(entry->base64);
+	image_file_unref(entry->image);
+	g_mutex_clear(&entry->fill_lock);
+	g_free(entry);
+}
+
+static void evict(struct Cache *cache, struct CacheEntry *entry) {
+	g_queue_unlink(&cache->lru, &entry->link);
+	g_hash_table_remove(cache->entries, entry->key);
+	cache->size -= entry->size;
+	if (entry->holds_fd) --cache->n_fds;
+	// The fd is closed here, unless a notification or a hook still has it
+	free_entry(entry);
+}
+
+static void evict_to(struct Cache *cache, gsize max_size, struct CacheEntry *keep) {
+	GList *link = cache->lru.tail;
+	while (link != NULL && (cache->size > max_size || cache->n_fds > cache->max_fds)) {
+		GList *prev = link->prev;
+		struct CacheEntry *entry = link->data;
+		// Entries without an fd only help when there are too many bytes
+		gboolean helps = cache->size > max_size || entry->holds_fd;
+		if (entry != keep && entry->users == 0 && helps) evict(cache, entry);
+		link = prev;
+	}
+}
+
+struct Cache *cache_new(gsize max_size) {
+	struct Cache *cache = g_new0(struct Cache, 1);
+	g_mutex_init(&cache->lock);
+	cache->entries = g_hash_table_new(g_str_hash, g_str_equal);
+	g_queue_init(&cache->lru);
+	cache->max_size = max_size;
+	// A quarter of the fds the daemon may open, leaving the rest to pipes,
+	// hooks and buses
+	struct rlimit limit;
+	cache->max_fds = 256;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+		cache->max_fds = MAX(limit.rlim_cur / 4, 1);
+	}
+	return cache;
+}
+
+void cache_set_max_size(struct Cache *cache, gsize max_size) {
+	g_mutex_lock(&cache->lock);
+	cache->max_size = max_size;
+	evict_to(cache, max_size, NULL);
+	stats_set(GAUGE_CACHE_BYTES, cache->size);
+	g_mutex_unlock(&cache->lock);
+}
+
+struct CacheEntry *cache_get(struct Cache *cache, const char *key) {
+	g_mutex_lock(&cache->lock);
+	struct CacheEntry *entry = g_hash_table_lookup(cache->entries, key);
+	if (entry != NULL) {
+		g_queue_unlink(&cache->lru, &entry->link);
+	} else {
+		entry = g_new0(struct CacheEntry, 1);
+		entry->key = g_strdup(key);
+		entry->link.data = entry;
+		g_mutex_init(&entry->fill_lock);
+		g_hash_table_insert(cache->entries, entry->key, entry);
+	}
+	g_queue_push_head_link(&cache->lru, &entry->link);
+	++entry->users;
+	g_mutex_unlock(&cache->lock);
+	g_mutex_lock(&entry->fill_lock);
+	return entry;
+}
+
+void cache_commit(struct Cache *cache, struct CacheEntry *entry, gboolean filled) {
+	stats_count(filled ? COUNTER_CACHE_MISSES : COUNTER_CACHE_HITS);
+	cache_release(cache, entry);
+}
+
+void cache_release(struct Cache *cache, struct CacheEntry *entry) {
+	gsize size = get_entry_size(entry);
+	gboolean fd = holds_fd(entry);
+	g_mutex_unlock(&entry->fill_lock);
+
+	g_mutex_lock(&cache->lock);
+	--entry->users;
+	cache->size -= entry->size;
+	entry->size = size;
+	cache->size += entry->size;
+	if (fd && !entry->holds_fd) ++cache->n_fds;
+	if (!fd && entry->holds_fd) --cache->n_fds;
+	entry->holds_fd = fd;
+	evict_to(cache, cache->max_size, entry);
+	// An entry larger than the whole cache is not kept, nor an fd past the
+	// limit that older entries could not make room for
+	if (
+		entry->users == 0 &&
+		(cache->size > cache->max_size || (cache->n_fds > cache->max_fds && entry->holds_fd))
+	) {
+		evict(cache, entry);
+	}
+	stats_set(GAUGE_CACHE_BYTES, cache->size);
+	g_mutex_unlock(&cache->lock);
+}
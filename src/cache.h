@@ -0,0 +1,41 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <glib.h>
+#include "image.h"
+
+/* Resolved icon paths and image encodings, keyed by what they were computed
+ * from. Fields are NULL until some notification needed them. */
+struct CacheEntry {
+	gchar *key;
+	gchar *path;
+	gchar *base64;
+	struct ImageFile *image;
+	gsize size;
+	GList link;
+	/* Threads between cache_get and cache_commit, which keep it from being
+	 * evicted */
+	guint users;
+	/* Whether the cache counts it as holding an open fd */
+	gboolean holds_fd;
+	/* Held from cache_get to cache_commit, so that one thread fills it in
+	 * while the others wait to use what it made */
+	GMutex fill_lock;
+};
+
+struct Cache;
+
+struct Cache *cache_new(gsize max_size);
+void cache_set_max_size(struct Cache *cache, gsize max_size);
+/* Returns the entry for key, creating an empty one if there is none. It stays
+ * valid, and only this thread may use it, until it is passed to
+ * cache_commit. */
+struct CacheEntry *cache_get(struct Cache *cache, const char *key);
+/* Records whether the entry was used as-is or had to be filled in, and evicts
+ * least recently used entries beyond the size limit. */
+void cache_commit(struct Cache *cache, struct CacheEntry *entry, gboolean filled);
+/* Gives the entry back without counting a hit or a miss, for one that is left
+ * for another thread to fill in and commit. */
+void cache_release(struct Cache *cache, struct CacheEntry *entry);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "debug.h"
+
+static const char MAGIC[] = "i-spy-notify capture 1\n";
+#define MAGIC_LENGTH (sizeof(MAGIC) - 1)
+
+/* Messages longer than this are taken to be a corrupt length */
+#define MAX_RECORD_LENGTH (DBUS_MAXIMUM_MESSAGE_LENGTH)
+
+struct Header {
+	guint64 time;
+	guint32 length;
+} __attribute__((packed));
+
+struct Recorder {
+	FILE *file;
+	gchar *path;
+};
+
+struct Replay {
+	FILE *file;
+	gchar *path;
+	gchar *buffer;
+	gsize buffer_size;
+};
+
+struct Recorder *recorder_open(const char *path) {
+	FILE *file = fopen(path, "ae");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0) fwrite(MAGIC, 1, MAGIC_LENGTH, file);
+	struct Recorder *recorder = g_new0(struct Recorder, 1);
+	recorder->file = file;
+	recorder->path = g_strdup(path);
+	return recorder;
+}
+
+void recorder_write(struct Recorder *recorder, DBusMessage *message) {
+	char *bytes;
+	int length;
+	if (!dbus_message_marshal(message, &bytes, &length)) return;
+	struct Header header = {
+		GUINT64_TO_LE((guint64)g_get_real_time()),
+		GUINT32_TO_LE((guint32)length),
+	};
+	fwrite(&header, sizeof(header), 1, recorder->file);
+	fwrite(bytes, 1, length, recorder->file);
+	dbus_free(bytes);
+}
+
+void recorder_flush(struct Recorder *recorder) {
+	if (fflush(recorder->file) != 0) perror(recorder->path);
+}
+
+void recorder_close(struct Recorder *recorder) {
+	if (fclose(recorder->file) != 0) perror(recorder->path);
+	g_free(recorder->path);
+	g_free(recorder);
+}
+
+struct Replay *replay_open(const char *path) {
+	char magic[MAGIC_LENGTH];
+	FILE *file = fopen(path, "re");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	if (fread(magic, 1, MAGIC_LENGTH, file) != MAGIC_LENGTH || memcmp(magic, MAGIC, MAGIC_LENGTH) != 0) {
+		fprintf(stderr, "%s is not a capture.\n", path);
+		fclose(file);
+		return NULL;
+	}
+	struct Replay *replay = g_new0(struct Replay, 1);
+	replay->file = file;
+	replay->path = g_strdup(path);
+	return replay;
+}
+
+DBusMessage *replay_next(struct Replay *replay, gint64 *time) {
+	struct Header header;
+	if (fread(&header, sizeof(header), 1, replay->file) != 1) return NULL;
+	gsize length = GUINT32_FROM_LE(header.length);
+	if (length > MAX_RECORD_LENGTH) {
+		fprintf(stderr, "%s: record of %zu bytes is corrupt.\n", replay->path, length);
+		return NULL;
+	}
+	if (length > replay->buffer_size) {
+		replay->buffer = g_realloc(replay->buffer, length);
+		replay->buffer_size = length;
+	}
+	if (fread(replay->buffer, 1, length, replay->file) != length) {
+		fprintf(stderr, "%s: last record is cut short.\n", replay->path);
+		return NULL;
+	}
+
+	DBusError error = DBUS_ERROR_INIT;
+	DBusMessage *message = dbus_message_demarshal(replay->buffer, length, &error);
+	if (message == NULL) {
+		debug(&error);
+		dbus_error_free(&error);
+		return NULL;
+	}
+	*time = (gint64)GUINT64_FROM_LE(header.time);
+	return message;
+}
+
+void replay_close(struct Replay *replay) {
+	fclose(replay->file);
+	g_free(replay->buffer);
+	g_free(replay->path);
+	g_free(replay);
+}
@@ -0,0 +1,30 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <dbus/dbus.h>
+#include <glib.h>
+
+/* Captures of notification traffic, for replaying it without a bus. A capture
+ * is a magic line followed by records of a little-endian 64-bit wall clock
+ * time in microseconds, a 32-bit length and the message as
+ * dbus_message_marshal wrote it. Records are only ever appended. */
+
+struct Recorder;
+
+/* Opens path for appending, starting a new capture if it is empty. */
+struct Recorder *recorder_open(const char *path);
+void recorder_write(struct Recorder *recorder, DBusMessage *message);
+/* Writes out buffered records, which happens once per loop iteration rather
+ * than once per message. */
+void recorder_flush(struct Recorder *recorder);
+void recorder_close(struct Recorder *recorder);
+
+struct Replay;
+
+struct Replay *replay_open(const char *path);
+/* Returns the next message and when it was recorded, or NULL at the end of
+ * the capture or at a record that is cut short. */
+DBusMessage *replay_next(struct Replay *replay, gint64 *time);
+void replay_close(struct Replay *replay);
+
+#endif
@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "config.h"
+#include "notification.h"
+#include "plugin.h"
+
+static const char *path_key(json_object *path, size_t i) {
+	json_object *key = json_object_array_get_idx(path, i);
+	if (json_object_get_type(key) != json_type_string) return NULL;
+	return json_object_get_string(key);
+}
+
+/* Only looks at the path from offset on, which skips the index into the array
+ * that batched hooks are given. */
+static unsigned get_path_needs(json_object *path, size_t offset) {
+	if (json_object_array_length(path) <= offset) return NEED_ALL;
+	size_t length = json_object_array_length(path) - offset;
+	const char *key = path_key(path, offset);
+	if (key == NULL) return 0;
+	if (!strcmp(key, "image")) {
+		if (length == 1) return NEED_IMAGE_BASE64 | NEED_IMAGE_PATH;
+		key = path_key(path, offset + 1);
+		if (key == NULL) return 0;
+		if (!strcmp(key, "base64")) return NEED_IMAGE_BASE64;
+		if (!strcmp(key, "path")) return NEED_IMAGE_PATH;
+	} else if (!strcmp(key, "hints")) {
+		if (length == 1) return NEED_IMAGE_DATA_PNG | NEED_IMAGE_DATA_PATH;
+		key = path_key(path, offset + 1);
+		if (key == NULL || strcmp(key, "image-data") != 0) return 0;
+		if (length == 2) return NEED_IMAGE_DATA_PNG | NEED_IMAGE_DATA_PATH;
+		key = path_key(path, offset + 2);
+		if (key == NULL) return 0;
+		if (!strcmp(key, "png")) return NEED_IMAGE_DATA_PNG;
+		if (!strcmp(key, "path")) return NEED_IMAGE_DATA_PATH;
+	}
+	return 0;
+}
+
+static dbus_bool_t get_boolean(json_object *hook, const char *key) {
+	json_object *value = json_object_object_get(hook, key);
+	return json_object_is_type(value, json_type_boolean) && json_object_get_boolean(value);
+}
+
+static dbus_bool_t path_equal(const struct FieldPath *a, json_object *path) {
+	if (a->length != json_object_array_length(path)) return FALSE;
+	for (size_t i = 0; i < a->length; ++i) {
+		json_object *key = json_object_array_get_idx(path, i);
+		if (json_object_is_type(key, json_type_string)) {
+			if (a->keys[i].name == NULL || strcmp(a->keys[i].name, json_object_get_string(key)) != 0) {
+				return FALSE;
+			}
+		} else if (a->keys[i].name != NULL || a->keys[i].index != (size_t)json_object_get_int64(key)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static size_t intern_path(GArray *fields, json_object *path) {
+	for (guint i = 0; i < fields->len; ++i) {
+		if (path_equal(&g_array_index(fields, struct FieldPath, i), path)) return i;
+	}
+	struct FieldPath field;
+	field.length = json_object_array_length(path);
+	field.keys = g_new0(struct PathKey, field.length);
+	for (size_t i = 0; i < field.length; ++i) {
+		json_object *key = json_object_array_get_idx(path, i);
+		if (json_object_is_type(key, json_type_string)) {
+			field.keys[i].name = json_object_get_string(key);
+		} else {
+			field.keys[i].index = json_object_get_int64(key);
+		}
+	}
+	field.slot = notification_find_slot(&field);
+	g_array_append_val(fields, field);
+	return fields->len - 1;
+}
+
+static dbus_bool_t compile_batch(struct Hook *hook, json_object *batch) {
+	json_object *max_size = json_object_object_get(batch, "max_size");
+	json_object *max_delay_ms = json_object_object_get(batch, "max_delay_ms");
+	json_object *coalesce = json_object_object_get(batch, "coalesce");
+	hook->batched = TRUE;
+	hook->batch_settings.max_size = 100;
+	hook->batch_settings.max_delay_ms = 1000;
+	hook->batch_settings.coalesce = COALESCE_NONE;
+	if (json_object_is_type(max_size, json_type_int) && json_object_get_int64(max_size) > 0) {
+		hook->batch_settings.max_size = json_object_get_int64(max_size);
+	}
+	if (json_object_is_type(max_delay_ms, json_type_int) && json_object_get_int(max_delay_ms) >= 0) {
+		hook->batch_settings.max_delay_ms = json_object_get_int(max_delay_ms);
+	}
+	if (coalesce == NULL) return TRUE;
+	if (!json_object_is_type(coalesce, json_type_string)) {
+		fprintf(stderr, "Batch coalesce must be a string.\n");
+		return FALSE;
+	}
+	const char *policy = json_object_get_string(coalesce);
+	if (!strcmp(policy, "replaces_id")) {
+		hook->batch_settings.coalesce = COALESCE_REPLACES_ID;
+	} else if (!strcmp(policy, "app_name")) {
+		hook->batch_settings.coalesce = COALESCE_APP_NAME;
+	} else {
+		fprintf(stderr, "Unknown coalesce policy %s.\n", policy);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static dbus_bool_t compile_events(struct Hook *hook, json_object *events) {
+	static const struct {
+		const char *name;
+		enum HookEvent event;
+	} NAMES[] = {
+		{ "notify", EVENT_NOTIFY },
+		{ "expired", EVENT_EXPIRED },
+		{ "closed", EVENT_CLOSED },
+	};
+	hook->events = EVENT_NOTIFY;
+	if (events == NULL) return TRUE;
+	if (!json_object_is_type(events, json_type_array)) {
+		fprintf(stderr, "Hook events must be an array.\n");
+		return FALSE;
+	}
+	hook->events = 0;
+	for (size_t i = 0; i < json_object_array_length(events); ++i) {
+		json_object *event = json_object_array_get_idx(events, i);
+		const char *name = json_object_is_type(event, json_type_string) ? json_object_get_string(event) : "";
+		size_t j = 0;
+		while (j < G_N_ELEMENTS(NAMES) && strcmp(NAMES[j].name, name) != 0) ++j;
+		if (j == G_N_ELEMENTS(NAMES)) {
+			fprintf(stderr, "Unknown hook event %s.\n", json_object_to_json_string(event));
+			return FALSE;
+		}
+		hook->events |= NAMES[j].event;
+	}
+	return TRUE;
+}
+
+static dbus_bool_t compile_queue(struct QueueSettings *settings, json_object *queue) {
+	json_object *max_queued = json_object_object_get(queue, "max_queued");
+	json_object *max_running = json_object_object_get(queue, "max_running");
+	json_object *overflow = json_object_object_get(queue, "overflow");
+	if (json_object_is_type(max_queued, json_type_int) && json_object_get_int(max_queued) >= 0) {
+		settings->max_queued = json_object_get_int(max_queued);
+	}
+	if (json_object_is_type(max_running, json_type_int) && json_object_get_int(max_running) > 0) {
+		settings->max_running = json_object_get_int(max_running);
+	}
+	if (overflow == NULL) return TRUE;
+	if (!json_object_is_type(overflow, json_type_string)) {
+		fprintf(stderr, "Overflow policy must be a string.\n");
+		return FALSE;
+	}
+	const char *policy = json_object_get_string(overflow);
+	if (!strcmp(policy, "drop_oldest")) {
+		settings->overflow = OVERFLOW_DROP_OLDEST;
+	} else if (!strcmp(policy, "drop_newest")) {
+		settings->overflow = OVERFLOW_DROP_NEWEST;
+	} else if (!strcmp(policy, "coalesce")) {
+		settings->overflow = OVERFLOW_COALESCE;
+	} else {
+		fprintf(stderr, "Unknown overflow policy %s.\n", policy);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Reads "queues", an object with a queue's settings for each urgency. */
+static dbus_bool_t compile_queues(struct Config *config, json_object *queues) {
+	static const char *const NAMES[N_URGENCIES] = {
+		[URGENCY_LOW] = "low",
+		[URGENCY_NORMAL] = "normal",
+		[URGENCY_CRITICAL] = "critical",
+	};
+	dbus_bool_t valid = TRUE;
+	for (int i = 0; i < N_URGENCIES; ++i) {
+		struct QueueSettings *settings = &config->queues[i];
+		settings->max_queued = 1000;
+		settings->max_running = config->max_running_hooks;
+		settings->overflow = OVERFLOW_DROP_OLDEST;
+		json_object *queue = json_object_object_get(queues, NAMES[i]);
+		if (queue != NULL && !compile_queue(settings, queue)) {
+			fprintf(stderr, "Ignoring the %s queue's settings.\n", NAMES[i]);
+			valid = FALSE;
+		}
+	}
+	return valid;
+}
+
+/* Loads the shared object of a hook of "type": "plugin". Other hooks run a
+ * process. */
+static dbus_bool_t compile_plugin(struct Hook *hook, json_object *options) {
+	json_object *type = json_object_object_get(options, "type");
+	json_object *budget_ms = json_object_object_get(options, "budget_ms");
+	if (type == NULL) return TRUE;
+	if (!json_object_is_type(type, json_type_string) || strcmp(json_object_get_string(type), "plugin") != 0) {
+		fprintf(stderr, "Unknown hook type %s.\n", json_object_to_json_string(type));
+		return FALSE;
+	}
+	if (hook->batched || get_boolean(options, "stream") || get_boolean(options, "shell")) {
+		fprintf(stderr, "Plugin hooks cannot be batched, streamed or run by the shell.\n");
+		return FALSE;
+	}
+	hook->budget_ms = 10;
+	if (json_object_is_type(budget_ms, json_type_int) && json_object_get_int(budget_ms) > 0) {
+		hook->budget_ms = json_object_get_int(budget_ms);
+	}
+	hook->plugin = plugin_load(json_object_get_string(json_object_object_get(options, "command")));
+	return hook->plugin != NULL;
+}
+
+static void add_literal(GArray *args, const char *literal) {
+	struct HookArg arg = { literal, 0 };
+	g_array_append_val(args, arg);
+}
+
+static dbus_bool_t compile_hook(
+	struct Config *config,
+	struct Hook *hook,
+	json_object *options,
+	GArray *fields,
+	GPtrArray *predicates
+) {
+	json_object *command = json_object_object_get(options, "command");
+	json_object *arguments = json_object_object_get(options, "arguments");
+	json_object *buffer_size = json_object_object_get(options, "buffer_size");
+	json_object *timeout_ms = json_object_object_get(options, "timeout_ms");
+	if (!json_object_is_type(command, json_type_string)) {
+		fprintf(stderr, "Hook has no command: %s\n", json_object_to_json_string(options));
+		return FALSE;
+	}
+	json_object *batch = json_object_object_get(options, "batch");
+	if (
+		(batch != NULL && !compile_batch(hook, batch)) ||
+		!compile_events(hook, json_object_object_get(options, "events")) ||
+		!match_compile(json_object_object_get(options, "match"), predicates, &hook->match)
+	) {
+		fprintf(stderr, "Skipping hook: %s\n", json_object_to_json_string(options));
+		return FALSE;
+	}
+	// Loaded last, so that nothing else can fail once it is
+	if (!compile_plugin(hook, options)) {
+		match_clear(&hook->match);
+		fprintf(stderr, "Skipping hook: %s\n", json_object_to_json_string(options));
+		return FALSE;
+	}
+	GArray *args = g_array_new(FALSE, FALSE, sizeof(struct HookArg));
+
+	hook->options = options;
+	// "block" used to wait for the hook inline; it now only keeps runs of
+	// the hook from overlapping, which is all it guaranteed to scripts
+	hook->ordered = get_boolean(options, "block") || get_boolean(options, "ordered");
+	if (json_object_is_type(timeout_ms, json_type_int) && json_object_get_int(timeout_ms) > 0) {
+		hook->timeout_ms = json_object_get_int(timeout_ms);
+	}
+	hook->stream = get_boolean(options, "stream");
+	hook->buffer_size = 1 << 20;
+	if (buffer_size != NULL) {
+		gint64 size = json_object_get_int64(buffer_size);
+		// The buffer is allocated as it fills, so the limit only guards
+		// against sizes that are surely mistakes
+		if (json_object_is_type(buffer_size, json_type_int) && size > 0 && size <= 1 << 30) {
+			hook->buffer_size = size;
+		} else {
+			fprintf(stderr, "Stream buffer size must be from 1 byte to 1 GiB.\n");
+			++config->n_errors;
+		}
+	}
+
+	if (get_boolean(options, "shell")) {
+		add_literal(args, "sh");
+		add_literal(args, "-c");
+		add_literal(args, json_object_get_string(command));
+		add_literal(args, "sh");
+	} else {
+		add_literal(args, json_object_get_string(command));
+	}
+	if (hook->stream) {
+		// Stream hooks are sent the whole notification
+		config->needs |= NEED_ALL;
+	}
+
+	if (json_object_is_type(arguments, json_type_array)) {
+		for (size_t i = 0; i < json_object_array_length(arguments); ++i) {
+			json_object *arg = json_object_array_get_idx(arguments, i);
+			if (json_object_is_type(arg, json_type_array)) {
+				// Batched hooks are given an array of notifications
+				size_t offset = (
+					hook->batched &&
+					json_object_array_length(arg) > 0 &&
+					json_object_is_type(json_object_array_get_idx(arg, 0), json_type_int)
+				);
+				config->needs |= get_path_needs(arg, offset);
+				// The command line of a stream hook is fixed, and plugins
+				// read the fields they need themselves, so only literal
+				// arguments are passed to them
+				if (hook->stream || hook->plugin != NULL) continue;
+				struct HookArg field = { NULL, intern_path(fields, arg) };
+				g_array_append_val(args, field);
+			} else if (json_object_is_type(arg, json_type_string)) {
+				add_literal(args, json_object_get_string(arg));
+			} else {
+				add_literal(args, json_object_to_json_string(arg));
+			}
+		}
+	}
+
+	hook->n_args = args->len;
+	hook->args = (struct HookArg *)(void *)g_array_free(args, FALSE);
+	return TRUE;
+}
+
+/* Configs are only compiled on the main thread */
+static size_t last_hook_id = 0;
+/* Ids given so far, by the hook's JSON and how many hooks before it in the
+ * same config had the same JSON */
+static GHashTable *hook_ids = NULL;
+
+/* Returns the id of a hook, which it keeps across reloads for as long as it
+ * is defined the same way. seen counts the definitions of this config. */
+static size_t get_hook_id(json_object *options, GHashTable *seen) {
+	const char *json = json_object_to_json_string_ext(options, JSON_C_TO_STRING_PLAIN);
+	guint copy = GPOINTER_TO_UINT(g_hash_table_lookup(seen, json));
+	g_hash_table_insert(seen, g_strdup(json), GUINT_TO_POINTER(copy + 1));
+	gchar *key = g_strdup_printf("%u:%s", copy, json);
+	if (hook_ids == NULL) hook_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	size_t id = GPOINTER_TO_SIZE(g_hash_table_lookup(hook_ids, key));
+	if (id == 0) {
+		id = ++last_hook_id;
+		g_hash_table_insert(hook_ids, key, GSIZE_TO_POINTER(id));
+	} else {
+		g_free(key);
+	}
+	return id;
+}
+
+struct Config *config_compile(json_object *options) {
+	struct Config *config = g_new0(struct Config, 1);
+	json_object *hooks = json_object_object_get(options, "hooks");
+	json_object *max_running_hooks = json_object_object_get(options, "max_running_hooks");
+	json_object *decode_threads = json_object_object_get(options, "decode_threads");
+	json_object *cache_size = json_object_object_get(options, "cache_size");
+	json_object *default_timeout = json_object_object_get(options, "default_timeout");
+	json_object *idle_exit_ms = json_object_object_get(options, "idle_exit_ms");
+	json_object *image_delivery = json_object_object_get(options, "image_delivery");
+	json_object *hook_output_size = json_object_object_get(options, "hook_output_size");
+	json_object *hook_output_file = json_object_object_get(options, "hook_output_file");
+	json_object *hook_output_file_size = json_object_object_get(options, "hook_output_file_size");
+	json_object *hook_output_files = json_object_object_get(options, "hook_output_files");
+	json_object *stats_file = json_object_object_get(options, "stats_file");
+	json_object *stats_interval_ms = json_object_object_get(options, "stats_interval_ms");
+	GArray *fields = g_array_new(FALSE, FALSE, sizeof(struct FieldPath));
+	GPtrArray *predicates = g_ptr_array_new();
+
+	config->options = options;
+	config->max_running_hooks = 8;
+	if (
+		json_object_is_type(max_running_hooks, json_type_int) &&
+		json_object_get_int(max_running_hooks) > 0
+	) {
+		config->max_running_hooks = json_object_get_int(max_running_hooks);
+	}
+	if (!compile_queues(config, json_object_object_get(options, "queues"))) ++config->n_errors;
+	config->decode_threads = g_get_num_processors();
+	if (
+		json_object_is_type(decode_threads, json_type_int) &&
+		json_object_get_int(decode_threads) > 0
+	) {
+		config->decode_threads = json_object_get_int(decode_threads);
+	}
+	config->cache_size = 16 << 20;
+	if (json_object_is_type(cache_size, json_type_int) && json_object_get_int64(cache_size) >= 0) {
+		config->cache_size = json_object_get_int64(cache_size);
+	}
+	config->default_timeout = 5000;
+	if (
+		json_object_is_type(default_timeout, json_type_int) &&
+		json_object_get_int(default_timeout) >= 0
+	) {
+		config->default_timeout = json_object_get_int(default_timeout);
+	}
+	config->idle_exit_ms = 0;
+	if (
+		json_object_is_type(idle_exit_ms, json_type_int) &&
+		json_object_get_int(idle_exit_ms) >= 0
+	) {
+		config->idle_exit_ms = json_object_get_int(idle_exit_ms);
+	}
+	config->image_delivery = IMAGE_DELIVERY_MEMFD;
+	if (
+		json_object_is_type(image_delivery, json_type_string) &&
+		!strcmp(json_object_get_string(image_delivery), "file")
+	) {
+		config->image_delivery = IMAGE_DELIVERY_FILE;
+	}
+	config->hook_output_size = 64 << 10;
+	if (
+		json_object_is_type(hook_output_size, json_type_int) &&
+		json_object_get_int64(hook_output_size) >= 0
+	) {
+		config->hook_output_size = json_object_get_int64(hook_output_size);
+	}
+	if (json_object_is_type(hook_output_file, json_type_string)) {
+		config->hook_output_file = json_object_get_string(hook_output_file);
+	}
+	config->hook_output_file_size = 1 << 20;
+	if (
+		json_object_is_type(hook_output_file_size, json_type_int) &&
+		json_object_get_int64(hook_output_file_size) > 0
+	) {
+		config->hook_output_file_size = json_object_get_int64(hook_output_file_size);
+	}
+	config->hook_output_files = 3;
+	if (
+		json_object_is_type(hook_output_files, json_type_int) &&
+		json_object_get_int(hook_output_files) >= 0
+	) {
+		config->hook_output_files = json_object_get_int(hook_output_files);
+	}
+	if (json_object_is_type(stats_file, json_type_string)) {
+		config->stats_file = json_object_get_string(stats_file);
+	}
+	config->stats_interval_ms = 10000;
+	if (
+		json_object_is_type(stats_interval_ms, json_type_int) &&
+		json_object_get_int(stats_interval_ms) > 0
+	) {
+		config->stats_interval_ms = json_object_get_int(stats_interval_ms);
+	}
+
+	if (json_object_is_type(hooks, json_type_array)) {
+		size_t length = json_object_array_length(hooks);
+		config->hooks = g_new0(struct Hook, length);
+		GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		for (size_t i = 0; i < length; ++i) {
+			json_object *options = json_object_array_get_idx(hooks, i);
+			// Compiled apart, so that nothing a rejected hook set up before
+			// failing carries over to the next one
+			struct Hook hook = { 0 };
+			if (compile_hook(config, &hook, options, fields, predicates)) {
+				hook.id = get_hook_id(options, seen);
+				config->hooks[config->n_hooks++] = hook;
+			} else {
+				++config->n_errors;
+			}
+		}
+		g_hash_table_unref(seen);
+	}
+
+	config->n_fields = fields->len;
+	config->fields = (struct FieldPath *)(void *)g_array_free(fields, FALSE);
+	config->n_predicates = predicates->len;
+	config->predicates = (struct Predicate **)g_ptr_array_free(predicates, FALSE);
+	return config;
+}
+
+void config_free(struct Config *config) {
+	for (size_t i = 0; i < config->n_hooks; ++i) {
+		g_free(config->hooks[i].args);
+		match_clear(&config->hooks[i].match);
+		plugin_unref(config->hooks[i].plugin);
+	}
+	for (size_t i = 0; i < config->n_predicates; ++i) {
+		predicate_free(config->predicates[i]);
+	}
+	g_free(config->predicates);
+	for (size_t i = 0; i < config->n_fields; ++i) {
+		g_free(config->fields[i].keys);
+	}
+	g_free(config->hooks);
+	g_free(config->fields);
+	json_object_put(config->options);
+	g_free(config);
+}
@@ -0,0 +1,128 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <dbus/dbus.h>
+#include <json-c/json.h>
+#include "batch.h"
+#include "executor.h"
+#include "image.h"
+#include "match.h"
+
+/* Notification fields that are expensive to build and are only computed when
+ * some hook argument can reach them. */
+enum ConfigNeeds {
+	NEED_IMAGE_BASE64 = 1 << 0,
+	NEED_IMAGE_PATH = 1 << 1,
+	NEED_IMAGE_DATA_PNG = 1 << 2,
+	NEED_IMAGE_DATA_PATH = 1 << 3,
+};
+
+#define NEED_ALL (NEED_IMAGE_BASE64 | NEED_IMAGE_PATH | NEED_IMAGE_DATA_PNG | NEED_IMAGE_DATA_PATH)
+
+struct PathKey {
+	const char *name;
+	size_t index;
+};
+
+/* A path into the notification, such as ["hints", "urgency"]. Keys with a
+ * NULL name are array indices. slot is where the decoded notification keeps
+ * the field, or -1 for paths that go through the JSON view. */
+struct FieldPath {
+	struct PathKey *keys;
+	size_t length;
+	int slot;
+};
+
+/* One argv entry of a hook: either a literal, or the field at fields[field]
+ * of the config rendered as a string. */
+struct HookArg {
+	const char *literal;
+	size_t field;
+};
+
+/* What a hook can be run for. */
+enum HookEvent {
+	EVENT_NOTIFY = 1 << 0,
+	EVENT_EXPIRED = 1 << 1,
+	EVENT_CLOSED = 1 << 2,
+};
+
+struct StreamHook;
+struct Plugin;
+struct PluginHook;
+
+struct Hook {
+	/* Kept by the hook across reloads while its definition is unchanged,
+	 * and never given to another hook, unlike its address or index */
+	size_t id;
+	json_object *options;
+	struct HookArg *args;
+	size_t n_args;
+	struct Match match;
+	/* Mask of the HookEvents it is run for */
+	unsigned events;
+	dbus_bool_t ordered;
+	/* Milliseconds a run may take before it is killed, or 0 */
+	int timeout_ms;
+	dbus_bool_t stream;
+	size_t buffer_size;
+	dbus_bool_t batched;
+	struct BatchSettings batch_settings;
+	/* Shared object of a plugin hook, loaded with the config */
+	struct Plugin *plugin;
+	/* Milliseconds a plugin's call may take before notifications for it are
+	 * dropped */
+	unsigned budget_ms;
+	/* Running process of a stream hook */
+	struct StreamHook *stream_hook;
+	/* Notifications waiting for a batched hook */
+	struct Batch *batch;
+	/* Thread of a plugin hook */
+	struct PluginHook *plugin_hook;
+};
+
+/* The configuration file, compiled once when it is loaded. */
+struct Config {
+	json_object *options;
+	unsigned needs;
+	size_t max_running_hooks;
+	/* Limits of the queue of hook runs for each urgency */
+	struct QueueSettings queues[N_URGENCIES];
+	/* Worker threads that decode notifications */
+	size_t decode_threads;
+	size_t cache_size;
+	/* Milliseconds the server keeps notifications that leave it the choice,
+	 * or 0 to keep them until they are closed */
+	int default_timeout;
+	/* Milliseconds the server may go without a message before it exits, or 0
+	 * to keep running */
+	int idle_exit_ms;
+	enum ImageDelivery image_delivery;
+	/* Bytes of output kept for each hook, or 0 to leave hooks the daemon's
+	 * stdout and stderr */
+	size_t hook_output_size;
+	/* File hook output is also appended to, or NULL */
+	const char *hook_output_file;
+	/* Size at which the file is rotated, and how many old ones are kept */
+	size_t hook_output_file_size;
+	int hook_output_files;
+	/* Where statistics are written for Prometheus, or NULL */
+	const char *stats_file;
+	int stats_interval_ms;
+	struct Hook *hooks;
+	size_t n_hooks;
+	/* Every distinct path used by a hook argument */
+	struct FieldPath *fields;
+	size_t n_fields;
+	/* Every distinct predicate used by a hook's match */
+	struct Predicate **predicates;
+	size_t n_predicates;
+	/* Hooks and settings that were left out because they are invalid */
+	size_t n_errors;
+};
+
+struct Config *config_compile(json_object *options);
+void config_free(struct Config *config);
+
+#endif
@@ -0,0 +1,268 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "executor.h"
+#include "process.h"
+#include "stats.h"
+
+static const char *const URGENCY_NAMES[N_URGENCIES] = {
+	[URGENCY_LOW] = "low",
+	[URGENCY_NORMAL] = "normal",
+	[URGENCY_CRITICAL] = "critical",
+};
+
+static const enum Counter DROP_COUNTERS[N_URGENCIES] = {
+	[URGENCY_LOW] = COUNTER_RUNS_DROPPED_LOW,
+	[URGENCY_NORMAL] = COUNTER_RUNS_DROPPED_NORMAL,
+	[URGENCY_CRITICAL] = COUNTER_RUNS_DROPPED_CRITICAL,
+};
+
+struct Job {
+	struct Executor *executor;
+	gchar **argv;
+	struct JobOptions options;
+	struct ImageFile **images;
+	size_t n_images;
+	pid_t pid;
+	/* Kills the job once its timeout_ms is up, or 0 */
+	unsigned timeout;
+	gint64 submitted;
+	gint64 started;
+};
+
+struct Queue {
+	GQueue jobs;
+	size_t running;
+	struct QueueSettings settings;
+	size_t dropped;
+};
+
+struct Executor {
+	struct Loop *loop;
+	struct HookLog *log;
+	size_t max_running;
+	struct Queue queues[N_URGENCIES];
+	/* Jobs running from every queue */
+	size_t running;
+	/* Ids of the ordered hooks that have a job running */
+	GHashTable *busy_hooks;
+};
+
+static void free_job(struct Job *job) {
+	for (size_t i = 0; i < job->n_images; ++i) {
+		image_file_unref(job->images[i]);
+	}
+	g_free(job->images);
+	g_free(job->argv);
+	g_free(job);
+}
+
+/* Copies argv into a single allocation, pointers first and strings after. */
+static gchar **copy_argv(const char *const *argv) {
+	size_t argc = 0;
+	size_t size = 0;
+	for (; argv[argc] != NULL; ++argc) size += strlen(argv[argc]) + 1;
+	gchar **copy = g_malloc((argc + 1) * sizeof(gchar *) + size);
+	gchar *strings = (gchar *)(copy + argc + 1);
+	for (size_t i = 0; i < argc; ++i) {
+		size_t length = strlen(argv[i]) + 1;
+		memcpy(strings, argv[i], length);
+		copy[i] = strings;
+		strings += length;
+	}
+	copy[argc] = NULL;
+	return copy;
+}
+
+static void finish_job(pid_t pid, int status, void *data);
+
+static void kill_job(void *data) {
+	struct Job *job = data;
+	job->timeout = 0;
+	stats_count(COUNTER_HOOK_TIMEOUTS);
+	fprintf(stderr, "%s timed out after %d ms, killing it.\n", job->argv[0], job->options.timeout_ms);
+	// Hung hooks are not given a chance to clean up. The job leads its own
+	// process group, so whatever it started goes with it, and finish_job
+	// runs once it is reaped
+	kill(-job->pid, SIGKILL);
+}
+
+static dbus_bool_t start_job(struct Executor *executor, struct Job *job) {
+	// A batched run passes on one image per notification in the batch
+	int *fds = g_new(int, job->n_images + 1);
+	size_t n_fds = 0;
+	for (size_t i = 0; i < job->n_images; ++i) {
+		if (job->images[i]->fd >= 0) fds[n_fds++] = job->images[i]->fd;
+	}
+	gint64 start = stats_record(STAGE_HOOK_QUEUE, job->submitted);
+	struct HookOutput *output = hook_output_open(executor->log, job->options.hook_id, job->options.id);
+	pid_t pid = spawn_process(
+		(const char *const *)job->argv,
+		-1,
+		output != NULL ? hook_output_get_fd(output) : -1,
+		job->options.timeout_ms > 0,
+		fds,
+		n_fds
+	);
+	g_free(fds);
+	if (output != NULL) hook_output_start(output, pid);
+	job->started = stats_record(STAGE_SPAWN, start);
+	if (pid < 0) {
+		stats_count(COUNTER_SPAWN_FAILURES);
+		return FALSE;
+	}
+	stats_count(COUNTER_SPAWNS);
+	job->pid = pid;
+	++executor->running;
+	++executor->queues[job->options.urgency].running;
+	if (job->options.ordered) {
+		g_hash_table_add(executor->busy_hooks, GSIZE_TO_POINTER(job->options.hook_id));
+	}
+	if (job->options.timeout_ms > 0) {
+		job->timeout = loop_add_timeout(executor->loop, job->options.timeout_ms, kill_job, job);
+	}
+	loop_watch_child(executor->loop, pid, finish_job, job);
+	return TRUE;
+}
+
+/* Whether a job of urgency may start on top of the ones running. */
+static gboolean has_room(struct Executor *executor, enum Urgency urgency) {
+	struct Queue *queue = &executor->queues[urgency];
+	if (queue->running >= queue->settings.max_running) return FALSE;
+	if (urgency == URGENCY_CRITICAL) return TRUE;
+	size_t others = executor->running - executor->queues[URGENCY_CRITICAL].running;
+	return others < executor->max_running;
+}
+
+/* Starts what there is room for, most urgent first, so that a less urgent
+ * job only takes a free slot that no more urgent one can use. */
+static void start_pending(struct Executor *executor) {
+	size_t queued = 0;
+	for (int urgency = URGENCY_CRITICAL; urgency >= 0; --urgency) {
+		struct Queue *queue = &executor->queues[urgency];
+		GList *link = queue->jobs.head;
+		while (link != NULL && has_room(executor, urgency)) {
+			GList *next = link->next;
+			struct Job *job = link->data;
+			if (
+				!job->options.ordered ||
+				!g_hash_table_contains(executor->busy_hooks, GSIZE_TO_POINTER(job->options.hook_id))
+			) {
+				g_queue_delete_link(&queue->jobs, link);
+				if (!start_job(executor, job)) free_job(job);
+			}
+			link = next;
+		}
+		queued += queue->jobs.length;
+	}
+	stats_set(GAUGE_HOOKS_QUEUED, queued);
+	stats_set(GAUGE_HOOKS_RUNNING, executor->running);
+}
+
+static void finish_job(pid_t pid, int status, void *data) {
+	struct Job *job = data;
+	struct Executor *executor = job->executor;
+	stats_record(STAGE_HOOK, job->started);
+	if (job->timeout != 0) loop_remove_timeout(executor->loop, job->timeout);
+	--executor->running;
+	--executor->queues[job->options.urgency].running;
+	if (job->options.ordered) {
+		g_hash_table_remove(executor->busy_hooks, GSIZE_TO_POINTER(job->options.hook_id));
+	}
+	free_job(job);
+	start_pending(executor);
+}
+
+/* Queues job in a full queue, returning the job that is dropped to make
+ * room, which may be job itself. */
+static struct Job *overflow(struct Queue *queue, struct Job *job) {
+	switch (queue->settings.overflow) {
+	case OVERFLOW_DROP_OLDEST:
+		g_queue_push_tail(&queue->jobs, job);
+		return g_queue_pop_head(&queue->jobs);
+	case OVERFLOW_DROP_NEWEST:
+		break;
+	case OVERFLOW_COALESCE:
+		for (GList *link = queue->jobs.head; link != NULL; link = link->next) {
+			struct Job *waiting = link->data;
+			if (waiting->options.hook_id != job->options.hook_id) continue;
+			// Taking its place keeps the hook's runs in order
+			link->data = job;
+			return waiting;
+		}
+		break;
+	}
+	return job;
+}
+
+struct Executor *executor_new(struct Loop *loop, struct HookLog *log) {
+	struct Executor *executor = g_new0(struct Executor, 1);
+	executor->loop = loop;
+	executor->log = log;
+	executor->max_running = 1;
+	for (size_t i = 0; i < N_URGENCIES; ++i) {
+		g_queue_init(&executor->queues[i].jobs);
+		executor->queues[i].settings = (struct QueueSettings){ G_MAXSIZE, G_MAXSIZE, OVERFLOW_DROP_OLDEST };
+	}
+	executor->busy_hooks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	return executor;
+}
+
+void executor_set_limits(
+	struct Executor *executor,
+	size_t max_running,
+	const struct QueueSettings queues[N_URGENCIES]
+) {
+	executor->max_running = max_running > 0 ? max_running : 1;
+	for (size_t i = 0; i < N_URGENCIES; ++i) {
+		struct Queue *queue = &executor->queues[i];
+		queue->settings = queues[i];
+		queue->settings.max_running = MAX(queue->settings.max_running, 1);
+		// Jobs beyond a lowered max_queued are kept; the limit applies to
+		// the next ones
+	}
+	start_pending(executor);
+}
+
+void executor_submit(
+	struct Executor *executor,
+	const char *const *argv,
+	struct ImageFile *const *images,
+	size_t n_images,
+	const struct JobOptions *options
+) {
+	struct Job *job = g_new0(struct Job, 1);
+	job->executor = executor;
+	job->argv = copy_argv(argv);
+	job->options = *options;
+	job->submitted = g_get_monotonic_time();
+	job->images = g_new(struct ImageFile *, n_images);
+	job->n_images = n_images;
+	for (size_t i = 0; i < n_images; ++i) {
+		job->images[i] = image_file_ref(images[i]);
+	}
+
+	struct Queue *queue = &executor->queues[options->urgency];
+	if (queue->jobs.length < queue->settings.max_queued) {
+		g_queue_push_tail(&queue->jobs, job);
+	} else {
+		free_job(overflow(queue, job));
+		stats_count(DROP_COUNTERS[options->urgency]);
+		if (queue->dropped++ % 100 == 0) {
+			fprintf(
+				stderr,
+				"The %s urgency queue is full, %zu hook runs dropped.\n",
+				URGENCY_NAMES[options->urgency],
+				queue->dropped
+			);
+		}
+	}
+	start_pending(executor);
+}
+
+size_t executor_pending(struct Executor *executor) {
+	size_t pending = executor->running;
+	for (size_t i = 0; i < N_URGENCIES; ++i) pending += executor->queues[i].jobs.length;
+	return pending;
+}
@@ -0,0 +1,74 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <dbus/dbus.h>
+#include "hook-log.h"
+#include "image.h"
+#include "loop.h"
+
+/* Jobs wait in a queue for the urgency hint of their notification, and more
+ * urgent queues are always served first. */
+enum Urgency {
+	URGENCY_LOW,
+	URGENCY_NORMAL,
+	URGENCY_CRITICAL,
+	N_URGENCIES,
+};
+
+/* What a full queue does with one more job. */
+enum Overflow {
+	OVERFLOW_DROP_OLDEST,
+	OVERFLOW_DROP_NEWEST,
+	/* The new job replaces the oldest waiting job of the same hook, or is
+	 * dropped if there is none */
+	OVERFLOW_COALESCE,
+};
+
+struct QueueSettings {
+	/* Jobs that may wait before the overflow policy applies */
+	size_t max_queued;
+	/* Jobs of the queue that may run at once */
+	size_t max_running;
+	enum Overflow overflow;
+};
+
+struct JobOptions {
+	/* The id of the hook the job is run for. Jobs of the same hook are
+	 * coalesced, and with ordered set they never run concurrently and
+	 * start in submission order among those of the same urgency. */
+	size_t hook_id;
+	dbus_bool_t ordered;
+	enum Urgency urgency;
+	/* Milliseconds after which the job and every process it started are
+	 * killed, or 0 */
+	int timeout_ms;
+	/* The notification's id or 0 */
+	dbus_uint32_t id;
+};
+
+struct Executor;
+
+/* Job output goes to log. */
+struct Executor *executor_new(struct Loop *loop, struct HookLog *log);
+/* At most max_running jobs run at once, and each queue is held to its own
+ * settings on top of that. Critical jobs only count against their own queue,
+ * so that a backlog of others cannot hold them up. */
+void executor_set_limits(
+	struct Executor *executor,
+	size_t max_running,
+	const struct QueueSettings queues[N_URGENCIES]
+);
+/* Queues argv. The images are kept alive and their fds inherited until the
+ * job exits. */
+void executor_submit(
+	struct Executor *executor,
+	const char *const *argv,
+	struct ImageFile *const *images,
+	size_t n_images,
+	const struct JobOptions *options
+);
+size_t executor_pending(struct Executor *executor);
+
+#endif
@@ -1,159 +1,433 @@
 #include "handler.h"
-#include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
-#include <gio/gunixoutputstream.h>
 #include <stddef.h>
 #include <stdio.h>
-#include <sys/wait.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include "message.h"
+#include "cache.h"
+#include "image.h"
+#include "config.h"
+#include "executor.h"
+#include "stream.h"
+#include "batch.h"
+#include "plugin.h"
+#include "icons.h"
+#include "notification.h"
+#include "arena.h"
+#include "hints.h"
+#include "base64.h"
+#include "capture.h"
+#include "stats.h"
 
 const char *SERVER_NAME = "I Spy Notify";
 const char *SERVER_VENDOR = "I Spy Notify";
 const char *SERVER_VERSION = "0.0.0";
 const char *SERVER_SPEC_VERSION = "1.2";
 
-json_object *get_base64_from_path(const char *path) {
-	json_object *out;
-	gchar *bytes;
-	gsize size;
-	gchar *base64;
-	g_file_get_contents(path, &bytes, &size, NULL);
-	base64 = g_base64_encode((const guchar *)bytes, size);
-	out = json_object_new_string(base64);
-	g_free(base64);
-	g_free(bytes);
-	return out;
+static const char *NOTIFY_SIGNATURE = "susssasa{sv}i";
+/* Served next to the Notifications interface, on the same object */
+static const char *STATS_INTERFACE = "io.github.haritkapadia.ISpyNotify.Stats";
+static const char *HOOKS_INTERFACE = "io.github.haritkapadia.ISpyNotify.Hooks";
+
+/* Replies and signals go nowhere when a capture is replayed without a bus. */
+static void send_message(DBusConnection *conn, DBusMessage *message) {
+	if (conn != NULL) dbus_connection_send(conn, message, NULL);
 }
 
-json_object *get_base64_from_pixbuf(GdkPixbuf *buf) {
-	json_object *out;
-	gsize png_size;
-	gchar *png_bytes;
-	gchar *png_base64;
-	gdk_pixbuf_save_to_buffer(buf, &png_bytes, &png_size, "png", NULL, NULL);
-	png_base64 = g_base64_encode((const guchar *)png_bytes, png_size);
-	out = json_object_new_string(png_base64);
-	g_free(png_base64);
-	g_free(png_bytes);
-	return out;
+/* Reasons given by NotificationClosed */
+enum CloseReason {
+	CLOSE_EXPIRED = 1,
+	CLOSE_DISMISSED = 2,
+	CLOSE_CALLED = 3,
+	CLOSE_UNDEFINED = 4,
+};
+
+/* A notification the server has handed out an id for. It stays in the table
+ * after it is closed until every Notify for it has been decoded, so that the
+ * hooks for its close run after the ones for its last update. */
+struct LiveNotification {
+	struct HandlerState *state;
+	dbus_uint32_t id;
+	/* The newest decoded update */
+	struct Notification *notification;
+	/* Updates still in the pipeline */
+	unsigned decoding;
+	/* Nonzero once it is closed */
+	enum CloseReason reason;
+	struct Timer timer;
+};
+
+gchar *get_base64_from_path(const char *path) {
+	// Encoded straight from the page cache into the result
+	GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+	if (file == NULL) return base64_encode_new(NULL, 0);
+	gchar *base64 = base64_encode_new(
+		(const guchar *)g_mapped_file_get_contents(file),
+		g_mapped_file_get_length(file)
+	);
+	g_mapped_file_unref(file);
+	return base64;
+}
+
+gchar *get_png_from_pixbuf(GdkPixbuf *buf, gsize *size) {
+	gchar *png = NULL;
+	*size = 0;
+	gdk_pixbuf_save_to_buffer(buf, &png, size, "png", NULL, NULL);
+	return png;
+}
+
+/* Derives whichever of base64 and image are requested and still unset from
+ * the same PNG bytes, so that an image is only ever encoded once. */
+void fill_from_png(
+	const gchar *png,
+	gsize size,
+	gchar **base64,
+	struct ImageFile **image,
+	enum ImageDelivery delivery
+) {
+	if (base64 != NULL && *base64 == NULL) {
+		*base64 = base64_encode_new((const guchar *)png, size);
+	}
+	if (image != NULL && *image == NULL) {
+		*image = image_file_new(png, size, delivery);
+	}
 }
 
-json_object *get_path_from_pixbuf(GdkPixbuf *buf) {
-	json_object *out;
-	char *path = g_build_filename(g_get_tmp_dir(), "i-spy-notify-XXXXXX.png", NULL);
-	gint fd = g_mkstemp(path);
-	GOutputStream *stream = g_unix_output_stream_new(fd, TRUE);
-	gdk_pixbuf_save_to_stream(buf, stream, "png", NULL, NULL, NULL);
-	out = json_object_new_string(path);
-	g_object_unref(stream);
-	g_free(path);
+const char *get_cached_base64_from_path(struct Cache *cache, const char *path, struct Arena *arena) {
+	struct stat info;
+	if (stat(path, &info) < 0) return arena_adopt(arena, get_base64_from_path(path));
+
+	const char *key = arena_printf(
+		arena,
+		"file:%lld.%09ld:%lld:%s",
+		(long long)info.st_mtim.tv_sec,
+		info.st_mtim.tv_nsec,
+		(long long)info.st_size,
+		path
+	);
+	struct CacheEntry *entry = cache_get(cache, key);
+	gboolean filled = entry->base64 == NULL;
+	if (filled) {
+		gint64 start = g_get_monotonic_time();
+		entry->base64 = get_base64_from_path(path);
+		stats_record(STAGE_ENCODE, start);
+	}
+	const char *out = arena_strdup(arena, entry->base64);
+	cache_commit(cache, entry, filled);
 	return out;
 }
 
-dbus_bool_t get_standard_hint(DBusMessageIter *iter, json_object *hints) {
+/* Whether the cache entry of an icon name holds everything needs asks of it.
+ * Icons without a file are kept as the encodings that hooks use. */
+static gboolean icon_entry_complete(const struct CacheEntry *entry, unsigned needs) {
+	if (entry->path != NULL) return TRUE;
+	return (
+		(entry->base64 != NULL || entry->image != NULL) &&
+		(entry->base64 != NULL || !(needs & NEED_IMAGE_BASE64)) &&
+		(entry->image != NULL || !(needs & NEED_IMAGE_PATH))
+	);
+}
+
+/* Sets the image fields from a complete icon entry, and returns the icon's
+ * file, or NULL if it has none. The entry may be evicted while the
+ * notification is still around, so nothing in it is borrowed. */
+static const char *take_icon_entry(struct Notification *notification, const struct CacheEntry *entry, unsigned needs) {
+	struct Arena *arena = notification->arena;
+	if (entry->path != NULL) return arena_strdup(arena, entry->path);
+	if (needs & NEED_IMAGE_BASE64) {
+		notification_set_string(notification, SLOT_IMAGE_BASE64, arena_strdup(arena, entry->base64));
+	}
+	if (needs & NEED_IMAGE_PATH) {
+		image_file_unref(notification->image_file);
+		notification->image_file = image_file_ref(entry->image);
+		notification_set_string(notification, SLOT_IMAGE_PATH, entry->image->path);
+	}
+	return NULL;
+}
+
+static void set_icon_path(struct Notification *notification, const char *path, unsigned needs, struct Cache *cache) {
+	if (needs & NEED_IMAGE_BASE64) {
+		notification_set_string(
+			notification,
+			SLOT_IMAGE_BASE64,
+			get_cached_base64_from_path(cache, path, notification->arena)
+		);
+	}
+	if (needs & NEED_IMAGE_PATH) {
+		notification_set_string(notification, SLOT_IMAGE_PATH, path);
+	}
+}
+
+/* Sets the image fields from app_icon through the built-in lookup. Names it
+ * cannot find are taken as paths, unless GTK is used, in which case they are
+ * left for get_gtk_icon and FALSE is returned. */
+static gboolean get_icon(struct Notification *notification, const char *app_icon, unsigned needs, struct Cache *cache) {
+	const char *key = arena_printf(notification->arena, "icon:64:%s", app_icon);
+	struct CacheEntry *entry = cache_get(cache, key);
+	gboolean filled = !icon_entry_complete(entry, needs);
+	if (filled) {
+		// Icons without a file can only be encoded again through GTK
+		gboolean found = FALSE;
+		if (entry->base64 == NULL && entry->image == NULL) {
+			gint64 start = g_get_monotonic_time();
+			found = icons_lookup(app_icon, 64, &entry->path);
+			stats_record(STAGE_ICON, start);
+			if (!found && !icons_use_gtk()) {
+				entry->path = g_strdup(app_icon);
+				found = TRUE;
+			}
+		}
+		if (!found) {
+			cache_release(cache, entry);
+			return FALSE;
+		}
+	}
+	const char *path = take_icon_entry(notification, entry, needs);
+	cache_commit(cache, entry, filled);
+	if (path != NULL) set_icon_path(notification, path, needs, cache);
+	return TRUE;
+}
+
+/* Sets the image fields of a notification whose app_icon get_icon left, on
+ * the loop's thread, and caches what GTK found for the decoding threads. */
+static void get_gtk_icon(struct Notification *notification, const struct Config *config, struct Cache *cache) {
+	unsigned needs = config->needs;
+	const char *app_icon = notification_get(notification, SLOT_APP_ICON).string;
+	const char *key = arena_printf(notification->arena, "icon:64:%s", app_icon);
+	struct CacheEntry *entry = cache_get(cache, key);
+	// Another notification with the same icon may have filled it in first
+	gboolean filled = !icon_entry_complete(entry, needs);
+	if (filled) {
+		GdkPixbuf *buf;
+		gint64 start = g_get_monotonic_time();
+		if (!icons_lookup_gtk(app_icon, 64, &entry->path, &buf)) entry->path = g_strdup(app_icon);
+		start = stats_record(STAGE_ICON, start);
+		if (buf != NULL) {
+			gsize png_size;
+			gchar *png = get_png_from_pixbuf(buf, &png_size);
+			fill_from_png(
+				png,
+				png_size,
+				(needs & NEED_IMAGE_BASE64) ? &entry->base64 : NULL,
+				(needs & NEED_IMAGE_PATH) ? &entry->image : NULL,
+				config->image_delivery
+			);
+			g_free(png);
+			g_object_unref(buf);
+			stats_record(STAGE_ENCODE, start);
+		}
+	}
+	const char *path = take_icon_entry(notification, entry, needs);
+	cache_commit(cache, entry, filled);
+	if (path != NULL) set_icon_path(notification, path, needs, cache);
+	notification->icon_pending = FALSE;
+}
+
+/* Decodes the pixels of an image-data hint into the encodings hooks can
+ * reach. */
+dbus_bool_t get_image_data(
+	DBusMessageIter *value,
+	struct Notification *notification,
+	const struct Config *config,
+	struct Cache *cache
+) {
+	unsigned needs = config->needs;
+	DBusMessageIter sub;
+	DBusMessageIter image_data;
+	dbus_int32_t width;
+	dbus_int32_t height;
+	dbus_int32_t rowstride;
+	dbus_bool_t has_alpha;
+	dbus_int32_t bits_per_sample;
+	dbus_int32_t channels;
+	int bytes_size;
+	char *bytes;
+	GdkPixbuf *buf = NULL;
+	struct Arena *arena = notification->arena;
+	gboolean want_base64 = (needs & (NEED_IMAGE_DATA_PNG | NEED_IMAGE_BASE64)) != 0;
+	gboolean want_path = (needs & (NEED_IMAGE_DATA_PATH | NEED_IMAGE_PATH)) != 0;
+	// Nothing reachable from the hooks is derived from the pixels
+	if (!(needs & NEED_ALL)) return TRUE;
+	notification->has_image_data = TRUE;
+	dbus_message_iter_recurse(value, &sub);
+	if (!(
+		get_basic_arg(DBUS_TYPE_INT32, &sub, &width) &&
+		get_basic_arg(DBUS_TYPE_INT32, &sub, &height) &&
+		get_basic_arg(DBUS_TYPE_INT32, &sub, &rowstride) &&
+		get_basic_arg(DBUS_TYPE_BOOLEAN, &sub, &has_alpha) &&
+		get_basic_arg(DBUS_TYPE_INT32, &sub, &bits_per_sample) &&
+		get_basic_arg(DBUS_TYPE_INT32, &sub, &channels) &&
+		dbus_message_iter_get_arg_type(&sub) == DBUS_TYPE_ARRAY &&
+		dbus_message_iter_get_element_type(&sub) == DBUS_TYPE_BYTE
+	)) {
+		return FALSE;
+	}
+	dbus_message_iter_recurse(&sub, &image_data);
+	dbus_message_iter_get_fixed_array(&image_data, &bytes, &bytes_size);
+	// gdk-pixbuf trusts these, so pixels it would read past are refused
+	if (
+		width <= 0 ||
+		height <= 0 ||
+		bits_per_sample != 8 ||
+		channels != (has_alpha ? 4 : 3) ||
+		rowstride < width * channels ||
+		bytes_size < (gint64)rowstride * (height - 1) + width * channels
+	) {
+		return FALSE;
+	}
+
+	// Apps tend to send the same pixels over and over, so encodings are
+	// cached by a hash of the raw image
+	gchar *checksum = g_compute_checksum_for_data(
+		G_CHECKSUM_SHA256,
+		(const guchar *)bytes,
+		bytes_size
+	);
+	const char *cache_key = arena_printf(
+		arena,
+		"pixels:%s:%dx%d:%d:%d:%d",
+		checksum,
+		width,
+		height,
+		rowstride,
+		has_alpha,
+		bits_per_sample
+	);
+	g_free(checksum);
+	struct CacheEntry *entry = cache_get(cache, cache_key);
+	gboolean filled = (
+		(want_base64 && entry->base64 == NULL) ||
+		(want_path && entry->image == NULL)
+	);
+	if (filled) {
+		gint64 start = g_get_monotonic_time();
+		gchar *png = NULL;
+		gsize png_size = 0;
+		if (entry->image != NULL) {
+			g_file_get_contents(entry->image->path, &png, &png_size, NULL);
+		} else if (entry->base64 != NULL) {
+			png = (gchar *)g_base64_decode(entry->base64, &png_size);
+		} else {
+			buf = gdk_pixbuf_new_from_data(
+				(const guchar *)bytes,
+				GDK_COLORSPACE_RGB,
+				has_alpha,
+				bits_per_sample,
+				width,
+				height,
+				rowstride,
+				NULL,
+				NULL
+			);
+			png = get_png_from_pixbuf(buf, &png_size);
+			g_object_unref(buf);
+		}
+		fill_from_png(
+			png,
+			png_size,
+			want_base64 ? &entry->base64 : NULL,
+			want_path ? &entry->image : NULL,
+			config->image_delivery
+		);
+		g_free(png);
+		stats_record(STAGE_ENCODE, start);
+	}
+	if (want_base64 && entry->base64 != NULL) {
+		notification_set_string(notification, SLOT_IMAGE_DATA_PNG, arena_strdup(arena, entry->base64));
+	}
+	if (want_path && entry->image != NULL) {
+		// An image sent under an older name may have come first
+		if (notification->image_file != entry->image) {
+			image_file_unref(notification->image_file);
+			notification->image_file = image_file_ref(entry->image);
+		}
+		notification_set_string(notification, SLOT_IMAGE_DATA_PATH, entry->image->path);
+	}
+	cache_commit(cache, entry, filled);
+	return TRUE;
+}
+
+void get_hint(
+	DBusMessageIter *iter,
+	struct Notification *notification,
+	const struct Config *config,
+	struct Cache *cache
+) {
 	DBusMessageIter value;
-	char *key;
+	const char *key;
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_STRING) return;
 	dbus_message_iter_get_basic(iter, &key);
 	dbus_message_iter_next(iter);
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_VARIANT) return;
 	dbus_message_iter_recurse(iter, &value);
 
-	if (
-		!strcmp(key, "category") ||
-		!strcmp(key, "desktop-entry") ||
-		!strcmp(key, "image-path") ||
-		!strcmp(key, "sound-file") ||
-		!strcmp(key, "sound-name")
-	) {
-		// String
-		char *v;
-		dbus_message_iter_get_basic(&value, &v);
-		json_object_object_add(hints, key, json_object_new_string(v));
-	} else if (
-		!strcmp(key, "action-icons") ||
-		!strcmp(key, "resident") ||
-		!strcmp(key, "suppress-sound") ||
-		!strcmp(key, "transient")
-	) {
-		// Boolean
-		dbus_bool_t v;
-		dbus_message_iter_get_basic(&value, &v);
-		json_object_object_add(hints, key, json_object_new_boolean(v));
+	const struct HintInfo *hint = hints_find(key);
+	if (hint == NULL) {
+		struct Value other = hints_decode_other(&value);
+		if (other.type != VALUE_NONE) notification_add_other_hint(notification, key, other);
+	} else if (hint->decoder != HINT_IMAGE) {
+		hints_decode(notification, hint, &value);
 	} else if (
-		!strcmp(key, "x") ||
-		!strcmp(key, "y")
+		notification->ranks[hint->slot] < hint->rank &&
+		dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_STRUCT
 	) {
-		// Int32
-		dbus_int32_t v;
-		dbus_message_iter_get_basic(&value, &v);
-		json_object_object_add(hints, key, json_object_new_int(v));
-	} else if (!strcmp(key, "urgency")) {
-		// Byte
-		char v;
-		dbus_message_iter_get_basic(&value, &v);
-		json_object_object_add(hints, key, json_object_new_int(v));
-	} else if (!strcmp(key, "image-data")) {
-		DBusMessageIter sub;
-		DBusMessageIter image_data;
-		json_object *image;
-		dbus_int32_t width;
-		dbus_int32_t height;
-		dbus_int32_t rowstride;
-		dbus_bool_t has_alpha;
-		dbus_int32_t bits_per_sample;
-		dbus_int32_t channels;
-		int bytes_size;
-		char *bytes;
-		GdkPixbuf *buf;
-		image = json_object_new_object();
-		json_object_object_add(hints, key, image);
-		dbus_message_iter_recurse(&value, &sub);
-		if (!(
-			get_basic_arg(DBUS_TYPE_INT32, &sub, &width) &&
-			get_basic_arg(DBUS_TYPE_INT32, &sub, &height) &&
-			get_basic_arg(DBUS_TYPE_INT32, &sub, &rowstride) &&
-			get_basic_arg(DBUS_TYPE_BOOLEAN, &sub, &has_alpha) &&
-			get_basic_arg(DBUS_TYPE_INT32, &sub, &bits_per_sample) &&
-			get_basic_arg(DBUS_TYPE_INT32, &sub, &channels)
-		)) {
-			return FALSE;
-		}
-		dbus_message_iter_recurse(&sub, &image_data);
-		dbus_message_iter_get_fixed_array(&image_data, &bytes, &bytes_size);
-		buf = gdk_pixbuf_new_from_data(
-			(const guchar *)bytes,
-			GDK_COLORSPACE_RGB,
-			has_alpha,
-			bits_per_sample,
-			width,
-			height,
-			rowstride,
-			NULL,
-			NULL
-		);
-		json_object_object_add(image, "png", get_base64_from_pixbuf(buf));
-		json_object_object_add(image, "path", get_path_from_pixbuf(buf));
-		g_object_unref(buf);
+		// A newer name for the image replaces what an older one gave
+		notification->ranks[hint->slot] = hint->rank;
+		get_image_data(&value, notification, config, cache);
 	}
-
-	return TRUE;
 }
 
-json_object *get_notification(DBusMessage *message) {
-	static GtkIconTheme *theme = NULL;
-	if (theme == NULL) {
-		theme = gtk_icon_theme_get_default();
+/* Sets the image fields from the icon that is most specific: image-data,
+ * then image-path, then app_icon. */
+void get_image(struct Notification *notification, const struct Config *config, struct Cache *cache) {
+	unsigned needs = config->needs;
+	struct Arena *arena = notification->arena;
+	struct Value image_path = notification_get(notification, SLOT_IMAGE_PATH_HINT);
+	const char *app_icon = notification_get(notification, SLOT_APP_ICON).string;
+	gboolean use_image_data = notification->has_image_data;
+	// icon_data, from the first version of the spec, comes after the others
+	if (
+		notification->ranks[SLOT_IMAGE_DATA_PNG] < 2 &&
+		(image_path.type == VALUE_STRING || strcmp(app_icon, "") != 0)
+	) {
+		use_image_data = FALSE;
 	}
+	if (use_image_data) {
+		if (needs & NEED_IMAGE_BASE64) {
+			notification->slots[SLOT_IMAGE_BASE64] = notification->slots[SLOT_IMAGE_DATA_PNG];
+		}
+		if (needs & NEED_IMAGE_PATH) {
+			notification->slots[SLOT_IMAGE_PATH] = notification->slots[SLOT_IMAGE_DATA_PATH];
+		}
+	} else if (image_path.type == VALUE_STRING) {
+		if (needs & NEED_IMAGE_BASE64) {
+			notification_set_string(
+				notification,
+				SLOT_IMAGE_BASE64,
+				get_cached_base64_from_path(cache, image_path.string, arena)
+			);
+		}
+		if (needs & NEED_IMAGE_PATH) {
+			notification_set_string(notification, SLOT_IMAGE_PATH, image_path.string);
+		}
+	} else if (strcmp(app_icon, "") != 0) {
+		notification->icon_pending = !get_icon(notification, app_icon, needs, cache);
+	}
+}
 
-	json_object *data = json_object_new_object();
+/* Decodes a Notify call. Its strings point into message, which it keeps a
+ * reference to. */
+struct Notification *get_notification(
+	DBusMessage *message,
+	const struct Config *config,
+	struct Cache *cache
+) {
 	char *app_name;
 	dbus_uint32_t replaces_id;
 	char *app_icon;
 	char *summary;
 	char *body;
-	json_object *actions = json_object_new_array();
-	json_object *hints = json_object_new_object();
-	json_object *image = json_object_new_object();
 	dbus_int32_t expire_timeout;
 	DBusMessageIter iter;
 	dbus_message_iter_init(message, &iter);
@@ -167,14 +441,22 @@ json_object *get_notification(DBusMessage *message) {
 	)) {
 		return NULL;
 	}
+	struct Notification *notification = notification_new(message);
+	notification_set_string(notification, SLOT_APP_NAME, app_name);
+	notification_set_int(notification, SLOT_REPLACES_ID, replaces_id);
+	notification_set_string(notification, SLOT_APP_ICON, app_icon);
+	notification_set_string(notification, SLOT_SUMMARY, summary);
+	notification_set_string(notification, SLOT_BODY, body);
 
 	{
 		DBusMessageIter sub;
+		int n_actions;
 		dbus_message_iter_recurse(&iter, &sub);
-		while (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
-			char *action;
-			dbus_message_iter_get_basic(&sub, &action);
-			json_object_array_add(actions, json_object_new_string(action));
+		// Actions are strings, so the array length bounds their number
+		n_actions = dbus_message_iter_get_element_count(&iter);
+		notification->actions = arena_alloc(notification->arena, n_actions * sizeof(const char *));
+		while (dbus_message_iter_get_arg_type(&sub) == DBUS_TYPE_STRING) {
+			dbus_message_iter_get_basic(&sub, &notification->actions[notification->n_actions++]);
 			dbus_message_iter_next(&sub);
 		}
 	}
@@ -186,7 +468,7 @@ json_object *get_notification(DBusMessage *message) {
 		while (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
 			DBusMessageIter dict;
 			dbus_message_iter_recurse(&sub, &dict);
-			get_standard_hint(&dict, hints);
+			get_hint(&dict, notification, config, cache);
 			dbus_message_iter_next(&sub);
 		}
 	}
@@ -194,145 +476,340 @@ json_object *get_notification(DBusMessage *message) {
 
 	dbus_message_iter_get_basic(&iter, &expire_timeout);
 	dbus_message_iter_next(&iter);
+	notification_set_int(notification, SLOT_EXPIRE_TIMEOUT, expire_timeout);
 
-	{
-		json_object *image_data = json_object_object_get(hints, "image-data");
-		json_object *image_path = json_object_object_get(hints, "image-path");
-		if (json_object_is_type(image_data, json_type_object)) {
-			json_object_object_add(
-				image,
-				"base64",
-				json_object_get(json_object_object_get(image_data, "png"))
-			);
-			json_object_object_add(
-				image,
-				"path",
-				json_object_get(json_object_object_get(image_data, "path"))
-			);
-		} else if (json_object_is_type(image_path, json_type_string)) {
-			json_object_object_add(
-				image,
-				"base64",
-				get_base64_from_path(json_object_get_string(image_path))
-			);
-			json_object_object_add(
-				image,
-				"path",
-				json_object_get(image_path)
-			);
-		} else if (strcmp(app_icon, "") != 0) {
-			GtkIconInfo *info = gtk_icon_theme_lookup_icon(theme, app_icon, 64, 0);
-			if (info == NULL) {
-				json_object_object_add(image, "base64", get_base64_from_path(app_icon));
-				json_object_object_add(image, "path", json_object_new_string(app_icon));
-			} else {
-				const gchar *path = gtk_icon_info_get_filename(info);
-				if (path == NULL) {
-					GdkPixbuf *buf = gtk_icon_info_load_icon(info, NULL);
-					json_object_object_add(image, "base64", get_base64_from_pixbuf(buf));
-					json_object_object_add(image, "path", get_path_from_pixbuf(buf));
-					g_object_unref(buf);
-				} else {
-					json_object_object_add(image, "base64", get_base64_from_path(path));
-					json_object_object_add(image, "path", json_object_new_string(path));
-				}
-				g_object_unref(info);
-			}
+	if (config->needs & (NEED_IMAGE_BASE64 | NEED_IMAGE_PATH)) {
+		get_image(notification, config, cache);
+	}
+	return notification;
+}
+
+json_object *nested_object_get(json_object *obj, const struct FieldPath *path) {
+	json_object *ptr = obj;
+	for (size_t i = 0; i < path->length; ++i) {
+		const struct PathKey *key = &path->keys[i];
+		if (key->name != NULL) {
+			ptr = json_object_object_get(ptr, key->name);
+		} else if (json_object_is_type(ptr, json_type_array)) {
+			ptr = json_object_array_get_idx(ptr, key->index);
+		} else {
+			return NULL;
 		}
 	}
+	return ptr;
+}
 
-	json_object_object_add(data, "app_name", json_object_new_string(app_name));
-	json_object_object_add(data, "replaces_id", json_object_new_uint64(replaces_id));
-	json_object_object_add(data, "app_icon", json_object_new_string(app_icon));
-	json_object_object_add(data, "summary", json_object_new_string(summary));
-	json_object_object_add(data, "body", json_object_new_string(body));
-	json_object_object_add(data, "actions", actions);
-	json_object_object_add(data, "hints", hints);
-	json_object_object_add(data, "expire_timeout", json_object_new_int(expire_timeout));
-	json_object_object_add(data, "image", image);
+/* Renders field for one notification, or for a batch when notification is
+ * NULL and root is the array. */
+const char *render_field(
+	const struct Config *config,
+	struct Notification *notification,
+	json_object *root,
+	const char **values,
+	size_t field
+) {
+	if (values[field] == NULL) {
+		const struct FieldPath *path = &config->fields[field];
+		if (notification != NULL && path->slot >= 0) {
+			values[field] = notification_render(notification, notification_get(notification, path->slot));
+			return values[field];
+		}
+		if (notification != NULL && path->slot == SLOT_OTHER_HINT) {
+			struct Value value = notification_get_other_hint(notification, path->keys[1].name);
+			values[field] = notification_render(notification, value);
+			return values[field];
+		}
+		if (root == NULL) root = notification_get_json(notification);
+		json_object *value = nested_object_get(root, path);
+		if (json_object_get_type(value) == json_type_string) {
+			values[field] = json_object_get_string(value);
+		} else {
+			values[field] = json_object_to_json_string(value);
+		}
+	}
+	return values[field];
+}
 
-	return data;
+/* The queue a notification's hook runs wait in. Batches, with no single
+ * notification, wait with normal ones. */
+static enum Urgency get_urgency(const struct Notification *notification) {
+	if (notification == NULL) return URGENCY_NORMAL;
+	struct Value urgency = notification_get(notification, SLOT_URGENCY);
+	// Notifications without an urgency are normal
+	if (urgency.type != VALUE_INT) return URGENCY_NORMAL;
+	if (urgency.number <= 0) return URGENCY_LOW;
+	return urgency.number >= 2 ? URGENCY_CRITICAL : URGENCY_NORMAL;
 }
 
-json_object *nested_object_get(json_object *obj, json_object *keys) {
-	json_object *ptr = obj;
-	for (size_t i = 0; i < json_object_array_length(keys); ++i) {
-		json_object *key = json_object_array_get_idx(keys, i);
-		if (json_object_get_type(key) == json_type_string) {
-			ptr = json_object_object_get(ptr, json_object_get_string(key));
-		} else if (json_object_get_type(key) == json_type_int) {
-			ptr = json_object_array_get_idx(ptr, json_object_get_int64(key));
+/* Hands one notification, or the array a batch collected, to a hook. */
+void deliver(
+	struct Daemon *daemon,
+	struct Hook *hook,
+	struct Notification *notification,
+	json_object *root,
+	const char **values,
+	struct ImageFile *const *images,
+	size_t n_images
+) {
+	if (hook->stream_hook != NULL) {
+		stream_hook_send(hook->stream_hook, root != NULL ? root : notification_get_json(notification));
+		return;
+	}
+
+	const char **argv = g_newa(const char *, hook->n_args + 1);
+	for (size_t i = 0; i < hook->n_args; ++i) {
+		const struct HookArg *arg = &hook->args[i];
+		if (arg->literal != NULL) {
+			argv[i] = arg->literal;
+		} else {
+			argv[i] = render_field(daemon->config, notification, root, values, arg->field);
 		}
 	}
-	return ptr;
+	argv[hook->n_args] = NULL;
+	// Batches are about several notifications, and monitored ones have no id
+	struct Value id = { VALUE_NONE };
+	if (notification != NULL) id = notification_get(notification, SLOT_ID);
+	struct JobOptions options = {
+		hook->id,
+		hook->ordered,
+		get_urgency(notification),
+		hook->timeout_ms,
+		id.type == VALUE_INT ? id.number : 0,
+	};
+	executor_submit(daemon->executor, argv, images, n_images, &options);
 }
 
-void make_arg_list(json_object *notification, json_object *command, size_t *argc, const char ***argv) {
-	*argc = json_object_array_length(command);
-	*argv = (const char **)malloc((*argc + 1) * sizeof(char *));
-	for (size_t j = 0; j < *argc; ++j) {
-		json_object *arg = json_object_array_get_idx(command, j);
-		if (json_object_get_type(arg) == json_type_array) {
-			json_object *value = nested_object_get(notification, arg);
-			if (json_object_get_type(value) == json_type_string) {
-				(*argv)[j] = json_object_get_string(value);
-			} else {
-				(*argv)[j] = json_object_to_json_string(value);
-			}
-		} else if (json_object_get_type(arg) == json_type_string) {
-			(*argv)[j] = json_object_get_string(arg);
+void flush_batch(
+	json_object *notifications,
+	struct ImageFile *const *images,
+	size_t n_images,
+	void *data,
+	void *hook
+) {
+	struct Daemon *daemon = data;
+	// Fields rendered for single notifications do not apply to the array
+	const char **values = g_newa(const char *, daemon->config->n_fields + 1);
+	memset(values, 0, (daemon->config->n_fields + 1) * sizeof(const char *));
+	deliver(daemon, hook, NULL, notifications, values, images, n_images);
+}
+
+void start_hooks(struct Daemon *daemon) {
+	struct Config *config = daemon->config;
+	struct Loop *loop = daemon->loop;
+	for (size_t i = 0; i < config->n_hooks; ++i) {
+		struct Hook *hook = &config->hooks[i];
+		if (hook->batched) {
+			hook->batch = batch_new(loop, &hook->batch_settings, flush_batch, daemon, hook);
+		}
+		if (!hook->stream && hook->plugin == NULL) continue;
+		const char **argv = g_newa(const char *, hook->n_args + 1);
+		for (size_t j = 0; j < hook->n_args; ++j) {
+			argv[j] = hook->args[j].literal;
+		}
+		argv[hook->n_args] = NULL;
+		if (hook->plugin != NULL) {
+			hook->plugin_hook = plugin_hook_new(hook->plugin, argv, hook->budget_ms);
 		} else {
+			hook->stream_hook = stream_hook_new(loop, argv, hook->buffer_size, daemon->hook_log, hook->id);
 		}
 	}
-	(*argv)[*argc] = NULL;
 }
 
-void run_hook(json_object *hook, json_object *notification) {
-	const char **argv;
-	size_t argc;
-	json_object *command = json_object_object_get(hook, "command");
-	json_object *arguments = json_object_object_get(hook, "arguments");
-	json_object *block = json_object_object_get(hook, "block");
-	json_object *shell = json_object_object_get(hook, "shell");
-	json_object *exec_command = json_object_new_array();
-	if (
-		json_object_is_type(shell, json_type_boolean) &&
-		json_object_get_boolean(shell)
-	) {
-		json_object_array_add(exec_command, json_object_new_string("sh"));
-		json_object_array_add(exec_command, json_object_new_string("-c"));
-		json_object_array_add(exec_command, json_object_get(command));
-		json_object_array_add(exec_command, json_object_new_string("sh"));
+/* Sends pending batches, which still render with this config, and lets stream
+ * and plugin hooks exit. Runs already handed to the executor are not affected. */
+void stop_hooks(struct Config *config) {
+	for (size_t i = 0; i < config->n_hooks; ++i) {
+		struct Hook *hook = &config->hooks[i];
+		if (hook->batch != NULL) {
+			batch_free(hook->batch);
+			hook->batch = NULL;
+		}
+		if (hook->stream_hook != NULL) {
+			stream_hook_free(hook->stream_hook);
+			hook->stream_hook = NULL;
+		}
+		if (hook->plugin_hook != NULL) {
+			plugin_hook_free(hook->plugin_hook);
+			hook->plugin_hook = NULL;
+		}
+	}
+}
+
+void run_hook(
+	struct Daemon *daemon,
+	struct Hook *hook,
+	struct Notification *notification,
+	const char **values
+) {
+	if (hook->batch != NULL) {
+		batch_add(hook->batch, notification);
+	} else if (hook->plugin_hook != NULL) {
+		plugin_hook_send(hook->plugin_hook, notification);
 	} else {
-		json_object_array_add(exec_command, json_object_get(command));
+		struct ImageFile *image_file = notification->image_file;
+		deliver(daemon, hook, notification, NULL, values, &image_file, image_file != NULL);
 	}
+}
 
-	for (size_t i = 0; i < json_object_array_length(arguments); ++i) {
-		json_object_array_add(
-			exec_command,
-			json_object_get(json_object_array_get_idx(arguments, i))
-		);
+/* Runs on a worker thread. The config and cache stay in place while any
+ * message is in the pipeline. */
+struct Notification *decode_notification(DBusMessage *message, dbus_uint32_t id, void *data) {
+	struct HandlerState *state = data;
+	struct Notification *notification = get_notification(message, state->daemon->config, state->daemon->cache);
+	if (notification == NULL) {
+		stats_count(COUNTER_DROPPED);
+		return NULL;
 	}
-	make_arg_list(notification, exec_command, &argc, &argv);
+	stats_count(COUNTER_NOTIFICATIONS);
+	if (id != 0) notification_set_int(notification, SLOT_ID, id);
+	notification_set_string(notification, SLOT_EVENT, "notify");
+	return notification;
+}
 
-	int pid = fork();
-	if (pid) {
-		if (
-			json_object_is_type(block, json_type_boolean) &&
-			json_object_get_boolean(block)
-		) {
-			int status;
-			waitpid(pid, &status, 0);
-		}
+/* Runs every hook for event whose match passes. */
+void run_hooks(struct Daemon *daemon, struct Notification *notification, enum HookEvent event) {
+	struct Config *config = daemon->config;
+	const char **values = g_newa(const char *, config->n_fields + 1);
+	signed char *results = g_newa(signed char, config->n_predicates + 1);
+	memset(values, 0, (config->n_fields + 1) * sizeof(const char *));
+	memset(results, -1, config->n_predicates + 1);
+	for (size_t i = 0; i < config->n_hooks; ++i) {
+		struct Hook *hook = &config->hooks[i];
+		if (!(hook->events & event)) continue;
+		if (!match_evaluate(&hook->match, config->predicates, notification, results)) continue;
+		run_hook(daemon, hook, notification, values);
+	}
+}
+
+void free_live_notification(gpointer data) {
+	struct LiveNotification *live = data;
+	timer_wheel_cancel(live->state->daemon->timers, &live->timer);
+	notification_unref(live->notification);
+	g_free(live);
+}
+
+/* Runs the hooks for a closed notification and forgets it. */
+static void finish_close(struct LiveNotification *live) {
+	struct HandlerState *state = live->state;
+	if (live->notification != NULL) {
+		struct Notification *closed = notification_derive(live->notification);
+		gboolean expired = live->reason == CLOSE_EXPIRED;
+		notification_set_string(closed, SLOT_EVENT, expired ? "expired" : "closed");
+		notification_set_int(closed, SLOT_REASON, live->reason);
+		run_hooks(state->daemon, closed, expired ? EVENT_EXPIRED : EVENT_CLOSED);
+		notification_unref(closed);
+	}
+	g_hash_table_remove(state->live, GUINT_TO_POINTER(live->id));
+}
+
+/* Runs the hooks for a NotificationClosed signal seen by a monitor, of which
+ * only the id and the reason are known. */
+static void monitor_closed(struct HandlerState *state, DBusMessage *message) {
+	dbus_uint32_t id;
+	dbus_uint32_t reason;
+	if (!dbus_message_get_args(
+		message, NULL,
+		DBUS_TYPE_UINT32, &id,
+		DBUS_TYPE_UINT32, &reason,
+		DBUS_TYPE_INVALID
+	)) {
+		stats_count(COUNTER_DROPPED);
+		return;
+	}
+	struct Notification *closed = notification_new(message);
+	gboolean expired = reason == CLOSE_EXPIRED;
+	notification_set_int(closed, SLOT_ID, id);
+	notification_set_string(closed, SLOT_EVENT, expired ? "expired" : "closed");
+	notification_set_int(closed, SLOT_REASON, reason);
+	run_hooks(state->daemon, closed, expired ? EVENT_EXPIRED : EVENT_CLOSED);
+	notification_unref(closed);
+}
+
+static void close_notification(struct LiveNotification *live, enum CloseReason reason) {
+	struct HandlerState *state = live->state;
+	if (live->reason != 0) return;
+	live->reason = reason;
+	timer_wheel_cancel(state->daemon->timers, &live->timer);
+
+	DBusMessage *signal = dbus_message_new_signal(
+		"/org/freedesktop/Notifications",
+		"org.freedesktop.Notifications",
+		"NotificationClosed"
+	);
+	add_to_message(signal, "uu", live->id, (dbus_uint32_t)reason);
+	send_message(state->connection, signal);
+	dbus_message_unref(signal);
+
+	if (live->decoding == 0) finish_close(live);
+}
+
+static void expire_notification(void *data) {
+	close_notification(data, CLOSE_EXPIRED);
+}
+
+/* Returns the notification with id, unless it has been closed. */
+static struct LiveNotification *find_live_notification(struct HandlerState *state, dbus_uint32_t id) {
+	struct LiveNotification *live = g_hash_table_lookup(state->live, GUINT_TO_POINTER(id));
+	return live != NULL && live->reason == 0 ? live : NULL;
+}
+
+/* Gives a Notify call its id, either a new one or the one it replaces, and
+ * arms its expiry. */
+static struct LiveNotification *open_notification(struct HandlerState *state, DBusMessage *message) {
+	DBusMessageIter iter;
+	dbus_uint32_t replaces_id;
+	dbus_int32_t expire_timeout;
+	dbus_message_iter_init(message, &iter);
+	dbus_message_iter_next(&iter);
+	dbus_message_iter_get_basic(&iter, &replaces_id);
+	// Skipping the arrays does not read their elements
+	for (int i = 0; i < 6; ++i) dbus_message_iter_next(&iter);
+	dbus_message_iter_get_basic(&iter, &expire_timeout);
+
+	struct LiveNotification *live = replaces_id != 0 ? find_live_notification(state, replaces_id) : NULL;
+	if (live == NULL) {
+		live = g_new0(struct LiveNotification, 1);
+		live->state = state;
+		if (++state->last_notification_id == 0) ++state->last_notification_id;
+		live->id = state->last_notification_id;
+		timer_init(&live->timer, expire_notification, live);
+		g_hash_table_insert(state->live, GUINT_TO_POINTER(live->id), live);
+	}
+	++live->decoding;
+	int timeout = expire_timeout < 0 ? state->daemon->config->default_timeout : expire_timeout;
+	if (timeout > 0) {
+		timer_wheel_arm(state->daemon->timers, &live->timer, timeout);
 	} else {
-		execvp(argv[0], (char *const *)argv);
+		timer_wheel_cancel(state->daemon->timers, &live->timer);
 	}
-	json_object_put(exec_command);
-	free(argv);
+	return live;
+}
+
+/* Runs the hooks for a decoded Notify call, back on the loop's thread, and
+ * keeps it as the newest version of its id. */
+void complete_notification(struct Notification *notification, dbus_uint32_t id, void *data) {
+	struct HandlerState *state = data;
+	if (notification != NULL && notification->icon_pending) {
+		// GTK may only be used on this thread
+		get_gtk_icon(notification, state->daemon->config, state->daemon->cache);
+	}
+	if (notification != NULL) run_hooks(state->daemon, notification, EVENT_NOTIFY);
+
+	struct LiveNotification *live = id != 0 ? g_hash_table_lookup(state->live, GUINT_TO_POINTER(id)) : NULL;
+	if (live == NULL) return;
+	--live->decoding;
+	if (notification != NULL) {
+		notification_unref(live->notification);
+		live->notification = notification_ref(notification);
+	}
+	if (live->reason != 0 && live->decoding == 0) finish_close(live);
 }
 
 DBusHandlerResult handler(DBusConnection *conn, DBusMessage *message, void *user_data) {
 	struct HandlerState *state = (struct HandlerState *)user_data;
+	gint64 received = g_get_monotonic_time();
+	stats_count(COUNTER_MESSAGES_RECEIVED);
+	if (state->is_server) state->daemon->last_active = received;
 
 	int message_type = dbus_message_get_type(message);
 	if (
@@ -344,27 +821,85 @@ DBusHandlerResult handler(DBusConnection *conn, DBusMessage *message, void *user
 
 	const char *interface = dbus_message_get_interface(message);
 	const char *member = dbus_message_get_member(message);
+	if (interface == NULL || member == NULL) return DBUS_HANDLER_RESULT_HANDLED;
+	if (!strcmp(STATS_INTERFACE, interface)) {
+		if (
+			state->is_server &&
+			message_type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+			!strcmp("GetStats", member)
+		) {
+			DBusMessage *r = dbus_message_new_method_return(message);
+			stats_append_to_message(r);
+			send_message(conn, r);
+			dbus_message_unref(r);
+		}
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+	if (!strcmp(HOOKS_INTERFACE, interface)) {
+		if (
+			state->is_server &&
+			message_type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+			!strcmp("GetOutput", member)
+		) {
+			dbus_uint32_t hook;
+			DBusMessageIter iter;
+			DBusMessage *r;
+			dbus_message_iter_init(message, &iter);
+			if (
+				get_basic_arg(DBUS_TYPE_UINT32, &iter, &hook) &&
+				hook < state->daemon->config->n_hooks
+			) {
+				r = dbus_message_new_method_return(message);
+				hook_log_append_to_message(
+					state->daemon->hook_log,
+					state->daemon->config->hooks[hook].id,
+					r
+				);
+			} else {
+				r = dbus_message_new_error(message, DBUS_ERROR_INVALID_ARGS, "No such hook");
+			}
+			send_message(conn, r);
+			dbus_message_unref(r);
+		}
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
 	if (strcmp("org.freedesktop.Notifications", interface) != 0) {
 		return DBUS_HANDLER_RESULT_HANDLED;
 	}
 
+	stats_count(COUNTER_MESSAGES_PROCESSED);
+	if (state->daemon->recorder != NULL) recorder_write(state->daemon->recorder, message);
 	if (!strcmp("Notify", member)) {
+		// Everything after the reply happens on the pipeline's workers, so
+		// the only check made here is the one the reply depends on
+		if (!dbus_message_has_signature(message, NOTIFY_SIGNATURE)) {
+			stats_count(COUNTER_DROPPED);
+			if (state->is_server && message_type == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+				DBusMessage *r = dbus_message_new_error(
+					message,
+					DBUS_ERROR_INVALID_ARGS,
+					"Notify takes (susssasa{sv}i)"
+				);
+				send_message(conn, r);
+				dbus_message_unref(r);
+			}
+			return DBUS_HANDLER_RESULT_HANDLED;
+		}
+		dbus_uint32_t id = 0;
 		if (state->is_server) {
-			++state->last_notification_id;
+			id = open_notification(state, message)->id;
 			DBusMessage *r = dbus_message_new_method_return(message);
-			add_to_message(r, "u", state->last_notification_id);
-			dbus_connection_send(conn, r, NULL);
+			add_to_message(r, "u", id);
+			send_message(conn, r);
 			dbus_message_unref(r);
 		}
-
-		json_object *notification = get_notification(message);
-		json_object *hooks = json_object_object_get(state->options, "hooks");
-		for (size_t i = 0; i < json_object_array_length(hooks); ++i) {
-			json_object *hook = json_object_array_get_idx(hooks, i);
-			run_hook(hook, notification);
-		}
-		json_object_put(notification);
+		pipeline_push(state->daemon->pipeline, message, id, state);
+		stats_record(STAGE_DISPATCH, received);
 	} else if (!strcmp("NotificationClosed", member)) {
+		// The server runs these hooks itself as it closes its notifications
+		if (!state->is_server && message_type == DBUS_MESSAGE_TYPE_SIGNAL) {
+			monitor_closed(state, message);
+		}
 	} else if (!strcmp("GetServerInformation", member)) {
 		if (state->is_server) {
 			DBusMessage *r = dbus_message_new_method_return(message);
@@ -375,15 +910,18 @@ DBusHandlerResult handler(DBusConnection *conn, DBusMessage *message, void *user
 				SERVER_VERSION,
 				SERVER_SPEC_VERSION
 			);
-			dbus_connection_send(conn, r, NULL);
+			send_message(conn, r);
 			dbus_message_unref(r);
 		}
 	} else if (!strcmp("GetCapabilities", member)) {
 		if (state->is_server) {
 			DBusMessage *r = dbus_message_new_method_return(message);
+			// Notifications are only kept until they expire when the
+			// server picks their timeout
+			gboolean persistence = state->daemon->config->default_timeout == 0;
 			add_to_message(
 				r, "as",
-				6,
+				persistence ? 6 : 5,
 				"actions",
 				"body",
 				"body-hyperlinks",
@@ -391,13 +929,30 @@ DBusHandlerResult handler(DBusConnection *conn, DBusMessage *message, void *user
 				"body-markup",
 				"persistence"
 			);
-			dbus_connection_send(conn, r, NULL);
+			send_message(conn, r);
 			dbus_message_unref(r);
 		}
 	} else if (!strcmp("CloseNotification", member)) {
 		if (state->is_server) {
-			DBusMessage *r = dbus_message_new_method_return(message);
-			dbus_connection_send(conn, r, NULL);
+			dbus_uint32_t id;
+			DBusMessageIter iter;
+			dbus_message_iter_init(message, &iter);
+			struct LiveNotification *live = NULL;
+			if (get_basic_arg(DBUS_TYPE_UINT32, &iter, &id)) {
+				live = find_live_notification(state, id);
+			}
+			DBusMessage *r;
+			if (live != NULL) {
+				close_notification(live, CLOSE_CALLED);
+				r = dbus_message_new_method_return(message);
+			} else {
+				r = dbus_message_new_error(
+					message,
+					DBUS_ERROR_INVALID_ARGS,
+					"No open notification has that id"
+				);
+			}
+			send_message(conn, r);
 			dbus_message_unref(r);
 		}
 	}
@@ -2,12 +2,55 @@
 #define HANDLER_H
 
 #include <dbus/dbus.h>
+#include <glib.h>
 #include <json-c/json.h>
+#include "cache.h"
+#include "capture.h"
+#include "config.h"
+#include "executor.h"
+#include "hook-log.h"
+#include "pipeline.h"
+#include "timer-wheel.h"
 
+/* What the handlers of every connection share: the configuration and what
+ * decodes notifications and runs hooks. */
+struct Daemon {
+	struct Config *config;
+	struct Loop *loop;
+	struct Executor *executor;
+	struct Pipeline *pipeline;
+	struct Cache *cache;
+	struct TimerWheel *timers;
+	/* What hook processes write */
+	struct HookLog *hook_log;
+	/* Where notification traffic is captured, if anywhere */
+	struct Recorder *recorder;
+	/* Timeout that next writes the stats file, or 0 */
+	unsigned stats_timeout;
+	/* The handler of every bus connection */
+	GPtrArray *handlers;
+	/* When a server last received a message */
+	gint64 last_active;
+	/* Timeout that next checks whether the daemon has been idle for
+	 * idle_exit_ms, or 0 */
+	unsigned idle_timeout;
+	/* Set once the name has been released on the way to exiting */
+	dbus_bool_t exiting;
+	/* When an exiting daemon stops waiting for notifications to close */
+	gint64 exit_deadline;
+};
+
+/* The handler of one bus connection. */
 struct HandlerState {
-	json_object *options;
+	struct Daemon *daemon;
 	dbus_bool_t is_server;
+	/* The bus the server emits its signals on */
+	DBusConnection *connection;
 	dbus_uint32_t last_notification_id;
+	/* Notifications the server has not closed yet, by id */
+	GHashTable *live;
+	/* The events a monitor's match rules let it see */
+	unsigned monitored_events;
 };
 
 extern const char *SERVER_NAME;
@@ -15,6 +58,11 @@ extern const char *SERVER_VENDOR;
 extern const char *SERVER_VERSION;
 extern const char *SERVER_SPEC_VERSION;
 
+void start_hooks(struct Daemon *daemon);
+void stop_hooks(struct Config *config);
+struct Notification *decode_notification(DBusMessage *message, dbus_uint32_t id, void *data);
+void complete_notification(struct Notification *notification, dbus_uint32_t id, void *data);
+void free_live_notification(gpointer data);
 DBusHandlerResult handler(DBusConnection *conn, DBusMessage *message, void *user_data);
 
 #endif
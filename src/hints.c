@@ -0,0 +1,233 @@
+#include <string.h>
+#include "hints.h"
+
+#define HASH_SIZE 32
+
+/* Indexed by hint_hash, which has no collisions between these names. Adding
+ * a hint means checking that its hash is free, or finding new multipliers. */
+static const struct HintInfo HINTS[HASH_SIZE] = {
+	[1] = { "sender-pid", HINT_INTEGER, SLOT_SENDER_PID, 1 },
+	[4] = { "image-data", HINT_IMAGE, SLOT_IMAGE_DATA_PNG, 3 },
+	[10] = { "category", HINT_STRING, SLOT_CATEGORY, 1 },
+	[13] = { "image_path", HINT_STRING, SLOT_IMAGE_PATH_HINT, 1 },
+	[16] = { "sound-file", HINT_STRING, SLOT_SOUND_FILE, 1 },
+	[17] = { "sound-name", HINT_STRING, SLOT_SOUND_NAME, 1 },
+	[18] = { "y", HINT_INTEGER, SLOT_Y, 1 },
+	[19] = { "action-icons", HINT_BOOLEAN, SLOT_ACTION_ICONS, 1 },
+	[20] = { "transient", HINT_BOOLEAN, SLOT_TRANSIENT, 1 },
+	[22] = { "image_data", HINT_IMAGE, SLOT_IMAGE_DATA_PNG, 2 },
+	[23] = { "desktop-entry", HINT_STRING, SLOT_DESKTOP_ENTRY, 1 },
+	[25] = { "x", HINT_INTEGER, SLOT_X, 1 },
+	[26] = { "icon_data", HINT_IMAGE, SLOT_IMAGE_DATA_PNG, 1 },
+	[27] = { "image-path", HINT_STRING, SLOT_IMAGE_PATH_HINT, 2 },
+	[29] = { "suppress-sound", HINT_BOOLEAN, SLOT_SUPPRESS_SOUND, 1 },
+	[30] = { "urgency", HINT_INTEGER, SLOT_URGENCY, 1 },
+	[31] = { "resident", HINT_BOOLEAN, SLOT_RESIDENT, 1 },
+};
+
+static const char *const HINT_NAMES[] = {
+	[SLOT_ACTION_ICONS] = "action-icons",
+	[SLOT_CATEGORY] = "category",
+	[SLOT_DESKTOP_ENTRY] = "desktop-entry",
+	[SLOT_IMAGE_PATH_HINT] = "image-path",
+	[SLOT_RESIDENT] = "resident",
+	[SLOT_SENDER_PID] = "sender-pid",
+	[SLOT_SOUND_FILE] = "sound-file",
+	[SLOT_SOUND_NAME] = "sound-name",
+	[SLOT_SUPPRESS_SOUND] = "suppress-sound",
+	[SLOT_TRANSIENT] = "transient",
+	[SLOT_URGENCY] = "urgency",
+	[SLOT_X] = "x",
+	[SLOT_Y] = "y",
+};
+
+static guint hint_hash(const char *name, size_t length) {
+	const guchar *s = (const guchar *)name;
+	guint hash = length + s[0] * 8 + s[length - 1] * 17;
+	if (length > 1) hash += s[length - 2];
+	if (length > 5) hash += s[5];
+	return hash % HASH_SIZE;
+}
+
+const struct HintInfo *hints_find(const char *name) {
+	size_t length = strlen(name);
+	if (length == 0) return NULL;
+	const struct HintInfo *hint = &HINTS[hint_hash(name, length)];
+	if (hint->name == NULL || strcmp(hint->name, name) != 0) return NULL;
+	return hint;
+}
+
+const char *hints_get_name(int slot) {
+	if (slot < SLOT_FIRST_HINT || slot >= (int)G_N_ELEMENTS(HINT_NAMES)) return NULL;
+	return HINT_NAMES[slot];
+}
+
+static dbus_bool_t get_integer(DBusMessageIter *iter, gint64 *out) {
+	switch (dbus_message_iter_get_arg_type(iter)) {
+	case DBUS_TYPE_BYTE: {
+		unsigned char v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	case DBUS_TYPE_INT16: {
+		dbus_int16_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	case DBUS_TYPE_UINT16: {
+		dbus_uint16_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	case DBUS_TYPE_INT32: {
+		dbus_int32_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	case DBUS_TYPE_UINT32: {
+		dbus_uint32_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	case DBUS_TYPE_INT64: {
+		dbus_int64_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	case DBUS_TYPE_UINT64: {
+		dbus_uint64_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		*out = v;
+		return TRUE;
+	}
+	}
+	return FALSE;
+}
+
+void hints_decode(struct Notification *notification, const struct HintInfo *hint, DBusMessageIter *value) {
+	int type = dbus_message_iter_get_arg_type(value);
+	if (notification->ranks[hint->slot] > hint->rank) return;
+	switch (hint->decoder) {
+	case HINT_STRING: {
+		const char *v;
+		if (type != DBUS_TYPE_STRING) return;
+		dbus_message_iter_get_basic(value, &v);
+		notification_set_string(notification, hint->slot, v);
+		break;
+	}
+	case HINT_BOOLEAN: {
+		dbus_bool_t v;
+		if (type != DBUS_TYPE_BOOLEAN) return;
+		dbus_message_iter_get_basic(value, &v);
+		notification_set_boolean(notification, hint->slot, v);
+		break;
+	}
+	case HINT_INTEGER: {
+		gint64 v;
+		if (!get_integer(value, &v)) return;
+		notification_set_int(notification, hint->slot, v);
+		break;
+	}
+	case HINT_IMAGE:
+		return;
+	}
+	notification->ranks[hint->slot] = hint->rank;
+}
+
+static json_object *value_to_json(DBusMessageIter *iter);
+
+/* Arrays of dict entries with string keys become objects, other arrays and
+ * structs become arrays. */
+static json_object *container_to_json(DBusMessageIter *iter) {
+	DBusMessageIter sub;
+	dbus_message_iter_recurse(iter, &sub);
+	if (
+		dbus_message_iter_get_arg_type(iter) == DBUS_TYPE_ARRAY &&
+		dbus_message_iter_get_element_type(iter) == DBUS_TYPE_DICT_ENTRY
+	) {
+		json_object *object = json_object_new_object();
+		while (dbus_message_iter_get_arg_type(&sub) == DBUS_TYPE_DICT_ENTRY) {
+			DBusMessageIter entry;
+			dbus_message_iter_recurse(&sub, &entry);
+			json_object *key = value_to_json(&entry);
+			dbus_message_iter_next(&entry);
+			// Keys are basic types, which print without quotes
+			const char *name = json_object_is_type(key, json_type_string)
+				? json_object_get_string(key)
+				: json_object_to_json_string(key);
+			json_object_object_add(object, name, value_to_json(&entry));
+			json_object_put(key);
+			dbus_message_iter_next(&sub);
+		}
+		return object;
+	}
+	json_object *array = json_object_new_array();
+	while (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
+		json_object_array_add(array, value_to_json(&sub));
+		dbus_message_iter_next(&sub);
+	}
+	return array;
+}
+
+static json_object *value_to_json(DBusMessageIter *iter) {
+	struct Value value = hints_decode_other(iter);
+	switch (value.type) {
+	case VALUE_NONE:
+		return NULL;
+	case VALUE_STRING:
+		return json_object_new_string(value.string);
+	case VALUE_INT:
+		return json_object_new_int64(value.number);
+	case VALUE_BOOLEAN:
+		return json_object_new_boolean(value.boolean);
+	case VALUE_DOUBLE:
+		return json_object_new_double(value.real);
+	case VALUE_JSON:
+		return value.json;
+	}
+	return NULL;
+}
+
+struct Value hints_decode_other(DBusMessageIter *iter) {
+	struct Value value = { VALUE_NONE };
+	int type = dbus_message_iter_get_arg_type(iter);
+	switch (type) {
+	case DBUS_TYPE_STRING:
+	case DBUS_TYPE_OBJECT_PATH:
+	case DBUS_TYPE_SIGNATURE:
+		value.type = VALUE_STRING;
+		dbus_message_iter_get_basic(iter, &value.string);
+		break;
+	case DBUS_TYPE_BOOLEAN: {
+		dbus_bool_t v;
+		dbus_message_iter_get_basic(iter, &v);
+		value.type = VALUE_BOOLEAN;
+		value.boolean = v;
+		break;
+	}
+	case DBUS_TYPE_DOUBLE:
+		value.type = VALUE_DOUBLE;
+		dbus_message_iter_get_basic(iter, &value.real);
+		break;
+	case DBUS_TYPE_VARIANT: {
+		DBusMessageIter sub;
+		dbus_message_iter_recurse(iter, &sub);
+		return hints_decode_other(&sub);
+	}
+	case DBUS_TYPE_ARRAY:
+	case DBUS_TYPE_STRUCT:
+		value.type = VALUE_JSON;
+		value.json = container_to_json(iter);
+		break;
+	default:
+		if (get_integer(iter, &value.number)) value.type = VALUE_INT;
+		break;
+	}
+	return value;
+}
@@ -0,0 +1,37 @@
+#ifndef HINTS_H
+#define HINTS_H
+
+#include <dbus/dbus.h>
+#include <glib.h>
+#include <json-c/json.h>
+#include "notification.h"
+
+enum HintDecoder {
+	HINT_STRING,
+	HINT_BOOLEAN,
+	/* Any integer type, since senders disagree on them */
+	HINT_INTEGER,
+	/* The (iiibiiay) of image-data */
+	HINT_IMAGE,
+};
+
+/* A hint the specification defines. Older names of a hint share its slot and
+ * have a lower rank, so the current name wins when both are sent. */
+struct HintInfo {
+	const char *name;
+	enum HintDecoder decoder;
+	enum NotificationSlot slot;
+	unsigned char rank;
+};
+
+const struct HintInfo *hints_find(const char *name);
+/* The current name of the hint kept in slot */
+const char *hints_get_name(int slot);
+/* Decodes a known hint into its slot. Values of the wrong type are dropped.
+ * Image hints are left to the caller. */
+void hints_decode(struct Notification *notification, const struct HintInfo *hint, DBusMessageIter *value);
+/* Decodes any value, for hints the daemon does not know. Containers become
+ * JSON. */
+struct Value hints_decode_other(DBusMessageIter *value);
+
+#endif
@@ -0,0 +1,336 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+#include "config.h"
+#include "hook-log.h"
+
+/* Longer lines are split */
+#define MAX_LINE 4096
+/* Bytes read from one pipe per wakeup, so that a noisy hook cannot keep the
+ * loop to itself */
+#define READ_BUDGET (64 << 10)
+
+struct LineHeader {
+	gint64 time;
+	guint32 pid;
+	guint32 id;
+	guint32 length;
+};
+
+/* The newest lines of one hook, each a LineHeader followed by its text, in a
+ * buffer that wraps around. The oldest lines make room for new ones. */
+struct Ring {
+	/* Allocated on the first line */
+	gchar *data;
+	size_t size;
+	/* Where the oldest line starts */
+	size_t head;
+	size_t used;
+};
+
+struct HookLog {
+	struct Loop *loop;
+	/* Hook id to struct Ring, for the hooks of the current config */
+	GHashTable *rings;
+	/* Their ids, in the config's order */
+	GArray *ids;
+	size_t ring_size;
+	gchar *path;
+	FILE *file;
+	size_t file_size;
+	size_t max_file_size;
+	int max_files;
+};
+
+struct HookOutput {
+	struct HookLog *log;
+	/* The hook's id */
+	size_t hook;
+	dbus_uint32_t id;
+	pid_t pid;
+	int read_fd;
+	int write_fd;
+	/* The line being read */
+	gchar line[MAX_LINE];
+	size_t length;
+};
+
+typedef void (*LineFunction)(size_t hook, const struct LineHeader *header, const gchar *text, void *data);
+
+static void ring_write(struct Ring *ring, size_t offset, const void *source, size_t n) {
+	offset %= ring->size;
+	size_t first = MIN(n, ring->size - offset);
+	memcpy(ring->data + offset, source, first);
+	memcpy(ring->data, (const gchar *)source + first, n - first);
+}
+
+static void ring_read(const struct Ring *ring, size_t offset, void *destination, size_t n) {
+	offset %= ring->size;
+	size_t first = MIN(n, ring->size - offset);
+	memcpy(destination, ring->data + offset, first);
+	memcpy((gchar *)destination + first, ring->data, n - first);
+}
+
+static struct Ring *ring_new(size_t size) {
+	struct Ring *ring = g_new0(struct Ring, 1);
+	ring->size = size;
+	return ring;
+}
+
+static void ring_free(gpointer data) {
+	struct Ring *ring = data;
+	g_free(ring->data);
+	g_free(ring);
+}
+
+static struct Ring *get_ring(const struct HookLog *log, size_t hook) {
+	return g_hash_table_lookup(log->rings, GSIZE_TO_POINTER(hook));
+}
+
+static void ring_push(struct Ring *ring, struct LineHeader header, const gchar *text) {
+	if (ring->data == NULL) ring->data = g_malloc(ring->size);
+	// Rings smaller than a line keep the start of it
+	header.length = MIN(header.length, ring->size - sizeof(header));
+	size_t record = sizeof(header) + header.length;
+	while (ring->size - ring->used < record) {
+		struct LineHeader oldest;
+		ring_read(ring, ring->head, &oldest, sizeof(oldest));
+		ring->head = (ring->head + sizeof(oldest) + oldest.length) % ring->size;
+		ring->used -= sizeof(oldest) + oldest.length;
+	}
+	size_t tail = ring->head + ring->used;
+	ring_write(ring, tail, &header, sizeof(header));
+	ring_write(ring, tail + sizeof(header), text, header.length);
+	ring->used += record;
+}
+
+static void ring_foreach(const struct Ring *ring, size_t hook, LineFunction fn, void *data) {
+	gchar text[MAX_LINE];
+	size_t offset = 0;
+	while (offset < ring->used) {
+		struct LineHeader header;
+		ring_read(ring, ring->head + offset, &header, sizeof(header));
+		ring_read(ring, ring->head + offset + sizeof(header), text, header.length);
+		fn(hook, &header, text, data);
+		offset += sizeof(header) + header.length;
+	}
+}
+
+static int print_line(FILE *file, size_t hook, const struct LineHeader *header, const gchar *text) {
+	char stamp[32];
+	time_t seconds = header->time / G_USEC_PER_SEC;
+	struct tm tm;
+	localtime_r(&seconds, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+	return fprintf(
+		file,
+		"%s hook %zu pid %u id %u: %.*s\n",
+		stamp,
+		hook,
+		header->pid,
+		header->id,
+		(int)header->length,
+		text
+	);
+}
+
+static void open_file(struct HookLog *log) {
+	log->file = fopen(log->path, "ae");
+	if (log->file == NULL) {
+		perror(log->path);
+		return;
+	}
+	long size = ftell(log->file);
+	log->file_size = size > 0 ? size : 0;
+}
+
+static void close_file(struct HookLog *log) {
+	if (log->file != NULL) fclose(log->file);
+	log->file = NULL;
+}
+
+/* Shifts FILE to FILE.1, FILE.1 to FILE.2 and so on, dropping the oldest. */
+static void rotate_file(struct HookLog *log) {
+	close_file(log);
+	if (log->max_files == 0) unlink(log->path);
+	for (int i = log->max_files; i > 0; --i) {
+		gchar *from = i > 1 ? g_strdup_printf("%s.%d", log->path, i - 1) : g_strdup(log->path);
+		gchar *to = g_strdup_printf("%s.%d", log->path, i);
+		// Files that are not there yet are skipped
+		rename(from, to);
+		g_free(from);
+		g_free(to);
+	}
+	open_file(log);
+}
+
+static void add_line(struct HookOutput *output) {
+	struct HookLog *log = output->log;
+	struct LineHeader header = { g_get_real_time(), output->pid, output->id, output->length };
+	output->length = 0;
+	// Processes may outlive their hook when the config is reloaded
+	struct Ring *ring = get_ring(log, output->hook);
+	if (ring != NULL) ring_push(ring, header, output->line);
+	if (log->file == NULL) return;
+	int written = print_line(log->file, output->hook, &header, output->line);
+	if (written > 0) log->file_size += written;
+	if (log->file_size >= log->max_file_size) rotate_file(log);
+}
+
+static void append_text(struct HookOutput *output, const gchar *text, size_t length) {
+	while (length > 0) {
+		const gchar *end = memchr(text, '\n', length);
+		size_t take = MIN(end != NULL ? (size_t)(end - text) : length, MAX_LINE - output->length);
+		memcpy(output->line + output->length, text, take);
+		output->length += take;
+		text += take;
+		length -= take;
+		if (length > 0 && *text == '\n') {
+			++text;
+			--length;
+			add_line(output);
+		} else if (output->length == MAX_LINE) {
+			add_line(output);
+		}
+	}
+}
+
+/* Closes output once every process holding the pipe, including any children
+ * the hook left behind, has closed it. */
+static void finish_output(struct HookOutput *output) {
+	if (output->length > 0) add_line(output);
+	loop_remove_fd(output->log->loop, output->read_fd);
+	close(output->read_fd);
+	g_free(output);
+}
+
+static void on_readable(int fd, short revents, void *data) {
+	struct HookOutput *output = data;
+	struct HookLog *log = output->log;
+	gchar buffer[16 << 10];
+	for (size_t total = 0; total < READ_BUDGET;) {
+		ssize_t n = read(fd, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno == EAGAIN) break;
+		if (n <= 0) {
+			finish_output(output);
+			break;
+		}
+		append_text(output, buffer, n);
+		total += n;
+	}
+	if (log->file != NULL) fflush(log->file);
+}
+
+struct HookLog *hook_log_new(struct Loop *loop) {
+	struct HookLog *log = g_new0(struct HookLog, 1);
+	log->loop = loop;
+	log->rings = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, ring_free);
+	log->ids = g_array_new(FALSE, FALSE, sizeof(size_t));
+	return log;
+}
+
+void hook_log_configure(struct HookLog *log, const struct Config *config) {
+	size_t ring_size = config->hook_output_size;
+	if (ring_size > 0) ring_size = MAX(ring_size, sizeof(struct LineHeader) + 1);
+	if (ring_size != log->ring_size) {
+		g_hash_table_remove_all(log->rings);
+		log->ring_size = ring_size;
+	}
+	// Rings follow their hook wherever it moved, and go with it
+	GHashTable *rings = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, ring_free);
+	g_array_set_size(log->ids, 0);
+	for (size_t i = 0; i < config->n_hooks && log->ring_size > 0; ++i) {
+		gpointer key = GSIZE_TO_POINTER(config->hooks[i].id);
+		gpointer ring;
+		if (!g_hash_table_steal_extended(log->rings, key, NULL, &ring)) ring = ring_new(log->ring_size);
+		g_hash_table_insert(rings, key, ring);
+		g_array_append_val(log->ids, config->hooks[i].id);
+	}
+	g_hash_table_unref(log->rings);
+	log->rings = rings;
+
+	log->max_file_size = config->hook_output_file_size;
+	log->max_files = config->hook_output_files;
+	if (g_strcmp0(config->hook_output_file, log->path) != 0) {
+		close_file(log);
+		g_free(log->path);
+		log->path = g_strdup(config->hook_output_file);
+		if (log->path != NULL) open_file(log);
+	}
+}
+
+struct HookOutput *hook_output_open(struct HookLog *log, size_t hook_id, dbus_uint32_t id) {
+	if (log->ring_size == 0) return NULL;
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		return NULL;
+	}
+	// Only the daemon's end; the hook's writes block as usual
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	struct HookOutput *output = g_new0(struct HookOutput, 1);
+	output->log = log;
+	output->hook = hook_id;
+	output->id = id;
+	output->read_fd = fds[0];
+	output->write_fd = fds[1];
+	return output;
+}
+
+int hook_output_get_fd(const struct HookOutput *output) {
+	return output->write_fd;
+}
+
+void hook_output_start(struct HookOutput *output, pid_t pid) {
+	close(output->write_fd);
+	if (pid < 0) {
+		close(output->read_fd);
+		g_free(output);
+		return;
+	}
+	output->pid = pid;
+	loop_add_fd(output->log->loop, output->read_fd, POLLIN, on_readable, output);
+}
+
+static void append_line(size_t hook, const struct LineHeader *header, const gchar *text, void *data) {
+	DBusMessageIter *array = data;
+	DBusMessageIter entry;
+	// D-Bus strings must be UTF-8, which hooks need not write
+	gchar *line = g_utf8_make_valid(text, header->length);
+	dbus_int64_t time = header->time;
+	dbus_uint32_t pid = header->pid;
+	dbus_uint32_t id = header->id;
+	dbus_message_iter_open_container(array, DBUS_TYPE_STRUCT, NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_INT64, &time);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_UINT32, &pid);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_UINT32, &id);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &line);
+	dbus_message_iter_close_container(array, &entry);
+	g_free(line);
+}
+
+void hook_log_append_to_message(struct HookLog *log, size_t hook_id, DBusMessage *message) {
+	DBusMessageIter iter;
+	DBusMessageIter array;
+	dbus_message_iter_init_append(message, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(xuus)", &array);
+	struct Ring *ring = get_ring(log, hook_id);
+	if (ring != NULL) ring_foreach(ring, hook_id, append_line, &array);
+	dbus_message_iter_close_container(&iter, &array);
+}
+
+static void print_to_file(size_t hook, const struct LineHeader *header, const gchar *text, void *data) {
+	print_line(data, hook, header, text);
+}
+
+void hook_log_print(struct HookLog *log, FILE *file) {
+	for (guint i = 0; i < log->ids->len; ++i) {
+		size_t hook = g_array_index(log->ids, size_t, i);
+		ring_foreach(get_ring(log, hook), hook, print_to_file, file);
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef HOOK_LOG_H
+#define HOOK_LOG_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <dbus/dbus.h>
+#include "loop.h"
+
+/* What hook processes write to stdout and stderr. Every process gets a pipe
+ * that the loop reads without blocking, and each line is tagged with the
+ * hook's id, the pid and the notification id. The newest lines of each
+ * hook are kept in a ring buffer of fixed size, and can also be appended to a
+ * file that is rotated when it grows too large. */
+struct HookLog;
+
+struct Config;
+
+/* The output of one process, read until every writer has closed it. */
+struct HookOutput;
+
+struct HookLog *hook_log_new(struct Loop *loop);
+/* Applies the output settings of config, keeping the lines of hooks whose
+ * id is still in it. */
+void hook_log_configure(struct HookLog *log, const struct Config *config);
+
+/* Returns the output of a process about to be run for the hook with hook_id,
+ * about the notification with id or 0, or NULL if it should inherit the
+ * daemon's stdout and stderr. */
+struct HookOutput *hook_output_open(struct HookLog *log, size_t hook_id, dbus_uint32_t id);
+/* The fd the process is given as its stdout and stderr. */
+int hook_output_get_fd(const struct HookOutput *output);
+/* Starts reading once the process has been spawned, or forgets output if pid
+ * is negative because it could not be. */
+void hook_output_start(struct HookOutput *output, pid_t pid);
+
+/* Appends the lines of the hook with hook_id, oldest first, as a(xuus): the
+ * time in microseconds since the epoch, the pid, the notification id and the
+ * line. */
+void hook_log_append_to_message(struct HookLog *log, size_t hook_id, DBusMessage *message);
+/* Prints every hook's lines. */
+void hook_log_print(struct HookLog *log, FILE *file);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef I_SPY_NOTIFY_PLUGIN_H
+#define I_SPY_NOTIFY_PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hooks of "type": "plugin" are shared objects that i-spy-notify loads and
+ * calls in-process, on a thread of their own, instead of spawning a process
+ * for each notification.
+ *
+ * A plugin exports a function named by ISPY_NOTIFY_PLUGIN_ENTRY, of type
+ * ISpyNotifyPluginEntry. It is called once when the configuration is loaded,
+ * and returns the plugin's functions or NULL to refuse to load. Each version
+ * of this interface has an entry point of its own, and its structs only ever
+ * grow at the end, so plugins keep working with newer daemons. */
+
+#define ISPY_NOTIFY_PLUGIN_VERSION 1
+#define ISPY_NOTIFY_PLUGIN_ENTRY "ispy_notify_plugin_v1"
+
+enum ISpyNotifyValueType {
+	ISPY_NOTIFY_VALUE_NONE,
+	ISPY_NOTIFY_VALUE_STRING,
+	ISPY_NOTIFY_VALUE_INT,
+	ISPY_NOTIFY_VALUE_BOOLEAN,
+	ISPY_NOTIFY_VALUE_DOUBLE,
+	/* A hint the daemon does not know that holds a container, as JSON text
+	 * in string */
+	ISPY_NOTIFY_VALUE_JSON,
+};
+
+struct ISpyNotifyValue {
+	/* An ISpyNotifyValueType */
+	int type;
+	union {
+		const char *string;
+		int64_t number;
+		int boolean;
+		double real;
+	};
+};
+
+/* A decoded notification. It, and every string read from it, is only valid
+ * until the call it was passed to returns. */
+struct ISpyNotifyNotification;
+
+/* What the daemon offers plugins. Every function may be called from the
+ * plugin's thread. */
+struct ISpyNotifyHost {
+	uint32_t version;
+	/* Returns the field at a path like the ones in a hook's arguments, such
+	 * as { "hints", "urgency" }. Image fields are only there when some
+	 * hook's arguments ask for them. */
+	struct ISpyNotifyValue (*get)(
+		const struct ISpyNotifyNotification *notification,
+		const char *const *path,
+		size_t length
+	);
+	size_t (*get_n_actions)(const struct ISpyNotifyNotification *notification);
+	const char *(*get_action)(const struct ISpyNotifyNotification *notification, size_t i);
+};
+
+struct ISpyNotifyPlugin {
+	/* ISPY_NOTIFY_PLUGIN_VERSION as the plugin was built */
+	uint32_t version;
+	/* Called first with the hook's command and string arguments. Returns 0
+	 * and sets *state for the other functions, or nonzero to receive
+	 * nothing. May be NULL. */
+	int (*start)(const char *const *argv, void **state);
+	/* Called for every notification whose match passes. It should return
+	 * within the hook's budget_ms. */
+	void (*notify)(void *state, const struct ISpyNotifyNotification *notification);
+	/* Called last, once the hook is removed or the configuration reloaded.
+	 * May be NULL. */
+	void (*stop)(void *state);
+};
+
+typedef const struct ISpyNotifyPlugin *(*ISpyNotifyPluginEntry)(const struct ISpyNotifyHost *host);
+
+#endif
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "icon-theme.h"
+
+/* Flags of an image in icon-theme.cache, which double as the extensions found
+ * in the directory index */
+#define HAS_SUFFIX_XPM (1 << 0)
+#define HAS_SUFFIX_SVG (1 << 1)
+#define HAS_SUFFIX_PNG (1 << 2)
+
+#define CACHE_NONE 0xffffffff
+
+enum DirType {
+	DIR_FIXED,
+	DIR_SCALABLE,
+	DIR_THRESHOLD,
+};
+
+struct ThemeDir {
+	gchar *name;
+	enum DirType type;
+	int size;
+	int min_size;
+	int max_size;
+	int threshold;
+	int scale;
+};
+
+/* One base directory a theme is installed in, such as /usr/share/icons/X */
+struct ThemeRoot {
+	gchar *path;
+	GMappedFile *cache;
+	/* Theme dir index for each directory in the cache, or -1 */
+	int *cache_dirs;
+	guint32 n_cache_dirs;
+	/* Icon name to a GArray of struct Found, built on first use when there
+	 * is no usable cache */
+	GHashTable *index;
+};
+
+struct Found {
+	int dir;
+	guint flags;
+};
+
+struct Theme {
+	gchar *name;
+	struct ThemeDir *dirs;
+	size_t n_dirs;
+	gchar **inherits;
+	GPtrArray *roots;
+};
+
+struct IconThemes {
+	gchar *theme_name;
+	GPtrArray *base_dirs;
+	/* Theme name to struct Theme, or NULL for themes that are not installed */
+	GHashTable *themes;
+};
+
+static guint32 read32(const guchar *data, gsize size, guint32 offset) {
+	if ((gsize)offset + 4 > size) return CACHE_NONE;
+	return (guint32)data[offset] << 24 | (guint32)data[offset + 1] << 16 |
+		(guint32)data[offset + 2] << 8 | data[offset + 3];
+}
+
+static guint16 read16(const guchar *data, gsize size, guint32 offset) {
+	if ((gsize)offset + 2 > size) return 0xffff;
+	return (guint16)(data[offset] << 8 | data[offset + 1]);
+}
+
+static const char *read_string(const guchar *data, gsize size, guint32 offset) {
+	if (offset >= size || memchr(data + offset, '\0', size - offset) == NULL) return NULL;
+	return (const char *)data + offset;
+}
+
+/* The hash GTK uses for icon-theme.cache */
+static guint32 icon_name_hash(const char *name) {
+	const signed char *p = (const signed char *)name;
+	guint32 h = *p;
+	if (h != 0) {
+		for (p += 1; *p != '\0'; ++p) h = (h << 5) - h + *p;
+	}
+	return h;
+}
+
+static int find_dir(struct Theme *theme, const char *name) {
+	for (size_t i = 0; i < theme->n_dirs; ++i) {
+		if (!strcmp(theme->dirs[i].name, name)) return i;
+	}
+	return -1;
+}
+
+/* Maps root's icon-theme.cache if it is at least as new as the directory,
+ * which is how GTK decides whether to trust it. */
+static void open_cache(struct Theme *theme, struct ThemeRoot *root) {
+	gchar *path = g_build_filename(root->path, "icon-theme.cache", NULL);
+	struct stat cache_info;
+	struct stat dir_info;
+	if (
+		stat(path, &cache_info) < 0 ||
+		stat(root->path, &dir_info) < 0 ||
+		cache_info.st_mtime < dir_info.st_mtime
+	) {
+		g_free(path);
+		return;
+	}
+	GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+	g_free(path);
+	if (file == NULL) return;
+
+	const guchar *data = (const guchar *)g_mapped_file_get_contents(file);
+	gsize size = g_mapped_file_get_length(file);
+	if (read16(data, size, 0) != 1) {
+		g_mapped_file_unref(file);
+		return;
+	}
+	guint32 list = read32(data, size, 8);
+	guint32 n_dirs = read32(data, size, list);
+	if (n_dirs == CACHE_NONE || n_dirs > size / 4) {
+		g_mapped_file_unref(file);
+		return;
+	}
+	root->cache = file;
+	root->n_cache_dirs = n_dirs;
+	root->cache_dirs = g_new(int, n_dirs);
+	for (guint32 i = 0; i < n_dirs; ++i) {
+		const char *name = read_string(data, size, read32(data, size, list + 4 + 4 * i));
+		root->cache_dirs[i] = name != NULL ? find_dir(theme, name) : -1;
+	}
+}
+
+static void add_found(GHashTable *index, const char *filename, int dir) {
+	static const struct {
+		const char *suffix;
+		guint flag;
+	} suffixes[] = {
+		{ ".png", HAS_SUFFIX_PNG },
+		{ ".svg", HAS_SUFFIX_SVG },
+		{ ".xpm", HAS_SUFFIX_XPM },
+	};
+	for (size_t i = 0; i < G_N_ELEMENTS(suffixes); ++i) {
+		if (!g_str_has_suffix(filename, suffixes[i].suffix)) continue;
+		gchar *name = g_strndup(filename, strlen(filename) - 4);
+		GArray *found = g_hash_table_lookup(index, name);
+		if (found == NULL) {
+			found = g_array_new(FALSE, FALSE, sizeof(struct Found));
+			g_hash_table_insert(index, name, found);
+		} else {
+			g_free(name);
+		}
+		for (guint j = 0; j < found->len; ++j) {
+			struct Found *entry = &g_array_index(found, struct Found, j);
+			if (entry->dir == dir) {
+				entry->flags |= suffixes[i].flag;
+				return;
+			}
+		}
+		struct Found entry = { dir, suffixes[i].flag };
+		g_array_append_val(found, entry);
+		return;
+	}
+}
+
+static void free_found(gpointer found) {
+	g_array_free(found, TRUE);
+}
+
+static void build_index(struct Theme *theme, struct ThemeRoot *root) {
+	root->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_found);
+	for (size_t i = 0; i < theme->n_dirs; ++i) {
+		gchar *path = g_build_filename(root->path, theme->dirs[i].name, NULL);
+		GDir *dir = g_dir_open(path, 0, NULL);
+		g_free(path);
+		if (dir == NULL) continue;
+		const gchar *filename;
+		while ((filename = g_dir_read_name(dir)) != NULL) {
+			add_found(root->index, filename, i);
+		}
+		g_dir_close(dir);
+	}
+}
+
+/* Lists the theme dirs of root that have name, with the extensions found. */
+static void find_in_root(struct Theme *theme, struct ThemeRoot *root, const char *name, GArray *out) {
+	if (root->cache != NULL) {
+		const guchar *data = (const guchar *)g_mapped_file_get_contents(root->cache);
+		gsize size = g_mapped_file_get_length(root->cache);
+		guint32 hash = read32(data, size, 4);
+		guint32 n_buckets = read32(data, size, hash);
+		if (n_buckets == 0 || n_buckets == CACHE_NONE) return;
+		guint32 icon = read32(data, size, hash + 4 + 4 * (icon_name_hash(name) % n_buckets));
+		// Chains are followed for at most as many steps as the file could
+		// hold, so a corrupt cache cannot loop forever
+		for (gsize steps = 0; icon != CACHE_NONE && steps < size / 12; ++steps) {
+			const char *icon_name = read_string(data, size, read32(data, size, icon + 4));
+			if (icon_name != NULL && !strcmp(icon_name, name)) {
+				guint32 images = read32(data, size, icon + 8);
+				guint32 n_images = read32(data, size, images);
+				for (guint32 i = 0; n_images != CACHE_NONE && i < n_images; ++i) {
+					guint16 dir = read16(data, size, images + 4 + 8 * i);
+					guint16 flags = read16(data, size, images + 6 + 8 * i);
+					if (dir >= root->n_cache_dirs || root->cache_dirs[dir] < 0) continue;
+					struct Found found = { root->cache_dirs[dir], flags };
+					g_array_append_val(out, found);
+				}
+				return;
+			}
+			icon = read32(data, size, icon);
+		}
+		return;
+	}
+
+	if (root->index == NULL) build_index(theme, root);
+	GArray *found = g_hash_table_lookup(root->index, name);
+	if (found != NULL) g_array_append_vals(out, found->data, found->len);
+}
+
+static gboolean dir_matches_size(const struct ThemeDir *dir, int size) {
+	switch (dir->type) {
+	case DIR_FIXED:
+		return dir->size == size;
+	case DIR_SCALABLE:
+		return dir->min_size <= size && size <= dir->max_size;
+	case DIR_THRESHOLD:
+		return dir->size - dir->threshold <= size && size <= dir->size + dir->threshold;
+	}
+	return FALSE;
+}
+
+static int dir_size_distance(const struct ThemeDir *dir, int size) {
+	switch (dir->type) {
+	case DIR_FIXED:
+		return ABS(dir->size - size);
+	case DIR_SCALABLE:
+		if (size < dir->min_size) return dir->min_size - size;
+		if (size > dir->max_size) return size - dir->max_size;
+		return 0;
+	case DIR_THRESHOLD:
+		if (size < dir->size - dir->threshold) return dir->size - dir->threshold - size;
+		if (size > dir->size + dir->threshold) return size - dir->size - dir->threshold;
+		return 0;
+	}
+	return G_MAXINT;
+}
+
+static const char *get_suffix(guint flags) {
+	if (flags & HAS_SUFFIX_PNG) return ".png";
+	if (flags & HAS_SUFFIX_SVG) return ".svg";
+	if (flags & HAS_SUFFIX_XPM) return ".xpm";
+	return NULL;
+}
+
+static gchar *lookup_in_theme(struct Theme *theme, const char *name, int size) {
+	GArray *found = g_array_new(FALSE, FALSE, sizeof(struct Found));
+	struct ThemeRoot *best_root = NULL;
+	struct Found best = { -1, 0 };
+	int best_distance = G_MAXINT;
+	for (guint i = 0; i < theme->roots->len && best_distance > 0; ++i) {
+		struct ThemeRoot *root = g_ptr_array_index(theme->roots, i);
+		g_array_set_size(found, 0);
+		find_in_root(theme, root, name, found);
+		for (guint j = 0; j < found->len; ++j) {
+			struct Found *entry = &g_array_index(found, struct Found, j);
+			const struct ThemeDir *dir = &theme->dirs[entry->dir];
+			if (get_suffix(entry->flags) == NULL || dir->scale != 1) continue;
+			int distance = dir_matches_size(dir, size) ? 0 : dir_size_distance(dir, size);
+			if (distance < best_distance) {
+				best_distance = distance;
+				best = *entry;
+				best_root = root;
+			}
+		}
+	}
+	g_array_free(found, TRUE);
+	if (best_root == NULL) return NULL;
+
+	gchar *filename = g_strconcat(name, get_suffix(best.flags), NULL);
+	gchar *path = g_build_filename(best_root->path, theme->dirs[best.dir].name, filename, NULL);
+	g_free(filename);
+	return path;
+}
+
+static void parse_dir(GKeyFile *index, const char *name, struct ThemeDir *dir) {
+	gchar *type = g_key_file_get_string(index, name, "Type", NULL);
+	dir->name = g_strdup(name);
+	dir->size = g_key_file_get_integer(index, name, "Size", NULL);
+	dir->scale = g_key_file_has_key(index, name, "Scale", NULL)
+		? g_key_file_get_integer(index, name, "Scale", NULL)
+		: 1;
+	dir->min_size = g_key_file_has_key(index, name, "MinSize", NULL)
+		? g_key_file_get_integer(index, name, "MinSize", NULL)
+		: dir->size;
+	dir->max_size = g_key_file_has_key(index, name, "MaxSize", NULL)
+		? g_key_file_get_integer(index, name, "MaxSize", NULL)
+		: dir->size;
+	dir->threshold = g_key_file_has_key(index, name, "Threshold", NULL)
+		? g_key_file_get_integer(index, name, "Threshold", NULL)
+		: 2;
+	if (type != NULL && !strcmp(type, "Fixed")) dir->type = DIR_FIXED;
+	else if (type != NULL && !strcmp(type, "Scalable")) dir->type = DIR_SCALABLE;
+	else dir->type = DIR_THRESHOLD;
+	g_free(type);
+}
+
+static struct Theme *load_theme(struct IconThemes *themes, const char *name) {
+	struct Theme *theme = NULL;
+	GKeyFile *index = NULL;
+	for (guint i = 0; i < themes->base_dirs->len; ++i) {
+		gchar *path = g_build_filename(g_ptr_array_index(themes->base_dirs, i), name, NULL);
+		gchar *index_path = g_build_filename(path, "index.theme", NULL);
+		if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+			g_free(path);
+			g_free(index_path);
+			continue;
+		}
+		// The first index.theme found describes the theme for all roots
+		if (index == NULL) {
+			GKeyFile *key_file = g_key_file_new();
+			if (g_key_file_load_from_file(key_file, index_path, G_KEY_FILE_NONE, NULL)) {
+				index = key_file;
+			} else {
+				g_key_file_free(key_file);
+			}
+		}
+		if (theme == NULL) {
+			theme = g_new0(struct Theme, 1);
+			theme->name = g_strdup(name);
+			theme->roots = g_ptr_array_new();
+		}
+		struct ThemeRoot *root = g_new0(struct ThemeRoot, 1);
+		root->path = path;
+		g_ptr_array_add(theme->roots, root);
+		g_free(index_path);
+	}
+	if (theme == NULL) return NULL;
+	if (index == NULL) {
+		// Not a theme after all, just a directory
+		for (guint i = 0; i < theme->roots->len; ++i) {
+			struct ThemeRoot *root = g_ptr_array_index(theme->roots, i);
+			g_free(root->path);
+			g_free(root);
+		}
+		g_ptr_array_unref(theme->roots);
+		g_free(theme->name);
+		g_free(theme);
+		return NULL;
+	}
+
+	gsize n_dirs = 0;
+	gchar **dirs = g_key_file_get_string_list(index, "Icon Theme", "Directories", &n_dirs, NULL);
+	theme->n_dirs = n_dirs;
+	theme->dirs = g_new0(struct ThemeDir, n_dirs);
+	for (gsize i = 0; i < n_dirs; ++i) parse_dir(index, dirs[i], &theme->dirs[i]);
+	g_strfreev(dirs);
+	theme->inherits = g_key_file_get_string_list(index, "Icon Theme", "Inherits", NULL, NULL);
+	g_key_file_free(index);
+
+	for (guint i = 0; i < theme->roots->len; ++i) {
+		open_cache(theme, g_ptr_array_index(theme->roots, i));
+	}
+	return theme;
+}
+
+static struct Theme *get_theme(struct IconThemes *themes, const char *name) {
+	gpointer theme;
+	if (!g_hash_table_lookup_extended(themes->themes, name, NULL, &theme)) {
+		theme = load_theme(themes, name);
+		g_hash_table_insert(themes->themes, g_strdup(name), theme);
+	}
+	return theme;
+}
+
+static gchar *lookup_in_chain(
+	struct IconThemes *themes,
+	const char *theme_name,
+	const char *name,
+	int size,
+	GHashTable *visited
+) {
+	if (g_hash_table_contains(visited, theme_name)) return NULL;
+	g_hash_table_add(visited, (gpointer)theme_name);
+	struct Theme *theme = get_theme(themes, theme_name);
+	if (theme == NULL) return NULL;
+
+	gchar *path = lookup_in_theme(theme, name, size);
+	for (gchar **parent = theme->inherits; path == NULL && parent != NULL && *parent != NULL; ++parent) {
+		path = lookup_in_chain(themes, *parent, name, size, visited);
+	}
+	return path;
+}
+
+static gchar *lookup_in_pixmaps(const char *name) {
+	static const char *const suffixes[] = { ".png", ".svg", ".xpm" };
+	const gchar *const *data_dirs = g_get_system_data_dirs();
+	for (; *data_dirs != NULL; ++data_dirs) {
+		for (size_t i = 0; i < G_N_ELEMENTS(suffixes); ++i) {
+			gchar *filename = g_strconcat(name, suffixes[i], NULL);
+			gchar *path = g_build_filename(*data_dirs, "pixmaps", filename, NULL);
+			g_free(filename);
+			if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) return path;
+			g_free(path);
+		}
+	}
+	return NULL;
+}
+
+/* The theme GTK would use, from its settings file, else the fallback theme. */
+static gchar *get_default_theme_name(void) {
+	gchar *path = g_build_filename(g_get_user_config_dir(), "gtk-3.0", "settings.ini", NULL);
+	GKeyFile *settings = g_key_file_new();
+	gchar *name = NULL;
+	if (g_key_file_load_from_file(settings, path, G_KEY_FILE_NONE, NULL)) {
+		name = g_key_file_get_string(settings, "Settings", "gtk-icon-theme-name", NULL);
+	}
+	g_key_file_free(settings);
+	g_free(path);
+	return name != NULL ? name : g_strdup("hicolor");
+}
+
+struct IconThemes *icon_themes_new(const char *theme_name) {
+	struct IconThemes *themes = g_new0(struct IconThemes, 1);
+	themes->theme_name = theme_name != NULL ? g_strdup(theme_name) : get_default_theme_name();
+	themes->base_dirs = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(themes->base_dirs, g_build_filename(g_get_home_dir(), ".icons", NULL));
+	g_ptr_array_add(themes->base_dirs, g_build_filename(g_get_user_data_dir(), "icons", NULL));
+	for (const gchar *const *dir = g_get_system_data_dirs(); *dir != NULL; ++dir) {
+		g_ptr_array_add(themes->base_dirs, g_build_filename(*dir, "icons", NULL));
+	}
+	themes->themes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	return themes;
+}
+
+gchar *icon_themes_lookup(struct IconThemes *themes, const char *name, int size) {
+	GHashTable *visited = g_hash_table_new(g_str_hash, g_str_equal);
+	gchar *path = lookup_in_chain(themes, themes->theme_name, name, size, visited);
+	if (path == NULL) path = lookup_in_chain(themes, "hicolor", name, size, visited);
+	g_hash_table_unref(visited);
+	if (path == NULL) path = lookup_in_pixmaps(name);
+	return path;
+}
+
+void icon_themes_set_theme(struct IconThemes *themes, const char *theme_name) {
+	g_free(themes->theme_name);
+	themes->theme_name = g_strdup(theme_name);
+}
@@ -0,0 +1,18 @@
+#ifndef ICON_THEME_H
+#define ICON_THEME_H
+
+#include <glib.h>
+
+/* Looks icon names up in XDG icon themes without GTK, following the Icon Theme
+ * Specification. Themes are read lazily on first use. A theme's
+ * icon-theme.cache, where present and up to date, is mapped and searched in
+ * place; otherwise its directories are listed once and indexed. */
+struct IconThemes;
+
+struct IconThemes *icon_themes_new(const char *theme_name);
+/* Returns the file for name at size pixels, or NULL if no theme has it. */
+gchar *icon_themes_lookup(struct IconThemes *themes, const char *name, int size);
+/* Looks icons up in theme_name from now on. Themes already read are kept. */
+void icon_themes_set_theme(struct IconThemes *themes, const char *theme_name);
+
+#endif
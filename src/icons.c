@@ -0,0 +1,84 @@
+#include <stdio.h>
+#ifdef WITH_GTK
+#include <gtk/gtk.h>
+#endif
+#include "icons.h"
+#include "icon-theme.h"
+
+/* The theme cache may not be used by two decoding threads at once */
+static GMutex icons_lock;
+static struct IconThemes *icon_themes;
+/* Cleared once GTK cannot be started */
+static gint icons_gtk = FALSE;
+
+#ifdef WITH_GTK
+static int *gtk_argc;
+static char ***gtk_argv;
+
+/* Returns NULL if GTK cannot be used. GTK is only initialized here, since
+ * opening the display and reading its settings would otherwise delay the
+ * first reply of every daemon, most of which never see an icon that the
+ * built-in lookup cannot find. */
+static GtkIconTheme *get_gtk_theme(void) {
+	static GtkIconTheme *theme = NULL;
+	if (theme == NULL && g_atomic_int_get(&icons_gtk)) {
+		if (gtk_init_check(gtk_argc, gtk_argv)) {
+			theme = gtk_icon_theme_get_default();
+			// The display's settings may name another theme than the
+			// settings file did
+			gchar *name = NULL;
+			g_object_get(gtk_settings_get_default(), "gtk-icon-theme-name", &name, NULL);
+			if (name != NULL) {
+				g_mutex_lock(&icons_lock);
+				icon_themes_set_theme(icon_themes, name);
+				g_mutex_unlock(&icons_lock);
+			}
+			g_free(name);
+		} else {
+			fprintf(stderr, "Cannot initialize GTK, using the built-in icon lookup.\n");
+			g_atomic_int_set(&icons_gtk, FALSE);
+		}
+	}
+	return theme;
+}
+#endif
+
+void icons_init(gboolean use_gtk, int *argc, char ***argv) {
+	icon_themes = icon_themes_new(NULL);
+#ifdef WITH_GTK
+	g_atomic_int_set(&icons_gtk, use_gtk);
+	gtk_argc = argc;
+	gtk_argv = argv;
+#endif
+}
+
+gboolean icons_lookup(const char *name, int size, gchar **path) {
+	g_mutex_lock(&icons_lock);
+	*path = icon_themes_lookup(icon_themes, name, size);
+	g_mutex_unlock(&icons_lock);
+	return *path != NULL;
+}
+
+gboolean icons_use_gtk(void) {
+	return g_atomic_int_get(&icons_gtk);
+}
+
+gboolean icons_lookup_gtk(const char *name, int size, gchar **path, GdkPixbuf **buf) {
+	*path = NULL;
+	*buf = NULL;
+#ifdef WITH_GTK
+	GtkIconTheme *theme = get_gtk_theme();
+	GtkIconInfo *info = theme != NULL ? gtk_icon_theme_lookup_icon(theme, name, size, 0) : NULL;
+	if (info == NULL) return FALSE;
+	const char *filename = gtk_icon_info_get_filename(info);
+	if (filename != NULL) {
+		*path = g_strdup(filename);
+	} else {
+		*buf = gtk_icon_info_load_icon(info, NULL);
+	}
+	g_object_unref(info);
+	return *path != NULL || *buf != NULL;
+#else
+	return FALSE;
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef ICONS_H
+#define ICONS_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Resolves icon names through the built-in XDG lookup on any thread, and
+ * through GTK's icon theme on the main thread only. GTK is not started until
+ * the first name that the built-in lookup cannot find, and is given the
+ * remaining command line then. */
+void icons_init(gboolean use_gtk, int *argc, char ***argv);
+/* Returns FALSE if no theme has name. Otherwise path is set to a copy of the
+ * icon's file. */
+gboolean icons_lookup(const char *name, int size, gchar **path);
+/* Whether names that icons_lookup cannot find should be given to
+ * icons_lookup_gtk. */
+gboolean icons_use_gtk(void);
+/* Main thread only. Returns FALSE if GTK's theme does not have name either.
+ * Otherwise sets path to a copy of the icon's file, or buf to the icon if it
+ * only exists in memory. */
+gboolean icons_lookup_gtk(const char *name, int size, gchar **path, GdkPixbuf **buf);
+
+#endif
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include "image.h"
+
+static gboolean write_all(int fd, const gchar *bytes, gsize size) {
+	while (size > 0) {
+		ssize_t written = write(fd, bytes, size);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return FALSE;
+		}
+		bytes += written;
+		size -= written;
+	}
+	return TRUE;
+}
+
+static struct ImageFile *new_memfd(const gchar *bytes, gsize size) {
+	int fd = memfd_create("i-spy-notify.png", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) return NULL;
+	if (!write_all(fd, bytes, size)) {
+		close(fd);
+		return NULL;
+	}
+	// Hooks share the file, so none of them may change it
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+	struct ImageFile *image = g_new0(struct ImageFile, 1);
+	image->refs = 1;
+	image->fd = fd;
+	image->path = g_strdup_printf("/proc/self/fd/%d", fd);
+	image->size = size;
+	return image;
+}
+
+static struct ImageFile *new_temporary(const gchar *bytes, gsize size) {
+	gchar *path = g_build_filename(g_get_tmp_dir(), "i-spy-notify-XXXXXX.png", NULL);
+	int fd = g_mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		g_free(path);
+		return NULL;
+	}
+	if (!write_all(fd, bytes, size)) {
+		perror(path);
+		close(fd);
+		g_unlink(path);
+		g_free(path);
+		return NULL;
+	}
+	close(fd);
+
+	struct ImageFile *image = g_new0(struct ImageFile, 1);
+	image->refs = 1;
+	image->fd = -1;
+	image->path = path;
+	image->size = size;
+	image->is_temporary = TRUE;
+	return image;
+}
+
+struct ImageFile *image_file_new(const gchar *bytes, gsize size, enum ImageDelivery delivery) {
+	struct ImageFile *image = NULL;
+	if (delivery == IMAGE_DELIVERY_MEMFD) image = new_memfd(bytes, size);
+	// Kernels without memfd fall back to a file
+	if (image == NULL) image = new_temporary(bytes, size);
+	return image;
+}
+
+struct ImageFile *image_file_ref(struct ImageFile *image) {
+	g_atomic_int_inc(&image->refs);
+	return image;
+}
+
+void image_file_unref(struct ImageFile *image) {
+	if (image == NULL || !g_atomic_int_dec_and_test(&image->refs)) return;
+	if (image->fd >= 0) close(image->fd);
+	if (image->is_temporary) g_unlink(image->path);
+	g_free(image->path);
+	g_free(image);
+}
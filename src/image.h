@@ -0,0 +1,27 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <glib.h>
+
+enum ImageDelivery {
+	IMAGE_DELIVERY_MEMFD,
+	IMAGE_DELIVERY_FILE,
+};
+
+/* An encoded image handed to hooks by path. It lives in a sealed memfd that
+ * children inherit and open through /proc/self/fd, or in a temporary file
+ * that is deleted once the last reference is dropped, from whichever thread
+ * drops it. */
+struct ImageFile {
+	gint refs;
+	int fd;
+	gchar *path;
+	gsize size;
+	gboolean is_temporary;
+};
+
+struct ImageFile *image_file_new(const gchar *bytes, gsize size, enum ImageDelivery delivery);
+struct ImageFile *image_file_ref(struct ImageFile *image);
+void image_file_unref(struct ImageFile *image);
+
+#endif
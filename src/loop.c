@@ -0,0 +1,511 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <glib.h>
+#include "loop.h"
+
+struct FdSource {
+	int fd;
+	short events;
+	dbus_bool_t removed;
+	LoopFdFunction fn;
+	void *data;
+};
+
+struct SignalSource {
+	int signo;
+	LoopSignalFunction fn;
+	void *data;
+};
+
+struct TimeoutSource {
+	unsigned id;
+	gint64 deadline;
+	LoopTimeoutFunction fn;
+	void *data;
+};
+
+struct ChildSource {
+	LoopChildFunction fn;
+	void *data;
+};
+
+struct PrepareSource {
+	LoopPrepareFunction fn;
+	void *data;
+};
+
+/* A bus connection driven by the loop. libdbus may give it one watch for
+ * reading and another for writing on the same fd, so its watches are kept
+ * together and registered by fd. */
+struct ConnectionSource {
+	struct Loop *loop;
+	DBusConnection *connection;
+	GPtrArray *watches;
+	/* Set by loop_remove_connection; it is freed between iterations, since
+	 * it may be removed while it dispatches */
+	dbus_bool_t removed;
+};
+
+/* A libdbus timeout, which repeats until it is removed or disabled */
+struct BusTimeout {
+	struct Loop *loop;
+	DBusTimeout *timeout;
+	/* Loop timeout of the next expiry, or 0 */
+	unsigned id;
+};
+
+/* Events epoll_wait returns at most per iteration */
+#define MAX_EVENTS 64
+
+struct Loop {
+	int epoll_fd;
+	/* Registered fds, by fd */
+	GHashTable *fds;
+	/* Removed fds, freed once the events already returned for them are
+	 * skipped */
+	GPtrArray *removed;
+	GArray *signals;
+	GArray *prepares;
+	GPtrArray *timeouts;
+	unsigned last_timeout_id;
+	GHashTable *children;
+	GPtrArray *connections;
+	sigset_t mask;
+	int signal_fd;
+	dbus_bool_t running;
+};
+
+static void reap_children(int signo, void *data) {
+	struct Loop *loop = data;
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		struct ChildSource *source = g_hash_table_lookup(loop->children, GINT_TO_POINTER(pid));
+		if (source == NULL) continue;
+		g_hash_table_steal(loop->children, GINT_TO_POINTER(pid));
+		source->fn(pid, status, source->data);
+		g_free(source);
+	}
+}
+
+struct Loop *loop_new(void) {
+	struct Loop *loop = g_new0(struct Loop, 1);
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) perror("epoll_create1");
+	loop->fds = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	loop->removed = g_ptr_array_new_with_free_func(g_free);
+	loop->signals = g_array_new(FALSE, FALSE, sizeof(struct SignalSource));
+	loop->prepares = g_array_new(FALSE, FALSE, sizeof(struct PrepareSource));
+	loop->timeouts = g_ptr_array_new_with_free_func(g_free);
+	loop->children = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	loop->connections = g_ptr_array_new();
+	sigemptyset(&loop->mask);
+	loop->signal_fd = -1;
+	// SIGCHLD is routed to the loop before any child can be started, so
+	// none of them exit unnoticed
+	loop_add_signal(loop, SIGCHLD, reap_children, loop);
+	return loop;
+}
+
+static void unwatch_connection(struct ConnectionSource *source) {
+	dbus_connection_set_watch_functions(source->connection, NULL, NULL, NULL, NULL, NULL);
+	dbus_connection_set_timeout_functions(source->connection, NULL, NULL, NULL, NULL, NULL);
+}
+
+static void free_connection_source(struct ConnectionSource *source) {
+	dbus_connection_unref(source->connection);
+	g_ptr_array_free(source->watches, TRUE);
+	g_free(source);
+}
+
+void loop_free(struct Loop *loop) {
+	for (guint i = 0; i < loop->connections->len; ++i) {
+		struct ConnectionSource *source = g_ptr_array_index(loop->connections, i);
+		if (!source->removed) unwatch_connection(source);
+		free_connection_source(source);
+	}
+	g_ptr_array_free(loop->connections, TRUE);
+	if (loop->signal_fd >= 0) close(loop->signal_fd);
+	close(loop->epoll_fd);
+	g_hash_table_unref(loop->fds);
+	g_ptr_array_unref(loop->removed);
+	g_array_free(loop->signals, TRUE);
+	g_array_free(loop->prepares, TRUE);
+	g_ptr_array_unref(loop->timeouts);
+	g_hash_table_unref(loop->children);
+	g_free(loop);
+}
+
+// Callers use poll's flags, which epoll's match in meaning
+static uint32_t to_epoll_events(short events) {
+	return (
+		(events & POLLIN ? EPOLLIN : 0) |
+		(events & POLLPRI ? EPOLLPRI : 0) |
+		(events & POLLOUT ? EPOLLOUT : 0)
+	);
+}
+
+static short from_epoll_events(uint32_t events) {
+	return (
+		(events & EPOLLIN ? POLLIN : 0) |
+		(events & EPOLLPRI ? POLLPRI : 0) |
+		(events & EPOLLOUT ? POLLOUT : 0) |
+		(events & EPOLLERR ? POLLERR : 0) |
+		(events & EPOLLHUP ? POLLHUP : 0)
+	);
+}
+
+dbus_bool_t loop_add_fd(struct Loop *loop, int fd, short events, LoopFdFunction fn, void *data) {
+	if (g_hash_table_contains(loop->fds, GINT_TO_POINTER(fd))) return FALSE;
+	struct FdSource *source = g_new0(struct FdSource, 1);
+	source->fd = fd;
+	source->events = events;
+	source->fn = fn;
+	source->data = data;
+	struct epoll_event event = { to_epoll_events(events), { .ptr = source } };
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		perror("epoll_ctl");
+		g_free(source);
+		return FALSE;
+	}
+	g_hash_table_insert(loop->fds, GINT_TO_POINTER(fd), source);
+	return TRUE;
+}
+
+void loop_set_fd_events(struct Loop *loop, int fd, short events) {
+	struct FdSource *source = g_hash_table_lookup(loop->fds, GINT_TO_POINTER(fd));
+	if (source == NULL || source->events == events) return;
+	source->events = events;
+	struct epoll_event event = { to_epoll_events(events), { .ptr = source } };
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) perror("epoll_ctl");
+}
+
+void loop_remove_fd(struct Loop *loop, int fd) {
+	// Sources are only marked here and freed between iterations, so that
+	// callbacks may remove any fd, including their own
+	struct FdSource *source = g_hash_table_lookup(loop->fds, GINT_TO_POINTER(fd));
+	if (source == NULL) return;
+	g_hash_table_steal(loop->fds, GINT_TO_POINTER(fd));
+	// Fails harmlessly when the fd was closed first, which unregistered it
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	source->removed = TRUE;
+	g_ptr_array_add(loop->removed, source);
+}
+
+static void dispatch_signals(int fd, short revents, void *data) {
+	struct Loop *loop = data;
+	struct signalfd_siginfo info;
+	while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+		for (guint i = 0; i < loop->signals->len; ++i) {
+			struct SignalSource *source = &g_array_index(loop->signals, struct SignalSource, i);
+			if ((int)info.ssi_signo == source->signo) source->fn(source->signo, source->data);
+		}
+	}
+}
+
+dbus_bool_t loop_add_signal(struct Loop *loop, int signo, LoopSignalFunction fn, void *data) {
+	struct SignalSource source = { signo, fn, data };
+	sigaddset(&loop->mask, signo);
+	if (sigprocmask(SIG_BLOCK, &loop->mask, NULL) < 0) {
+		perror("sigprocmask");
+		return FALSE;
+	}
+	int fd = signalfd(loop->signal_fd, &loop->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		perror("signalfd");
+		return FALSE;
+	}
+	if (loop->signal_fd < 0) {
+		loop->signal_fd = fd;
+		loop_add_fd(loop, fd, POLLIN, dispatch_signals, loop);
+	}
+	g_array_append_val(loop->signals, source);
+	return TRUE;
+}
+
+unsigned loop_add_timeout(struct Loop *loop, int ms, LoopTimeoutFunction fn, void *data) {
+	struct TimeoutSource *source = g_new0(struct TimeoutSource, 1);
+	if (++loop->last_timeout_id == 0) ++loop->last_timeout_id;
+	source->id = loop->last_timeout_id;
+	source->deadline = g_get_monotonic_time() + (gint64)(ms > 0 ? ms : 0) * 1000;
+	source->fn = fn;
+	source->data = data;
+	g_ptr_array_add(loop->timeouts, source);
+	return source->id;
+}
+
+void loop_remove_timeout(struct Loop *loop, unsigned id) {
+	for (guint i = 0; i < loop->timeouts->len; ++i) {
+		struct TimeoutSource *source = g_ptr_array_index(loop->timeouts, i);
+		if (source->id == id) {
+			g_ptr_array_remove_index_fast(loop->timeouts, i);
+			return;
+		}
+	}
+}
+
+void loop_watch_child(struct Loop *loop, pid_t pid, LoopChildFunction fn, void *data) {
+	struct ChildSource *source = g_new0(struct ChildSource, 1);
+	source->fn = fn;
+	source->data = data;
+	g_hash_table_insert(loop->children, GINT_TO_POINTER(pid), source);
+}
+
+static int get_wait_timeout(struct Loop *loop) {
+	gint64 first = G_MAXINT64;
+	for (guint i = 0; i < loop->timeouts->len; ++i) {
+		struct TimeoutSource *source = g_ptr_array_index(loop->timeouts, i);
+		if (source->deadline < first) first = source->deadline;
+	}
+	if (first == G_MAXINT64) return -1;
+	gint64 now = g_get_monotonic_time();
+	if (first <= now) return 0;
+	// Round up so that the timer has expired once epoll_wait returns
+	gint64 ms = (first - now + 999) / 1000;
+	return ms > G_MAXINT ? G_MAXINT : (int)ms;
+}
+
+static struct TimeoutSource *steal_timeout(struct Loop *loop, unsigned id) {
+	for (guint i = 0; i < loop->timeouts->len; ++i) {
+		struct TimeoutSource *source = g_ptr_array_index(loop->timeouts, i);
+		if (source->id == id) {
+			g_ptr_array_index(loop->timeouts, i) = NULL;
+			g_ptr_array_remove_index_fast(loop->timeouts, i);
+			return source;
+		}
+	}
+	return NULL;
+}
+
+static void dispatch_timeouts(struct Loop *loop) {
+	gint64 now = g_get_monotonic_time();
+	GArray *expired = g_array_new(FALSE, FALSE, sizeof(unsigned));
+	for (guint i = 0; i < loop->timeouts->len; ++i) {
+		struct TimeoutSource *source = g_ptr_array_index(loop->timeouts, i);
+		if (source->deadline <= now) g_array_append_val(expired, source->id);
+	}
+	// Callbacks may add or remove timeouts; ones added now wait for the
+	// next iteration
+	for (guint i = 0; i < expired->len; ++i) {
+		struct TimeoutSource *source = steal_timeout(loop, g_array_index(expired, unsigned, i));
+		if (source == NULL) continue;
+		source->fn(source->data);
+		g_free(source);
+	}
+	g_array_free(expired, TRUE);
+}
+
+void loop_add_prepare(struct Loop *loop, LoopPrepareFunction fn, void *data) {
+	struct PrepareSource source = { fn, data };
+	g_array_append_val(loop->prepares, source);
+}
+
+static void handle_watches(int fd, short revents, void *data) {
+	struct ConnectionSource *source = data;
+	GPtrArray *ready = g_ptr_array_new();
+	for (guint i = 0; i < source->watches->len; ++i) {
+		DBusWatch *watch = g_ptr_array_index(source->watches, i);
+		if (dbus_watch_get_unix_fd(watch) == fd && dbus_watch_get_enabled(watch)) {
+			g_ptr_array_add(ready, watch);
+		}
+	}
+	for (guint i = 0; i < ready->len; ++i) {
+		DBusWatch *watch = g_ptr_array_index(ready, i);
+		// Handling one watch may remove the other
+		if (!g_ptr_array_find(source->watches, watch, NULL)) continue;
+		unsigned flags = dbus_watch_get_flags(watch);
+		unsigned condition = 0;
+		if ((revents & POLLIN) && (flags & DBUS_WATCH_READABLE)) condition |= DBUS_WATCH_READABLE;
+		if ((revents & POLLOUT) && (flags & DBUS_WATCH_WRITABLE)) condition |= DBUS_WATCH_WRITABLE;
+		if (revents & POLLERR) condition |= DBUS_WATCH_ERROR;
+		if (revents & POLLHUP) condition |= DBUS_WATCH_HANGUP;
+		if (condition != 0) dbus_watch_handle(watch, condition);
+	}
+	g_ptr_array_free(ready, TRUE);
+}
+
+/* Registers fd for what its enabled watches wait for. It is removed when they
+ * wait for nothing, since epoll would still report errors and hangups. */
+static void update_watched_fd(struct ConnectionSource *source, int fd) {
+	short events = 0;
+	for (guint i = 0; i < source->watches->len; ++i) {
+		DBusWatch *watch = g_ptr_array_index(source->watches, i);
+		if (dbus_watch_get_unix_fd(watch) != fd || !dbus_watch_get_enabled(watch)) continue;
+		unsigned flags = dbus_watch_get_flags(watch);
+		if (flags & DBUS_WATCH_READABLE) events |= POLLIN;
+		if (flags & DBUS_WATCH_WRITABLE) events |= POLLOUT;
+	}
+	gboolean registered = g_hash_table_contains(source->loop->fds, GINT_TO_POINTER(fd));
+	if (events == 0) {
+		if (registered) loop_remove_fd(source->loop, fd);
+	} else if (registered) {
+		loop_set_fd_events(source->loop, fd, events);
+	} else {
+		loop_add_fd(source->loop, fd, events, handle_watches, source);
+	}
+}
+
+static dbus_bool_t add_watch(DBusWatch *watch, void *data) {
+	struct ConnectionSource *source = data;
+	g_ptr_array_add(source->watches, watch);
+	update_watched_fd(source, dbus_watch_get_unix_fd(watch));
+	return TRUE;
+}
+
+static void remove_watch(DBusWatch *watch, void *data) {
+	struct ConnectionSource *source = data;
+	g_ptr_array_remove_fast(source->watches, watch);
+	update_watched_fd(source, dbus_watch_get_unix_fd(watch));
+}
+
+static void toggle_watch(DBusWatch *watch, void *data) {
+	update_watched_fd(data, dbus_watch_get_unix_fd(watch));
+}
+
+static void handle_timeout(void *data) {
+	struct BusTimeout *bus_timeout = data;
+	// Rearmed first, because libdbus may remove the timeout, and free this,
+	// while handling it
+	bus_timeout->id = loop_add_timeout(
+		bus_timeout->loop,
+		dbus_timeout_get_interval(bus_timeout->timeout),
+		handle_timeout,
+		bus_timeout
+	);
+	dbus_timeout_handle(bus_timeout->timeout);
+}
+
+static void arm_timeout(struct BusTimeout *bus_timeout) {
+	if (bus_timeout->id != 0) loop_remove_timeout(bus_timeout->loop, bus_timeout->id);
+	bus_timeout->id = 0;
+	if (dbus_timeout_get_enabled(bus_timeout->timeout)) {
+		bus_timeout->id = loop_add_timeout(
+			bus_timeout->loop,
+			dbus_timeout_get_interval(bus_timeout->timeout),
+			handle_timeout,
+			bus_timeout
+		);
+	}
+}
+
+static void free_bus_timeout(void *data) {
+	struct BusTimeout *bus_timeout = data;
+	if (bus_timeout->id != 0) loop_remove_timeout(bus_timeout->loop, bus_timeout->id);
+	g_free(bus_timeout);
+}
+
+static dbus_bool_t add_timeout(DBusTimeout *timeout, void *data) {
+	struct ConnectionSource *source = data;
+	struct BusTimeout *bus_timeout = g_new0(struct BusTimeout, 1);
+	bus_timeout->loop = source->loop;
+	bus_timeout->timeout = timeout;
+	dbus_timeout_set_data(timeout, bus_timeout, free_bus_timeout);
+	arm_timeout(bus_timeout);
+	return TRUE;
+}
+
+static void remove_timeout(DBusTimeout *timeout, void *data) {
+	struct BusTimeout *bus_timeout = dbus_timeout_get_data(timeout);
+	if (bus_timeout->id != 0) loop_remove_timeout(bus_timeout->loop, bus_timeout->id);
+	bus_timeout->id = 0;
+}
+
+static void toggle_timeout(DBusTimeout *timeout, void *data) {
+	arm_timeout(dbus_timeout_get_data(timeout));
+}
+
+static void dispatch_connection(void *data) {
+	struct ConnectionSource *source = data;
+	while (
+		!source->removed &&
+		dbus_connection_dispatch(source->connection) == DBUS_DISPATCH_DATA_REMAINS
+	);
+}
+
+/* Frees the connections removed since the last iteration. */
+static void free_removed_connections(struct Loop *loop) {
+	for (guint i = loop->connections->len; i > 0; --i) {
+		struct ConnectionSource *source = g_ptr_array_index(loop->connections, i - 1);
+		if (!source->removed) continue;
+		for (guint j = 0; j < loop->prepares->len; ++j) {
+			struct PrepareSource *prepare = &g_array_index(loop->prepares, struct PrepareSource, j);
+			if (prepare->fn == dispatch_connection && prepare->data == source) {
+				g_array_remove_index(loop->prepares, j);
+				break;
+			}
+		}
+		g_ptr_array_remove_index(loop->connections, i - 1);
+		free_connection_source(source);
+	}
+}
+
+dbus_bool_t loop_add_connection(struct Loop *loop, DBusConnection *connection) {
+	struct ConnectionSource *source = g_new0(struct ConnectionSource, 1);
+	source->loop = loop;
+	source->connection = dbus_connection_ref(connection);
+	source->watches = g_ptr_array_new();
+	g_ptr_array_add(loop->connections, source);
+	// Outgoing messages are written as the socket becomes writable, by
+	// the watches, rather than flushed with a blocking write
+	if (
+		!dbus_connection_set_watch_functions(
+			connection, add_watch, remove_watch, toggle_watch, source, NULL
+		) ||
+		!dbus_connection_set_timeout_functions(
+			connection, add_timeout, remove_timeout, toggle_timeout, source, NULL
+		)
+	) {
+		fprintf(stderr, "Cannot watch a bus connection.\n");
+		return FALSE;
+	}
+	loop_add_prepare(loop, dispatch_connection, source);
+	return TRUE;
+}
+
+void loop_remove_connection(struct Loop *loop, DBusConnection *connection) {
+	for (guint i = 0; i < loop->connections->len; ++i) {
+		struct ConnectionSource *source = g_ptr_array_index(loop->connections, i);
+		if (source->connection != connection || source->removed) continue;
+		// Removes its watches and timeouts from the loop
+		unwatch_connection(source);
+		source->removed = TRUE;
+		return;
+	}
+}
+
+void loop_run(struct Loop *loop) {
+	struct epoll_event events[MAX_EVENTS];
+	loop->running = TRUE;
+	while (loop->running) {
+		for (guint i = 0; i < loop->prepares->len; ++i) {
+			struct PrepareSource *source = &g_array_index(loop->prepares, struct PrepareSource, i);
+			source->fn(source->data);
+		}
+		free_removed_connections(loop);
+		if (!loop->running) break;
+
+		int ready = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, get_wait_timeout(loop));
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
+			break;
+		}
+		for (int i = 0; i < ready; ++i) {
+			struct FdSource *source = events[i].data.ptr;
+			if (!source->removed) source->fn(source->fd, from_epoll_events(events[i].events), source->data);
+		}
+		g_ptr_array_set_size(loop->removed, 0);
+		dispatch_timeouts(loop);
+	}
+}
+
+void loop_quit(struct Loop *loop) {
+	loop->running = FALSE;
+}
@@ -0,0 +1,35 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <sys/types.h>
+#include <dbus/dbus.h>
+
+struct Loop;
+
+typedef void (*LoopFdFunction)(int fd, short revents, void *data);
+typedef void (*LoopSignalFunction)(int signo, void *data);
+typedef void (*LoopPrepareFunction)(void *data);
+typedef void (*LoopTimeoutFunction)(void *data);
+typedef void (*LoopChildFunction)(pid_t pid, int status, void *data);
+
+struct Loop *loop_new(void);
+void loop_free(struct Loop *loop);
+dbus_bool_t loop_add_fd(struct Loop *loop, int fd, short events, LoopFdFunction fn, void *data);
+void loop_set_fd_events(struct Loop *loop, int fd, short events);
+void loop_remove_fd(struct Loop *loop, int fd);
+dbus_bool_t loop_add_signal(struct Loop *loop, int signo, LoopSignalFunction fn, void *data);
+/* One-shot timer; returns an id for loop_remove_timeout, never 0. */
+unsigned loop_add_timeout(struct Loop *loop, int ms, LoopTimeoutFunction fn, void *data);
+void loop_remove_timeout(struct Loop *loop, unsigned id);
+/* Calls fn once pid has exited and been reaped. */
+void loop_watch_child(struct Loop *loop, pid_t pid, LoopChildFunction fn, void *data);
+void loop_add_prepare(struct Loop *loop, LoopPrepareFunction fn, void *data);
+/* Reads, writes and dispatches connection from the loop, through its watch
+ * and timeout functions. Any number of connections can be added. */
+dbus_bool_t loop_add_connection(struct Loop *loop, DBusConnection *connection);
+/* Stops watching connection, which may be dispatching. */
+void loop_remove_connection(struct Loop *loop, DBusConnection *connection);
+void loop_run(struct Loop *loop);
+void loop_quit(struct Loop *loop);
+
+#endif
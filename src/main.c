@@ -3,16 +3,38 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <signal.h>
 #include <dbus/dbus.h>
 #include <json-c/json.h>
-#include <gtk/gtk.h>
 #include "debug.h"
 #include "message.h"
 #include "handler.h"
+#include "hook-log.h"
+#include "config.h"
+#include "executor.h"
+#include "pipeline.h"
+#include "plugin.h"
+#include "loop.h"
+#include "reload.h"
+#include "capture.h"
+#include "icons.h"
+#include "stats.h"
 
-DBusConnection *connect_to_session_bus() {
+/* Connects to the "session" or "system" bus, or to the bus at an address. */
+DBusConnection *connect_to_bus(const char *bus) {
 	DBusError error = DBUS_ERROR_INIT;
-	DBusConnection *conn = dbus_bus_get(DBUS_BUS_SESSION, &error);
+	DBusConnection *conn;
+	if (!strcmp(bus, "session")) {
+		conn = dbus_bus_get(DBUS_BUS_SESSION, &error);
+	} else if (!strcmp(bus, "system")) {
+		conn = dbus_bus_get(DBUS_BUS_SYSTEM, &error);
+	} else {
+		conn = dbus_connection_open(bus, &error);
+		if (conn != NULL && !dbus_bus_register(conn, &error)) {
+			dbus_connection_unref(conn);
+			conn = NULL;
+		}
+	}
 	if (!conn) debug(&error);
 	dbus_error_free(&error);
 	return conn;
@@ -57,31 +79,426 @@ dbus_bool_t become_server(
 		}
 	}
 	state->is_server = TRUE;
+	state->connection = connection;
 	dbus_error_free(&error);
 	return TRUE;
 }
 
+static const char *NOTIFY_RULE =
+	"type='method_call',"
+	"interface='org.freedesktop.Notifications',"
+	"member='Notify'";
+static const char *CLOSED_RULE =
+	"type='signal',"
+	"interface='org.freedesktop.Notifications',"
+	"member='NotificationClosed'";
+
+/* The events that the hooks of config run for. */
+static unsigned get_hook_events(const struct Config *config) {
+	unsigned events = 0;
+	for (size_t i = 0; i < config->n_hooks; ++i) {
+		events |= config->hooks[i].events;
+	}
+	return events;
+}
+
 void become_monitor(DBusConnection *connection, struct HandlerState *state) {
 	state->is_server = FALSE;
 	DBusError error = DBUS_ERROR_INIT;
 	DBusMessage *message;
 	DBusMessage *reply;
+	// An empty rule list would have the bus copy every message to us, so
+	// ask only for what the hooks can be run for. Notify is always watched,
+	// which keeps a rule in the list and the stats counting.
+	unsigned events = get_hook_events(state->daemon->config);
+	const char *rules[2] = { NOTIFY_RULE };
+	int n_rules = 1;
+	state->monitored_events = EVENT_NOTIFY;
+	if (events & (EVENT_EXPIRED | EVENT_CLOSED)) {
+		rules[n_rules++] = CLOSED_RULE;
+		state->monitored_events |= EVENT_EXPIRED | EVENT_CLOSED;
+	}
+	const char **rules_ptr = rules;
+	dbus_uint32_t flags = 0;
 	message = dbus_message_new_method_call(
 		DBUS_SERVICE_DBUS,
 		DBUS_PATH_DBUS,
 		DBUS_INTERFACE_MONITORING,
 		"BecomeMonitor"
 	);
-	add_to_message(message, "asu", 0, 0);
+	dbus_message_append_args(
+		message,
+		DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &rules_ptr, n_rules,
+		DBUS_TYPE_UINT32, &flags,
+		DBUS_TYPE_INVALID
+	);
 	reply = dbus_connection_send_with_reply_and_block(connection, message, -1, &error);
 	if (reply != NULL) dbus_message_unref(reply);
+	else debug(&error);
+	dbus_error_free(&error);
 	dbus_message_unref(message);
 
 	dbus_connection_add_filter(connection, handler, (void *)state, NULL);
 }
 
+static void print_stats(int signo, void *data) {
+	stats_print(stderr);
+}
+
+static void print_hook_output(int signo, void *data) {
+	struct Daemon *daemon = data;
+	hook_log_print(daemon->hook_log, stderr);
+}
+
+/* Rewrites the stats file every interval. It is written beside the old one
+ * and renamed over it, so that it is never read half written. */
+static void write_stats_file(void *data) {
+	struct Daemon *daemon = data;
+	const char *path = daemon->config->stats_file;
+	daemon->stats_timeout = 0;
+	if (path == NULL) return;
+	gchar *temporary = g_strconcat(path, ".tmp", NULL);
+	FILE *file = fopen(temporary, "we");
+	if (file == NULL) {
+		perror(temporary);
+	} else {
+		stats_write_prometheus(file);
+		if (fclose(file) != 0 || rename(temporary, path) != 0) perror(path);
+	}
+	g_free(temporary);
+	daemon->stats_timeout = loop_add_timeout(
+		daemon->loop,
+		daemon->config->stats_interval_ms,
+		write_stats_file,
+		daemon
+	);
+}
+
+static void schedule_stats_file(struct Daemon *daemon) {
+	if (daemon->stats_timeout != 0) loop_remove_timeout(daemon->loop, daemon->stats_timeout);
+	daemon->stats_timeout = 0;
+	if (daemon->config->stats_file != NULL) {
+		daemon->stats_timeout = loop_add_timeout(daemon->loop, 0, write_stats_file, daemon);
+	}
+}
+
+static void schedule_idle_exit(struct Daemon *daemon);
+
+/* Warns about events the hooks of config run for that a monitor cannot see,
+ * as a monitor's rules are fixed once it starts. */
+static void check_monitored_events(struct Daemon *daemon, const struct Config *config) {
+	unsigned events = get_hook_events(config);
+	for (guint i = 0; i < daemon->handlers->len; ++i) {
+		struct HandlerState *state = g_ptr_array_index(daemon->handlers, i);
+		if (state->is_server || !(events & ~state->monitored_events)) continue;
+		fprintf(stderr, "Closed notifications are not watched until the daemon is restarted.\n");
+		return;
+	}
+}
+
+static void apply_config(struct Config *config, void *data) {
+	struct Daemon *daemon = data;
+	check_monitored_events(daemon, config);
+	// Workers read the config while decoding
+	pipeline_drain(daemon->pipeline);
+	stop_hooks(daemon->config);
+	config_free(daemon->config);
+	daemon->config = config;
+	executor_set_limits(daemon->executor, config->max_running_hooks, config->queues);
+	pipeline_set_threads(daemon->pipeline, config->decode_threads);
+	cache_set_max_size(daemon->cache, config->cache_size);
+	hook_log_configure(daemon->hook_log, config);
+	start_hooks(daemon);
+	schedule_stats_file(daemon);
+	schedule_idle_exit(daemon);
+}
+
+static struct HandlerState *new_handler_state(struct Daemon *daemon) {
+	struct HandlerState *state = g_new0(struct HandlerState, 1);
+	state->daemon = daemon;
+	state->live = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_live_notification);
+	g_ptr_array_add(daemon->handlers, state);
+	return state;
+}
+
+struct Options {
+	gboolean headless;
+	/* The buses to watch, each "session", "system" or an address */
+	GPtrArray *buses;
+	const char *record;
+	const char *replay;
+	/* How many times faster than recorded a capture is replayed */
+	double speed;
+	/* Replay as fast as the capture can be decoded */
+	gboolean max;
+};
+
+/* Removes the daemon's own options from argv, leaving the rest for GTK, and
+ * returns FALSE if they are used wrongly. */
+static gboolean take_options(int *argc, char **argv, struct Options *options) {
+	int out = 1;
+	options->headless = FALSE;
+	options->buses = g_ptr_array_new();
+	options->record = NULL;
+	options->replay = NULL;
+	options->speed = 1;
+	options->max = FALSE;
+	for (int i = 1; i < *argc; ++i) {
+		const char *arg = argv[i];
+		gboolean takes_value = (
+			!strcmp(arg, "--bus") ||
+			!strcmp(arg, "--record") ||
+			!strcmp(arg, "--replay") ||
+			!strcmp(arg, "--speed")
+		);
+		if (takes_value && i + 1 >= *argc) {
+			fprintf(stderr, "%s needs a value.\n", arg);
+			return FALSE;
+		}
+		if (!strcmp(arg, "--headless")) {
+			options->headless = TRUE;
+		} else if (!strcmp(arg, "--max")) {
+			options->max = TRUE;
+		} else if (!strcmp(arg, "--bus")) {
+			g_ptr_array_add(options->buses, argv[++i]);
+		} else if (!strcmp(arg, "--record")) {
+			options->record = argv[++i];
+		} else if (!strcmp(arg, "--replay")) {
+			options->replay = argv[++i];
+		} else if (!strcmp(arg, "--speed")) {
+			options->speed = g_ascii_strtod(argv[++i], NULL);
+			if (!(options->speed > 0)) {
+				fprintf(stderr, "--speed must be a positive number.\n");
+				return FALSE;
+			}
+		} else {
+			argv[out++] = argv[i];
+		}
+	}
+	if (options->buses->len == 0) g_ptr_array_add(options->buses, "session");
+	*argc = out;
+	argv[out] = NULL;
+	return TRUE;
+}
+
+/* Messages a loop iteration replays with --max, so that completed
+ * notifications get to their hooks in between */
+#define REPLAY_BATCH 64
+/* How long notifications sent while the name was being released are waited
+ * for, since one that never expires would keep the daemon forever */
+#define EXIT_GRACE_MS 5000
+
+struct ReplayRun {
+	struct HandlerState *state;
+	struct Replay *replay;
+	double speed;
+	gboolean max;
+	DBusMessage *next;
+	gint64 next_time;
+	gint64 first_time;
+	gint64 start;
+	unsigned long count;
+};
+
+static void wait_for_hooks(void *data) {
+	struct Daemon *daemon = data;
+	if (executor_pending(daemon->executor) > 0 || plugin_hooks_running() > 0) {
+		loop_add_timeout(daemon->loop, 50, wait_for_hooks, daemon);
+	} else {
+		loop_quit(daemon->loop);
+	}
+}
+
+/* Whether exiting would lose nothing: no notification is open or being
+ * decoded, and no hook run is waiting or running. */
+static gboolean is_idle(struct Daemon *daemon) {
+	for (guint i = 0; i < daemon->handlers->len; ++i) {
+		struct HandlerState *state = g_ptr_array_index(daemon->handlers, i);
+		if (g_hash_table_size(state->live) > 0) return FALSE;
+	}
+	return executor_pending(daemon->executor) == 0;
+}
+
+static void release_names(struct Daemon *daemon) {
+	for (guint i = 0; i < daemon->handlers->len; ++i) {
+		struct HandlerState *state = g_ptr_array_index(daemon->handlers, i);
+		if (!state->is_server || state->connection == NULL) continue;
+		DBusError error = DBUS_ERROR_INIT;
+		if (dbus_bus_release_name(state->connection, "org.freedesktop.Notifications", &error) == -1) {
+			debug(&error);
+		}
+		dbus_error_free(&error);
+	}
+}
+
+/* Exits once the server has gone idle_exit_ms without a message and has
+ * nothing left to do. The name is released first, so that the bus starts a
+ * new daemon for the next Notify instead of sending it to this one. */
+static void check_idle(void *data) {
+	struct Daemon *daemon = data;
+	int idle_exit_ms = daemon->config->idle_exit_ms;
+	gint64 now = g_get_monotonic_time();
+	daemon->idle_timeout = 0;
+	if (daemon->exiting) {
+		// Calls sent before the name was released were already queued on
+		// the connection, and are answered before exiting
+		if (is_idle(daemon) || now >= daemon->exit_deadline) {
+			// Left open, they would keep expiring into hooks that are stopped
+			for (guint i = 0; i < daemon->handlers->len; ++i) {
+				struct HandlerState *state = g_ptr_array_index(daemon->handlers, i);
+				g_hash_table_remove_all(state->live);
+			}
+			stop_hooks(daemon->config);
+			wait_for_hooks(daemon);
+		} else {
+			daemon->idle_timeout = loop_add_timeout(daemon->loop, 50, check_idle, daemon);
+		}
+		return;
+	}
+	if (idle_exit_ms == 0) return;
+	gint64 idle_ms = (now - daemon->last_active) / 1000;
+	if (idle_ms < idle_exit_ms) {
+		daemon->idle_timeout = loop_add_timeout(daemon->loop, idle_exit_ms - idle_ms, check_idle, daemon);
+		return;
+	}
+	if (!is_idle(daemon)) {
+		// Open notifications and hooks count as activity, so the daemon
+		// exits about idle_exit_ms after the last of them is done
+		daemon->last_active = now;
+		daemon->idle_timeout = loop_add_timeout(daemon->loop, MIN(idle_exit_ms, 1000), check_idle, daemon);
+		return;
+	}
+	fprintf(stderr, "Idle for %d ms, exiting.\n", idle_exit_ms);
+	release_names(daemon);
+	daemon->exiting = TRUE;
+	daemon->exit_deadline = now + EXIT_GRACE_MS * 1000;
+	daemon->idle_timeout = loop_add_timeout(daemon->loop, 50, check_idle, daemon);
+}
+
+/* Only a daemon that is the server on every bus it watches exits when idle,
+ * since the bus starts it again for the next Notify. A monitor would just
+ * miss notifications. */
+static void schedule_idle_exit(struct Daemon *daemon) {
+	if (daemon->exiting) return;
+	if (daemon->idle_timeout != 0) loop_remove_timeout(daemon->loop, daemon->idle_timeout);
+	daemon->idle_timeout = 0;
+	if (daemon->config->idle_exit_ms == 0 || daemon->handlers->len == 0) return;
+	for (guint i = 0; i < daemon->handlers->len; ++i) {
+		struct HandlerState *state = g_ptr_array_index(daemon->handlers, i);
+		// Replays have no bus to be started by
+		if (!state->is_server || state->connection == NULL) return;
+	}
+	daemon->idle_timeout = loop_add_timeout(daemon->loop, 0, check_idle, daemon);
+}
+
+/* Forgets a bus that went away, and exits once no bus is left. */
+static DBusHandlerResult on_disconnected(DBusConnection *connection, DBusMessage *message, void *data) {
+	if (!dbus_message_is_signal(message, DBUS_INTERFACE_LOCAL, "Disconnected")) {
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+	struct HandlerState *state = data;
+	struct Daemon *daemon = state->daemon;
+	fprintf(stderr, "Lost a bus connection.\n");
+	loop_remove_connection(daemon->loop, connection);
+	// Decoded notifications still being completed refer to the state
+	pipeline_drain(daemon->pipeline);
+	if (state->is_server) {
+		dbus_connection_unregister_object_path(connection, "/org/freedesktop/Notifications");
+	} else {
+		dbus_connection_remove_filter(connection, handler, state);
+	}
+	dbus_connection_remove_filter(connection, on_disconnected, state);
+	g_ptr_array_remove(daemon->handlers, state);
+	g_hash_table_unref(state->live);
+	g_free(state);
+	dbus_connection_unref(connection);
+	if (daemon->handlers->len == 0) {
+		if (daemon->idle_timeout != 0) loop_remove_timeout(daemon->loop, daemon->idle_timeout);
+		daemon->idle_timeout = 0;
+		stop_hooks(daemon->config);
+		wait_for_hooks(daemon);
+	}
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void finish_replay(struct ReplayRun *run) {
+	struct HandlerState *state = run->state;
+	pipeline_drain(state->daemon->pipeline);
+	double elapsed = (g_get_monotonic_time() - run->start) / 1e6;
+	fprintf(
+		stderr,
+		"Replayed %lu messages in %.3f s, %.0f per second.\n",
+		run->count,
+		elapsed,
+		elapsed > 0 ? run->count / elapsed : 0
+	);
+	// Notifications left open would otherwise keep expiring into hooks that
+	// are stopped
+	g_hash_table_remove_all(state->live);
+	stop_hooks(state->daemon->config);
+	wait_for_hooks(state->daemon);
+}
+
+/* Feeds the capture to the handler as if it came from the bus, keeping the
+ * recorded spacing divided by the speed, or in batches with --max. */
+static void replay_step(void *data) {
+	struct ReplayRun *run = data;
+	for (int n = 0; run->next != NULL; ++n) {
+		if (run->max) {
+			if (n == REPLAY_BATCH) {
+				loop_add_timeout(run->state->daemon->loop, 0, replay_step, run);
+				return;
+			}
+		} else {
+			gint64 due = run->start + (gint64)((run->next_time - run->first_time) / run->speed);
+			gint64 now = g_get_monotonic_time();
+			if (due > now) {
+				loop_add_timeout(run->state->daemon->loop, (due - now + 999) / 1000, replay_step, run);
+				return;
+			}
+		}
+		handler(NULL, run->next, run->state);
+		dbus_message_unref(run->next);
+		++run->count;
+		run->next = replay_next(run->replay, &run->next_time);
+	}
+	finish_replay(run);
+}
+
+static dbus_bool_t start_replay(struct ReplayRun *run, struct HandlerState *state, const struct Options *options) {
+	run->state = state;
+	run->replay = replay_open(options->replay);
+	if (run->replay == NULL) return FALSE;
+	run->speed = options->speed;
+	run->max = options->max;
+	run->count = 0;
+	run->next_time = 0;
+	run->next = replay_next(run->replay, &run->next_time);
+	run->first_time = run->next_time;
+	run->start = g_get_monotonic_time();
+	// Replays act as the server, so ids, replacement and expiry are part of
+	// what is reproduced
+	state->is_server = TRUE;
+	loop_add_timeout(state->daemon->loop, 0, replay_step, run);
+	return TRUE;
+}
+
+static void flush_recorder(void *data) {
+	recorder_flush(data);
+}
+
 int main(int argc, char **argv) {
-	gtk_init(&argc, &argv);
+	struct Options command_options;
+	if (!take_options(&argc, argv, &command_options)) return 2;
+	gboolean headless = command_options.headless;
+#ifndef WITH_GTK
+	headless = TRUE;
+#endif
+	icons_init(!headless, &argc, &argv);
+	// Messages are decoded on worker threads
+	dbus_threads_init_default();
+	// Hooks that exit are noticed through their pipes instead
+	signal(SIGPIPE, SIG_IGN);
 	const gchar *options_file = g_build_filename(
 		g_get_user_config_dir(),
 		"i-spy-notify",
@@ -89,14 +506,69 @@ int main(int argc, char **argv) {
 		NULL
 	);
 	json_object *options = json_object_from_file(options_file);
-	struct HandlerState state;
+	struct Daemon daemon;
 	DBusObjectPathVTable server_vtable;
-	state.options = options;
-	state.last_notification_id = 0;
-	DBusConnection *conn = connect_to_session_bus();
-	if (!become_server(conn, &state, &server_vtable)) {
-		become_monitor(conn, &state);
+	daemon.config = config_compile(options);
+	daemon.recorder = NULL;
+	daemon.stats_timeout = 0;
+	daemon.handlers = g_ptr_array_new();
+	daemon.last_active = g_get_monotonic_time();
+	daemon.idle_timeout = 0;
+	daemon.exiting = FALSE;
+	struct Loop *loop = loop_new();
+	daemon.loop = loop;
+	daemon.timers = timer_wheel_new(loop);
+	daemon.hook_log = hook_log_new(loop);
+	hook_log_configure(daemon.hook_log, daemon.config);
+	daemon.executor = executor_new(loop, daemon.hook_log);
+	executor_set_limits(daemon.executor, daemon.config->max_running_hooks, daemon.config->queues);
+	daemon.cache = cache_new(daemon.config->cache_size);
+	daemon.pipeline = pipeline_new(
+		loop,
+		daemon.config->decode_threads,
+		decode_notification,
+		complete_notification
+	);
+	start_hooks(&daemon);
+	schedule_stats_file(&daemon);
+	watch_config(loop, options_file, apply_config, &daemon);
+	loop_add_signal(loop, SIGUSR1, print_stats, NULL);
+	loop_add_signal(loop, SIGUSR2, print_hook_output, &daemon);
+	if (command_options.record != NULL) {
+		daemon.recorder = recorder_open(command_options.record);
+		if (daemon.recorder == NULL) return 1;
+		loop_add_prepare(loop, flush_recorder, daemon.recorder);
+	}
+	if (command_options.replay != NULL) {
+		struct ReplayRun run;
+		if (!start_replay(&run, new_handler_state(&daemon), &command_options)) return 1;
+		loop_run(loop);
+		if (daemon.recorder != NULL) recorder_close(daemon.recorder);
+		return 0;
+	}
+	// Each bus gets a handler of its own, so that ids and open
+	// notifications stay apart, while hooks and decoding are shared
+	guint n_watched = 0;
+	for (guint i = 0; i < command_options.buses->len; ++i) {
+		const char *bus = g_ptr_array_index(command_options.buses, i);
+		DBusConnection *conn = connect_to_bus(bus);
+		if (conn == NULL) {
+			fprintf(stderr, "Cannot connect to %s.\n", bus);
+			continue;
+		}
+		// A bus that goes away is forgotten rather than ending the daemon,
+		// which keeps watching the others
+		dbus_connection_set_exit_on_disconnect(conn, FALSE);
+		struct HandlerState *state = new_handler_state(&daemon);
+		// Ahead of the handler, since a monitor's handles every message
+		dbus_connection_add_filter(conn, on_disconnected, state, NULL);
+		if (!become_server(conn, state, &server_vtable)) {
+			become_monitor(conn, state);
+		}
+		if (loop_add_connection(loop, conn)) ++n_watched;
 	}
-	while(dbus_connection_read_write_dispatch(conn, -1));
+	if (n_watched == 0) return 1;
+	schedule_idle_exit(&daemon);
+	loop_run(loop);
 	return 0;
 }
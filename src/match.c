@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <string.h>
+#include "match.h"
+
+enum PredicateKind {
+	PREDICATE_EQUALS,
+	PREDICATE_PREFIX,
+	PREDICATE_REGEX,
+	PREDICATE_RANGE,
+	PREDICATE_BOOLEAN,
+};
+
+struct Predicate {
+	enum PredicateKind kind;
+	/* Top-level field, or hint when hint is TRUE */
+	gchar *field;
+	dbus_bool_t hint;
+	/* Where the notification keeps field */
+	int slot;
+	gchar *string;
+	GRegex *regex;
+	gint64 min;
+	gint64 max;
+	dbus_bool_t value;
+};
+
+void predicate_free(struct Predicate *predicate) {
+	g_free(predicate->field);
+	g_free(predicate->string);
+	if (predicate->regex != NULL) g_regex_unref(predicate->regex);
+	g_free(predicate);
+}
+
+static dbus_bool_t predicate_equal(const struct Predicate *a, const struct Predicate *b) {
+	return (
+		a->kind == b->kind &&
+		a->hint == b->hint &&
+		!strcmp(a->field, b->field) &&
+		g_strcmp0(a->string, b->string) == 0 &&
+		a->min == b->min &&
+		a->max == b->max &&
+		a->value == b->value
+	);
+}
+
+static size_t intern_predicate(GPtrArray *predicates, struct Predicate *predicate) {
+	for (guint i = 0; i < predicates->len; ++i) {
+		if (predicate_equal(g_ptr_array_index(predicates, i), predicate)) {
+			predicate_free(predicate);
+			return i;
+		}
+	}
+	if (predicate->kind == PREDICATE_REGEX) {
+		GError *error = NULL;
+		predicate->regex = g_regex_new(predicate->string, G_REGEX_OPTIMIZE, 0, &error);
+		if (predicate->regex == NULL) {
+			fprintf(stderr, "Invalid regex %s: %s\n", predicate->string, error->message);
+			g_error_free(error);
+			predicate_free(predicate);
+			return (size_t)-1;
+		}
+	}
+	g_ptr_array_add(predicates, predicate);
+	return predicates->len - 1;
+}
+
+static struct Predicate *new_predicate(enum PredicateKind kind, const char *field, dbus_bool_t hint) {
+	struct Predicate *predicate = g_new0(struct Predicate, 1);
+	predicate->kind = kind;
+	predicate->field = g_strdup(field);
+	predicate->hint = hint;
+	predicate->slot = notification_find_field(field, hint);
+	return predicate;
+}
+
+static void print_invalid_test(const char *field, json_object *test) {
+	fprintf(stderr, "Invalid test for %s: %s\n", field, json_object_to_json_string(test));
+}
+
+/* Compiles one alternative for a string field: either a string to compare
+ * with, or an object with "equals", "prefix" or "regex". */
+static struct Predicate *compile_string_test(const char *field, dbus_bool_t hint, json_object *test) {
+	enum PredicateKind kind = PREDICATE_EQUALS;
+	json_object *value = test;
+	if (json_object_is_type(test, json_type_object)) {
+		if (json_object_object_get_ex(test, "equals", &value)) {
+			kind = PREDICATE_EQUALS;
+		} else if (json_object_object_get_ex(test, "prefix", &value)) {
+			kind = PREDICATE_PREFIX;
+		} else if (json_object_object_get_ex(test, "regex", &value)) {
+			kind = PREDICATE_REGEX;
+		} else {
+			value = NULL;
+		}
+	}
+	// Anything but a string, null included, would leave nothing to compare
+	if (!json_object_is_type(value, json_type_string)) {
+		print_invalid_test(field, test);
+		return NULL;
+	}
+	struct Predicate *predicate = new_predicate(kind, field, hint);
+	predicate->string = g_strdup(json_object_get_string(value));
+	return predicate;
+}
+
+/* Compiles one alternative for urgency: either a level, or an object with
+ * "min", "max" or both. */
+static struct Predicate *compile_urgency_test(json_object *test) {
+	gint64 min = G_MININT64;
+	gint64 max = G_MAXINT64;
+	json_object *value;
+	dbus_bool_t ok = TRUE;
+	if (json_object_is_type(test, json_type_int)) {
+		min = max = json_object_get_int64(test);
+	} else if (json_object_is_type(test, json_type_object)) {
+		dbus_bool_t bounded = FALSE;
+		if (json_object_object_get_ex(test, "min", &value)) {
+			ok = ok && json_object_is_type(value, json_type_int);
+			min = json_object_get_int64(value);
+			bounded = TRUE;
+		}
+		if (json_object_object_get_ex(test, "max", &value)) {
+			ok = ok && json_object_is_type(value, json_type_int);
+			max = json_object_get_int64(value);
+			bounded = TRUE;
+		}
+		ok = ok && bounded && min <= max;
+	} else {
+		ok = FALSE;
+	}
+	if (!ok) {
+		print_invalid_test("urgency", test);
+		return NULL;
+	}
+	struct Predicate *predicate = new_predicate(PREDICATE_RANGE, "urgency", TRUE);
+	predicate->min = min;
+	predicate->max = max;
+	return predicate;
+}
+
+static dbus_bool_t add_clause(GArray *clauses, GArray *alternatives) {
+	struct MatchClause clause;
+	clause.n_predicates = alternatives->len;
+	clause.predicates = (size_t *)(void *)g_array_free(alternatives, FALSE);
+	g_array_append_val(clauses, clause);
+	return TRUE;
+}
+
+/* A test, or an array of tests of which any may pass. */
+static dbus_bool_t compile_field(
+	const char *field,
+	json_object *tests,
+	GPtrArray *predicates,
+	GArray *clauses
+) {
+	size_t length = json_object_is_type(tests, json_type_array) ? json_object_array_length(tests) : 1;
+	// No alternatives would make a clause that never passes
+	if (length == 0) {
+		fprintf(stderr, "No tests for %s.\n", field);
+		return FALSE;
+	}
+	GArray *alternatives = g_array_new(FALSE, FALSE, sizeof(size_t));
+	for (size_t i = 0; i < length; ++i) {
+		json_object *test = json_object_is_type(tests, json_type_array)
+			? json_object_array_get_idx(tests, i)
+			: tests;
+		struct Predicate *predicate;
+		if (!strcmp(field, "urgency")) {
+			predicate = compile_urgency_test(test);
+		} else if (!strcmp(field, "category")) {
+			predicate = compile_string_test(field, TRUE, test);
+		} else {
+			predicate = compile_string_test(field, FALSE, test);
+		}
+		size_t index = predicate != NULL ? intern_predicate(predicates, predicate) : (size_t)-1;
+		if (index == (size_t)-1) {
+			g_array_free(alternatives, TRUE);
+			return FALSE;
+		}
+		g_array_append_val(alternatives, index);
+	}
+	return add_clause(clauses, alternatives);
+}
+
+static dbus_bool_t compile_hints(json_object *hints, GPtrArray *predicates, GArray *clauses) {
+	if (!json_object_is_type(hints, json_type_object)) {
+		fprintf(stderr, "Invalid hints: %s\n", json_object_to_json_string(hints));
+		return FALSE;
+	}
+	json_object_object_foreach(hints, key, value) {
+		if (!json_object_is_type(value, json_type_boolean)) {
+			fprintf(stderr, "Only boolean hints can be matched: %s\n", key);
+			return FALSE;
+		}
+		struct Predicate *predicate = new_predicate(PREDICATE_BOOLEAN, key, TRUE);
+		predicate->value = json_object_get_boolean(value);
+		size_t index = intern_predicate(predicates, predicate);
+		GArray *alternatives = g_array_new(FALSE, FALSE, sizeof(size_t));
+		g_array_append_val(alternatives, index);
+		add_clause(clauses, alternatives);
+	}
+	return TRUE;
+}
+
+dbus_bool_t match_compile(json_object *spec, GPtrArray *predicates, struct Match *match) {
+	GArray *clauses = g_array_new(FALSE, FALSE, sizeof(struct MatchClause));
+	dbus_bool_t ok = TRUE;
+	match->clauses = NULL;
+	match->n_clauses = 0;
+	if (spec != NULL && !json_object_is_type(spec, json_type_object)) {
+		fprintf(stderr, "Invalid match: %s\n", json_object_to_json_string(spec));
+		ok = FALSE;
+	} else if (spec != NULL) {
+		json_object_object_foreach(spec, key, value) {
+			if (!strcmp(key, "hints")) {
+				ok = compile_hints(value, predicates, clauses);
+			} else if (
+				!strcmp(key, "app_name") ||
+				!strcmp(key, "summary") ||
+				!strcmp(key, "body") ||
+				!strcmp(key, "category") ||
+				!strcmp(key, "urgency")
+			) {
+				ok = compile_field(key, value, predicates, clauses);
+			} else {
+				fprintf(stderr, "Cannot match on %s.\n", key);
+				ok = FALSE;
+			}
+			if (!ok) break;
+		}
+	}
+	match->n_clauses = clauses->len;
+	match->clauses = (struct MatchClause *)(void *)g_array_free(clauses, FALSE);
+	if (!ok) match_clear(match);
+	return ok;
+}
+
+void match_clear(struct Match *match) {
+	for (size_t i = 0; i < match->n_clauses; ++i) {
+		g_free(match->clauses[i].predicates);
+	}
+	g_free(match->clauses);
+	match->clauses = NULL;
+	match->n_clauses = 0;
+}
+
+static dbus_bool_t evaluate(const struct Predicate *predicate, const struct Notification *notification) {
+	struct Value value = predicate->slot == SLOT_OTHER_HINT
+		? notification_get_other_hint(notification, predicate->field)
+		: notification_get(notification, predicate->slot);
+	dbus_bool_t is_string = value.type == VALUE_STRING;
+
+	switch (predicate->kind) {
+	case PREDICATE_EQUALS:
+		return is_string && !strcmp(value.string, predicate->string);
+	case PREDICATE_PREFIX:
+		return is_string && g_str_has_prefix(value.string, predicate->string);
+	case PREDICATE_REGEX:
+		return is_string && g_regex_match(predicate->regex, value.string, 0, NULL);
+	case PREDICATE_RANGE: {
+		// Notifications without an urgency are normal
+		gint64 number = value.type == VALUE_INT ? value.number : 1;
+		return number >= predicate->min && number <= predicate->max;
+	}
+	case PREDICATE_BOOLEAN:
+		// Hints that were not sent are false
+		return (value.type == VALUE_BOOLEAN && value.boolean) == !!predicate->value;
+	}
+	return FALSE;
+}
+
+dbus_bool_t match_evaluate(
+	const struct Match *match,
+	struct Predicate *const *predicates,
+	const struct Notification *notification,
+	signed char *results
+) {
+	for (size_t i = 0; i < match->n_clauses; ++i) {
+		const struct MatchClause *clause = &match->clauses[i];
+		dbus_bool_t passed = FALSE;
+		for (size_t j = 0; j < clause->n_predicates && !passed; ++j) {
+			size_t index = clause->predicates[j];
+			if (results[index] < 0) {
+				results[index] = evaluate(predicates[index], notification);
+			}
+			passed = results[index];
+		}
+		if (!passed) return FALSE;
+	}
+	return TRUE;
+}
@@ -0,0 +1,39 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+#include <dbus/dbus.h>
+#include <glib.h>
+#include <json-c/json.h>
+#include "notification.h"
+
+/* A single test on a notification field, such as a prefix of summary. Equal
+ * tests are compiled once and shared by every hook that uses them. */
+struct Predicate;
+
+/* Passes when any of its predicates does. */
+struct MatchClause {
+	size_t *predicates;
+	size_t n_predicates;
+};
+
+/* A hook's "match" object: passes when every clause does. */
+struct Match {
+	struct MatchClause *clauses;
+	size_t n_clauses;
+};
+
+/* Compiles spec into match, adding new predicates to the shared table. */
+dbus_bool_t match_compile(json_object *spec, GPtrArray *predicates, struct Match *match);
+void match_clear(struct Match *match);
+void predicate_free(struct Predicate *predicate);
+/* results caches each predicate's outcome for one notification; it starts
+ * filled with -1 and is shared between the hooks. */
+dbus_bool_t match_evaluate(
+	const struct Match *match,
+	struct Predicate *const *predicates,
+	const struct Notification *notification,
+	signed char *results
+);
+
+#endif
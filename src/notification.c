@@ -0,0 +1,220 @@
+#include <string.h>
+#include "notification.h"
+#include "config.h"
+#include "hints.h"
+
+/* Most notifications fit in the first block with room to spare */
+#define ARENA_BLOCK_SIZE 2048
+
+static const char *const FIELD_NAMES[] = {
+	[SLOT_ID] = "id",
+	[SLOT_APP_NAME] = "app_name",
+	[SLOT_REPLACES_ID] = "replaces_id",
+	[SLOT_APP_ICON] = "app_icon",
+	[SLOT_SUMMARY] = "summary",
+	[SLOT_BODY] = "body",
+	[SLOT_EXPIRE_TIMEOUT] = "expire_timeout",
+	[SLOT_EVENT] = "event",
+	[SLOT_REASON] = "reason",
+};
+
+struct Notification *notification_new(DBusMessage *message) {
+	struct Arena *arena = arena_new(ARENA_BLOCK_SIZE);
+	struct Notification *notification = arena_alloc(arena, sizeof(struct Notification));
+	memset(notification, 0, sizeof(struct Notification));
+	notification->refs = 1;
+	notification->arena = arena;
+	notification->message = dbus_message_ref(message);
+	return notification;
+}
+
+struct Notification *notification_ref(struct Notification *notification) {
+	g_atomic_int_inc(&notification->refs);
+	return notification;
+}
+
+void notification_unref(struct Notification *notification) {
+	if (notification == NULL || !g_atomic_int_dec_and_test(&notification->refs)) return;
+	if (notification->json != NULL) json_object_put(notification->json);
+	if (notification->source != NULL) {
+		notification_unref(notification->source);
+	} else {
+		for (struct OtherHint *hint = notification->other_hints; hint != NULL; hint = hint->next) {
+			if (hint->value.type == VALUE_JSON) json_object_put(hint->value.json);
+		}
+	}
+	image_file_unref(notification->image_file);
+	dbus_message_unref(notification->message);
+	arena_free(notification->arena);
+}
+
+struct Notification *notification_derive(struct Notification *notification) {
+	struct Notification *copy = notification_new(notification->message);
+	memcpy(copy->slots, notification->slots, sizeof(copy->slots));
+	memcpy(copy->ranks, notification->ranks, sizeof(copy->ranks));
+	copy->other_hints = notification->other_hints;
+	copy->actions = notification->actions;
+	copy->n_actions = notification->n_actions;
+	copy->has_image_data = notification->has_image_data;
+	if (notification->image_file != NULL) copy->image_file = image_file_ref(notification->image_file);
+	copy->source = notification_ref(notification);
+	return copy;
+}
+
+void notification_set_string(struct Notification *notification, int slot, const char *string) {
+	notification->slots[slot].type = VALUE_STRING;
+	notification->slots[slot].string = string;
+}
+
+void notification_set_int(struct Notification *notification, int slot, gint64 number) {
+	notification->slots[slot].type = VALUE_INT;
+	notification->slots[slot].number = number;
+}
+
+void notification_set_boolean(struct Notification *notification, int slot, dbus_bool_t boolean) {
+	notification->slots[slot].type = VALUE_BOOLEAN;
+	notification->slots[slot].boolean = boolean;
+}
+
+void notification_add_other_hint(struct Notification *notification, const char *name, struct Value value) {
+	struct OtherHint *hint = arena_alloc(notification->arena, sizeof(struct OtherHint));
+	hint->name = name;
+	hint->value = value;
+	hint->next = notification->other_hints;
+	notification->other_hints = hint;
+}
+
+struct Value notification_get(const struct Notification *notification, int slot) {
+	if (slot < 0) {
+		struct Value none = { VALUE_NONE };
+		return none;
+	}
+	return notification->slots[slot];
+}
+
+struct Value notification_get_other_hint(const struct Notification *notification, const char *name) {
+	for (struct OtherHint *hint = notification->other_hints; hint != NULL; hint = hint->next) {
+		if (!strcmp(hint->name, name)) return hint->value;
+	}
+	struct Value none = { VALUE_NONE };
+	return none;
+}
+
+const char *notification_render(struct Notification *notification, struct Value value) {
+	switch (value.type) {
+	case VALUE_NONE:
+		return "null";
+	case VALUE_STRING:
+		return value.string;
+	case VALUE_INT:
+		return arena_printf(notification->arena, "%" G_GINT64_FORMAT, value.number);
+	case VALUE_BOOLEAN:
+		return value.boolean ? "true" : "false";
+	case VALUE_DOUBLE: {
+		gchar *s = arena_alloc(notification->arena, G_ASCII_DTOSTR_BUF_SIZE);
+		return g_ascii_dtostr(s, G_ASCII_DTOSTR_BUF_SIZE, value.real);
+	}
+	case VALUE_JSON:
+		return json_object_to_json_string(value.json);
+	}
+	return "null";
+}
+
+static json_object *value_to_json(struct Value value) {
+	switch (value.type) {
+	case VALUE_NONE:
+		return NULL;
+	case VALUE_STRING:
+		return json_object_new_string(value.string);
+	case VALUE_INT:
+		return json_object_new_int64(value.number);
+	case VALUE_BOOLEAN:
+		return json_object_new_boolean(value.boolean);
+	case VALUE_DOUBLE:
+		return json_object_new_double(value.real);
+	case VALUE_JSON:
+		return json_object_get(value.json);
+	}
+	return NULL;
+}
+
+static void add_slot(json_object *object, const char *key, const struct Notification *notification, int slot) {
+	if (notification->slots[slot].type == VALUE_NONE) return;
+	json_object_object_add(object, key, value_to_json(notification->slots[slot]));
+}
+
+json_object *notification_get_json(struct Notification *notification) {
+	if (notification->json != NULL) return notification->json;
+
+	json_object *data = json_object_new_object();
+	json_object *actions = json_object_new_array_ext(notification->n_actions);
+	json_object *hints = json_object_new_object();
+	json_object *image = json_object_new_object();
+	for (size_t i = 0; i < notification->n_actions; ++i) {
+		json_object_array_add(actions, json_object_new_string(notification->actions[i]));
+	}
+	for (int slot = SLOT_FIRST_HINT; slot < N_SLOTS; ++slot) {
+		add_slot(hints, hints_get_name(slot), notification, slot);
+	}
+	for (struct OtherHint *hint = notification->other_hints; hint != NULL; hint = hint->next) {
+		json_object_object_add(hints, hint->name, value_to_json(hint->value));
+	}
+	if (notification->has_image_data) {
+		json_object *image_data = json_object_new_object();
+		add_slot(image_data, "png", notification, SLOT_IMAGE_DATA_PNG);
+		add_slot(image_data, "path", notification, SLOT_IMAGE_DATA_PATH);
+		json_object_object_add(hints, "image-data", image_data);
+	}
+	add_slot(image, "base64", notification, SLOT_IMAGE_BASE64);
+	add_slot(image, "path", notification, SLOT_IMAGE_PATH);
+
+	add_slot(data, "app_name", notification, SLOT_APP_NAME);
+	add_slot(data, "replaces_id", notification, SLOT_REPLACES_ID);
+	add_slot(data, "app_icon", notification, SLOT_APP_ICON);
+	add_slot(data, "summary", notification, SLOT_SUMMARY);
+	add_slot(data, "body", notification, SLOT_BODY);
+	json_object_object_add(data, "actions", actions);
+	json_object_object_add(data, "hints", hints);
+	add_slot(data, "expire_timeout", notification, SLOT_EXPIRE_TIMEOUT);
+	add_slot(data, "event", notification, SLOT_EVENT);
+	add_slot(data, "reason", notification, SLOT_REASON);
+	json_object_object_add(data, "image", image);
+	add_slot(data, "id", notification, SLOT_ID);
+
+	notification->json = data;
+	return data;
+}
+
+int notification_find_field(const char *name, dbus_bool_t hint) {
+	if (hint) {
+		const struct HintInfo *info = hints_find(name);
+		if (info == NULL) return SLOT_OTHER_HINT;
+		// The image-data slots are not values of the hint itself
+		return info->decoder != HINT_IMAGE ? (int)info->slot : -1;
+	}
+	for (size_t i = 0; i < G_N_ELEMENTS(FIELD_NAMES); ++i) {
+		if (!strcmp(FIELD_NAMES[i], name)) return i;
+	}
+	return -1;
+}
+
+int notification_find_slot(const struct FieldPath *path) {
+	const char *keys[3] = { NULL, NULL, NULL };
+	if (path->length == 0 || path->length > G_N_ELEMENTS(keys)) return -1;
+	for (size_t i = 0; i < path->length; ++i) {
+		keys[i] = path->keys[i].name;
+		if (keys[i] == NULL) return -1;
+	}
+
+	if (path->length == 1) return notification_find_field(keys[0], FALSE);
+	if (path->length == 2 && !strcmp(keys[0], "hints")) return notification_find_field(keys[1], TRUE);
+	if (path->length == 2 && !strcmp(keys[0], "image")) {
+		if (!strcmp(keys[1], "base64")) return SLOT_IMAGE_BASE64;
+		if (!strcmp(keys[1], "path")) return SLOT_IMAGE_PATH;
+	}
+	if (path->length == 3 && !strcmp(keys[0], "hints") && !strcmp(keys[1], "image-data")) {
+		if (!strcmp(keys[2], "png")) return SLOT_IMAGE_DATA_PNG;
+		if (!strcmp(keys[2], "path")) return SLOT_IMAGE_DATA_PATH;
+	}
+	return -1;
+}
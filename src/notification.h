@@ -0,0 +1,134 @@
+#ifndef NOTIFICATION_H
+#define NOTIFICATION_H
+
+#include <stddef.h>
+#include <dbus/dbus.h>
+#include <glib.h>
+#include <json-c/json.h>
+#include "arena.h"
+#include "image.h"
+
+struct FieldPath;
+
+enum ValueType {
+	VALUE_NONE,
+	VALUE_STRING,
+	VALUE_INT,
+	VALUE_BOOLEAN,
+	VALUE_DOUBLE,
+	/* Containers in hints the daemon does not know */
+	VALUE_JSON,
+};
+
+struct Value {
+	enum ValueType type;
+	union {
+		const char *string;
+		gint64 number;
+		dbus_bool_t boolean;
+		double real;
+		json_object *json;
+	};
+};
+
+/* Every field a hook can reach without the JSON view. Hints follow the
+ * top-level fields, starting at SLOT_FIRST_HINT. */
+enum NotificationSlot {
+	SLOT_ID,
+	SLOT_APP_NAME,
+	SLOT_REPLACES_ID,
+	SLOT_APP_ICON,
+	SLOT_SUMMARY,
+	SLOT_BODY,
+	SLOT_EXPIRE_TIMEOUT,
+	/* What the hook is run for: "notify", "expired" or "closed" */
+	SLOT_EVENT,
+	/* The NotificationClosed reason of expired and closed events */
+	SLOT_REASON,
+	SLOT_IMAGE_BASE64,
+	SLOT_IMAGE_PATH,
+	SLOT_IMAGE_DATA_PNG,
+	SLOT_IMAGE_DATA_PATH,
+	SLOT_ACTION_ICONS,
+	SLOT_CATEGORY,
+	SLOT_DESKTOP_ENTRY,
+	SLOT_IMAGE_PATH_HINT,
+	SLOT_RESIDENT,
+	SLOT_SENDER_PID,
+	SLOT_SOUND_FILE,
+	SLOT_SOUND_NAME,
+	SLOT_SUPPRESS_SOUND,
+	SLOT_TRANSIENT,
+	SLOT_URGENCY,
+	SLOT_X,
+	SLOT_Y,
+	N_SLOTS,
+};
+
+#define SLOT_FIRST_HINT SLOT_ACTION_ICONS
+/* Stands for a hint that has no slot, which is looked up by name */
+#define SLOT_OTHER_HINT (-2)
+
+/* A hint without a slot, such as a vendor hint */
+struct OtherHint {
+	const char *name;
+	struct Value value;
+	struct OtherHint *next;
+};
+
+/* A decoded Notify call. Strings point into the message, which is kept alive,
+ * or into the arena; both are freed with the last reference. */
+struct Notification {
+	gint refs;
+	struct Arena *arena;
+	DBusMessage *message;
+	struct Value slots[N_SLOTS];
+	/* Precedence of the hint a slot was set from, where several names
+	 * compete for it */
+	unsigned char ranks[N_SLOTS];
+	struct OtherHint *other_hints;
+	const char **actions;
+	size_t n_actions;
+	/* Set when image-data was sent and some hook can see it */
+	dbus_bool_t has_image_data;
+	/* The generated image that a path in the notification refers to */
+	struct ImageFile *image_file;
+	/* Set when app_icon is left to be looked up through GTK on the loop's
+	 * thread */
+	dbus_bool_t icon_pending;
+	/* Built on first use */
+	json_object *json;
+	/* The notification this one was derived from, which owns the strings and
+	 * hints they share */
+	struct Notification *source;
+};
+
+struct Notification *notification_new(DBusMessage *message);
+struct Notification *notification_ref(struct Notification *notification);
+void notification_unref(struct Notification *notification);
+/* A copy of notification that can be given other top-level fields, such as
+ * the event it is delivered for. It shares everything else. */
+struct Notification *notification_derive(struct Notification *notification);
+
+void notification_set_string(struct Notification *notification, int slot, const char *string);
+void notification_set_int(struct Notification *notification, int slot, gint64 number);
+void notification_set_boolean(struct Notification *notification, int slot, dbus_bool_t boolean);
+/* Keeps value, whose JSON is owned by the notification from now on. */
+void notification_add_other_hint(struct Notification *notification, const char *name, struct Value value);
+/* Returns an empty value for slot -1, which stands for unknown fields. */
+struct Value notification_get(const struct Notification *notification, int slot);
+struct Value notification_get_other_hint(const struct Notification *notification, const char *name);
+/* Renders a value the way the JSON view would print it, with strings
+ * unquoted. */
+const char *notification_render(struct Notification *notification, struct Value value);
+/* The notification as a JSON object. It is owned by the notification. */
+json_object *notification_get_json(struct Notification *notification);
+
+/* Returns the slot of a top-level field, or of a hint when hint is TRUE, or
+ * -1 if there is none. */
+int notification_find_field(const char *name, dbus_bool_t hint);
+/* Returns the slot path leads to, SLOT_OTHER_HINT for other hints, or -1 if
+ * it needs the JSON view. */
+int notification_find_slot(const struct FieldPath *path);
+
+#endif
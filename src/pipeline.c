@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <glib.h>
+#include "pipeline.h"
+#include "stats.h"
+
+struct Job {
+	DBusMessage *message;
+	dbus_uint32_t id;
+	void *data;
+	struct Notification *notification;
+	/* Set by the worker under the pipeline's lock */
+	gboolean done;
+	gint64 pushed;
+	gint64 decoded;
+};
+
+struct Pipeline {
+	struct Loop *loop;
+	GThreadPool *pool;
+	PipelineDecodeFunction decode;
+	PipelineCompleteFunction complete;
+	/* Jobs in the order they were pushed, only touched by the loop */
+	GQueue jobs;
+	GMutex lock;
+	GCond finished;
+	int wake_fd;
+};
+
+static void decode_job(gpointer data, gpointer user_data) {
+	struct Job *job = data;
+	struct Pipeline *pipeline = user_data;
+	gint64 start = stats_record(STAGE_QUEUE, job->pushed);
+	job->notification = pipeline->decode(job->message, job->id, job->data);
+	job->decoded = stats_record(STAGE_DECODE, start);
+	dbus_message_unref(job->message);
+	job->message = NULL;
+
+	g_mutex_lock(&pipeline->lock);
+	job->done = TRUE;
+	g_cond_broadcast(&pipeline->finished);
+	g_mutex_unlock(&pipeline->lock);
+	eventfd_write(pipeline->wake_fd, 1);
+}
+
+/* Completes the jobs at the front of the queue that are decoded. A job that is
+ * slow to decode holds back the ones behind it, which keeps hooks in arrival
+ * order. */
+static void complete_jobs(struct Pipeline *pipeline) {
+	for (;;) {
+		struct Job *job = g_queue_peek_head(&pipeline->jobs);
+		if (job == NULL) return;
+		g_mutex_lock(&pipeline->lock);
+		gboolean done = job->done;
+		g_mutex_unlock(&pipeline->lock);
+		if (!done) return;
+		g_queue_pop_head(&pipeline->jobs);
+		stats_set(GAUGE_DECODING, pipeline->jobs.length);
+		stats_record(STAGE_ORDER, job->decoded);
+		pipeline->complete(job->notification, job->id, job->data);
+		notification_unref(job->notification);
+		g_free(job);
+	}
+}
+
+static void on_wake(int fd, short revents, void *data) {
+	eventfd_t count;
+	eventfd_read(fd, &count);
+	complete_jobs(data);
+}
+
+/* Workers leave every signal to the loop's signalfd. Threads inherit the mask
+ * of the one that creates them, so they are created with all of them
+ * blocked. */
+static void set_max_threads(struct Pipeline *pipeline, size_t n_threads) {
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if (pipeline->pool == NULL) {
+		pipeline->pool = g_thread_pool_new(decode_job, pipeline, n_threads, TRUE, NULL);
+	} else {
+		g_thread_pool_set_max_threads(pipeline->pool, n_threads, NULL);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+struct Pipeline *pipeline_new(
+	struct Loop *loop,
+	size_t n_threads,
+	PipelineDecodeFunction decode,
+	PipelineCompleteFunction complete
+) {
+	struct Pipeline *pipeline = g_new0(struct Pipeline, 1);
+	pipeline->loop = loop;
+	pipeline->decode = decode;
+	pipeline->complete = complete;
+	g_queue_init(&pipeline->jobs);
+	g_mutex_init(&pipeline->lock);
+	g_cond_init(&pipeline->finished);
+	pipeline->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pipeline->wake_fd < 0) perror("eventfd");
+	loop_add_fd(loop, pipeline->wake_fd, POLLIN, on_wake, pipeline);
+	set_max_threads(pipeline, n_threads > 0 ? n_threads : 1);
+	return pipeline;
+}
+
+void pipeline_set_threads(struct Pipeline *pipeline, size_t n_threads) {
+	set_max_threads(pipeline, n_threads > 0 ? n_threads : 1);
+}
+
+void pipeline_push(struct Pipeline *pipeline, DBusMessage *message, dbus_uint32_t id, void *data) {
+	struct Job *job = g_new0(struct Job, 1);
+	job->message = dbus_message_ref(message);
+	job->id = id;
+	job->data = data;
+	job->pushed = g_get_monotonic_time();
+	g_queue_push_tail(&pipeline->jobs, job);
+	stats_set(GAUGE_DECODING, pipeline->jobs.length);
+	g_thread_pool_push(pipeline->pool, job, NULL);
+}
+
+void pipeline_drain(struct Pipeline *pipeline) {
+	if (g_queue_is_empty(&pipeline->jobs)) return;
+	// Workers take jobs in order, but may finish them out of it
+	g_mutex_lock(&pipeline->lock);
+	for (GList *link = pipeline->jobs.head; link != NULL; link = link->next) {
+		struct Job *job = link->data;
+		while (!job->done) g_cond_wait(&pipeline->finished, &pipeline->lock);
+	}
+	g_mutex_unlock(&pipeline->lock);
+	complete_jobs(pipeline);
+}
+
+size_t pipeline_pending(struct Pipeline *pipeline) {
+	return pipeline->jobs.length;
+}
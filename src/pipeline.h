@@ -0,0 +1,36 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include <dbus/dbus.h>
+#include "loop.h"
+#include "notification.h"
+
+/* Runs on a worker thread. It may return NULL for messages it cannot decode. */
+typedef struct Notification *(*PipelineDecodeFunction)(DBusMessage *message, dbus_uint32_t id, void *data);
+/* Runs on the loop's thread, in the order the messages were pushed, with the
+ * id and data they were pushed with. The notification is borrowed, and NULL if
+ * it could not be decoded. */
+typedef void (*PipelineCompleteFunction)(struct Notification *notification, dbus_uint32_t id, void *data);
+
+/* Decodes Notify calls on a pool of worker threads, so that the thread
+ * reading the bus only has to reply to them. */
+struct Pipeline;
+
+struct Pipeline *pipeline_new(
+	struct Loop *loop,
+	size_t n_threads,
+	PipelineDecodeFunction decode,
+	PipelineCompleteFunction complete
+);
+void pipeline_set_threads(struct Pipeline *pipeline, size_t n_threads);
+/* Keeps a reference to message until it is decoded. Messages from every
+ * connection share the pipeline, each passing its own data to the
+ * functions. */
+void pipeline_push(struct Pipeline *pipeline, DBusMessage *message, dbus_uint32_t id, void *data);
+/* Waits for every pushed message to be decoded and completes them, so that
+ * whatever decode reads can be changed afterwards. */
+void pipeline_drain(struct Pipeline *pipeline);
+size_t pipeline_pending(struct Pipeline *pipeline);
+
+#endif
@@ -0,0 +1,258 @@
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include "config.h"
+#include "i-spy-notify-plugin.h"
+#include "plugin.h"
+#include "stats.h"
+
+/* Notifications a plugin may fall behind by before more are dropped */
+#define MAX_QUEUED 4096
+
+struct Plugin {
+	gint refs;
+	gchar *path;
+	void *handle;
+	const struct ISpyNotifyPlugin *functions;
+};
+
+/* What a plugin is given for a notification. */
+struct ISpyNotifyNotification {
+	struct Notification *notification;
+	/* Container hints, rendered on the loop's thread since it is the only
+	 * one that may touch their JSON */
+	json_object **json_values;
+	gchar **json_texts;
+	size_t n_json;
+};
+
+struct PluginHook {
+	struct Plugin *plugin;
+	gchar **argv;
+	GAsyncQueue *queue;
+	gint64 budget_us;
+	/* When the plugin's thread entered the call in progress, or 0 */
+	gint64 call_started;
+	/* Only touched by the loop */
+	size_t dropped;
+};
+
+static gint running;
+
+static struct ISpyNotifyValue get_field(
+	const struct ISpyNotifyNotification *view,
+	const char *const *path,
+	size_t length
+) {
+	struct ISpyNotifyValue out = { ISPY_NOTIFY_VALUE_NONE };
+	struct PathKey keys[3];
+	if (length == 0 || length > G_N_ELEMENTS(keys)) return out;
+	for (size_t i = 0; i < length; ++i) {
+		keys[i].name = path[i];
+		keys[i].index = 0;
+	}
+	struct FieldPath field = { keys, length, -1 };
+	int slot = notification_find_slot(&field);
+	struct Value value;
+	if (slot >= 0) {
+		value = notification_get(view->notification, slot);
+	} else if (slot == SLOT_OTHER_HINT) {
+		value = notification_get_other_hint(view->notification, path[1]);
+	} else {
+		return out;
+	}
+	switch (value.type) {
+	case VALUE_NONE:
+		break;
+	case VALUE_STRING:
+		out.type = ISPY_NOTIFY_VALUE_STRING;
+		out.string = value.string;
+		break;
+	case VALUE_INT:
+		out.type = ISPY_NOTIFY_VALUE_INT;
+		out.number = value.number;
+		break;
+	case VALUE_BOOLEAN:
+		out.type = ISPY_NOTIFY_VALUE_BOOLEAN;
+		out.boolean = value.boolean;
+		break;
+	case VALUE_DOUBLE:
+		out.type = ISPY_NOTIFY_VALUE_DOUBLE;
+		out.real = value.real;
+		break;
+	case VALUE_JSON:
+		for (size_t i = 0; i < view->n_json; ++i) {
+			if (view->json_values[i] == value.json) {
+				out.type = ISPY_NOTIFY_VALUE_JSON;
+				out.string = view->json_texts[i];
+			}
+		}
+		break;
+	}
+	return out;
+}
+
+static size_t get_n_actions(const struct ISpyNotifyNotification *view) {
+	return view->notification->n_actions;
+}
+
+static const char *get_action(const struct ISpyNotifyNotification *view, size_t i) {
+	return i < view->notification->n_actions ? view->notification->actions[i] : NULL;
+}
+
+static const struct ISpyNotifyHost HOST = {
+	ISPY_NOTIFY_PLUGIN_VERSION,
+	get_field,
+	get_n_actions,
+	get_action,
+};
+
+struct Plugin *plugin_load(const char *path) {
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		return NULL;
+	}
+	ISpyNotifyPluginEntry entry = (ISpyNotifyPluginEntry)dlsym(handle, ISPY_NOTIFY_PLUGIN_ENTRY);
+	const struct ISpyNotifyPlugin *functions = entry != NULL ? entry(&HOST) : NULL;
+	if (
+		functions == NULL ||
+		functions->version != ISPY_NOTIFY_PLUGIN_VERSION ||
+		functions->notify == NULL
+	) {
+		fprintf(stderr, "%s is not a version %d plugin.\n", path, ISPY_NOTIFY_PLUGIN_VERSION);
+		dlclose(handle);
+		return NULL;
+	}
+	struct Plugin *plugin = g_new0(struct Plugin, 1);
+	plugin->refs = 1;
+	plugin->path = g_strdup(path);
+	plugin->handle = handle;
+	plugin->functions = functions;
+	return plugin;
+}
+
+void plugin_unref(struct Plugin *plugin) {
+	if (plugin == NULL || !g_atomic_int_dec_and_test(&plugin->refs)) return;
+	dlclose(plugin->handle);
+	g_free(plugin->path);
+	g_free(plugin);
+}
+
+static void free_view(struct ISpyNotifyNotification *view) {
+	for (size_t i = 0; i < view->n_json; ++i) g_free(view->json_texts[i]);
+	g_free(view->json_values);
+	g_free(view->json_texts);
+	notification_unref(view->notification);
+	g_free(view);
+}
+
+/* The plugin's thread. The hook is pushed onto its own queue to stop it, and
+ * from then on belongs to the thread. */
+static gpointer run_plugin(gpointer data) {
+	struct PluginHook *hook = data;
+	const struct ISpyNotifyPlugin *functions = hook->plugin->functions;
+	void *state = NULL;
+	size_t overruns = 0;
+	gboolean started = (
+		functions->start == NULL ||
+		functions->start((const char *const *)hook->argv, &state) == 0
+	);
+	if (!started) fprintf(stderr, "Plugin %s did not start.\n", hook->plugin->path);
+	gpointer item;
+	while ((item = g_async_queue_pop(hook->queue)) != hook) {
+		struct ISpyNotifyNotification *view = item;
+		if (started) {
+			gint64 start = g_get_monotonic_time();
+			__atomic_store_n(&hook->call_started, start, __ATOMIC_RELAXED);
+			functions->notify(state, view);
+			__atomic_store_n(&hook->call_started, 0, __ATOMIC_RELAXED);
+			if (stats_record(STAGE_PLUGIN, start) - start > hook->budget_us) {
+				stats_count(COUNTER_PLUGIN_OVERRUNS);
+				if (overruns++ % 100 == 0) {
+					fprintf(
+						stderr,
+						"Plugin %s has gone over its budget %zu times.\n",
+						hook->plugin->path,
+						overruns
+					);
+				}
+			}
+		}
+		free_view(view);
+	}
+	if (started && functions->stop != NULL) functions->stop(state);
+	g_async_queue_unref(hook->queue);
+	g_strfreev(hook->argv);
+	plugin_unref(hook->plugin);
+	g_free(hook);
+	g_atomic_int_add(&running, -1);
+	return NULL;
+}
+
+struct PluginHook *plugin_hook_new(struct Plugin *plugin, const char *const *argv, guint budget_ms) {
+	struct PluginHook *hook = g_new0(struct PluginHook, 1);
+	g_atomic_int_inc(&plugin->refs);
+	hook->plugin = plugin;
+	hook->argv = g_strdupv((gchar **)argv);
+	hook->queue = g_async_queue_new();
+	hook->budget_us = (gint64)budget_ms * 1000;
+	g_atomic_int_inc(&running);
+	// Signals are left to the loop's signalfd, and threads inherit the
+	// mask of the one that creates them
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	g_thread_unref(g_thread_new("plugin", run_plugin, hook));
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return hook;
+}
+
+void plugin_hook_send(struct PluginHook *hook, struct Notification *notification) {
+	gint64 call_started = __atomic_load_n(&hook->call_started, __ATOMIC_RELAXED);
+	gboolean stuck = call_started != 0 && g_get_monotonic_time() - call_started > hook->budget_us;
+	if (stuck || g_async_queue_length(hook->queue) >= MAX_QUEUED) {
+		stats_count(COUNTER_DROPPED);
+		if (hook->dropped++ % 100 == 0) {
+			fprintf(
+				stderr,
+				"Plugin %s is %s, %zu notifications dropped.\n",
+				hook->plugin->path,
+				stuck ? "over its budget" : "not keeping up",
+				hook->dropped
+			);
+		}
+		return;
+	}
+
+	struct ISpyNotifyNotification *view = g_new0(struct ISpyNotifyNotification, 1);
+	view->notification = notification_ref(notification);
+	for (struct OtherHint *hint = notification->other_hints; hint != NULL; hint = hint->next) {
+		if (hint->value.type == VALUE_JSON) ++view->n_json;
+	}
+	if (view->n_json > 0) {
+		size_t i = 0;
+		view->json_values = g_new(json_object *, view->n_json);
+		view->json_texts = g_new(gchar *, view->n_json);
+		for (struct OtherHint *hint = notification->other_hints; hint != NULL; hint = hint->next) {
+			if (hint->value.type != VALUE_JSON) continue;
+			view->json_values[i] = hint->value.json;
+			view->json_texts[i] = g_strdup(json_object_to_json_string_ext(
+				hint->value.json,
+				JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE
+			));
+			++i;
+		}
+	}
+	g_async_queue_push(hook->queue, view);
+}
+
+void plugin_hook_free(struct PluginHook *hook) {
+	g_async_queue_push(hook->queue, hook);
+}
+
+size_t plugin_hooks_running(void) {
+	return g_atomic_int_get(&running);
+}
@@ -0,0 +1,30 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stddef.h>
+#include <glib.h>
+#include "notification.h"
+
+/* A plugin's shared object, loaded when the configuration is. */
+struct Plugin;
+
+/* Loads the plugin at path, or says why it cannot and returns NULL. */
+struct Plugin *plugin_load(const char *path);
+void plugin_unref(struct Plugin *plugin);
+
+/* A thread that calls a plugin for each notification it is sent, so that a
+ * slow plugin never holds up the loop. */
+struct PluginHook;
+
+/* Starts the thread, which starts the plugin with argv. */
+struct PluginHook *plugin_hook_new(struct Plugin *plugin, const char *const *argv, guint budget_ms);
+/* Queues notification for the plugin. It is dropped instead while a call has
+ * gone over budget_ms, or when the plugin has fallen too far behind. */
+void plugin_hook_send(struct PluginHook *hook, struct Notification *notification);
+/* Lets the thread finish what it was sent, stop the plugin and exit, without
+ * waiting for it to. */
+void plugin_hook_free(struct PluginHook *hook);
+/* Threads of freed hooks that have not exited yet count too. */
+size_t plugin_hooks_running(void);
+
+#endif
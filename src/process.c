@@ -0,0 +1,67 @@
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "process.h"
+
+extern char **environ;
+
+pid_t spawn_process(
+	const char *const *argv,
+	int stdin_fd,
+	int output_fd,
+	int new_group,
+	const int *inherit_fds,
+	size_t n_inherit_fds
+) {
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	sigset_t mask;
+	sigset_t defaults;
+	pid_t pid;
+
+	// Undo the daemon's signal setup: SIGCHLD and friends are blocked for
+	// the main loop, and SIGPIPE is ignored
+	sigemptyset(&mask);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	if (new_group) {
+		posix_spawnattr_setpgroup(&attr, 0);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	posix_spawn_file_actions_init(&actions);
+	if (stdin_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+	}
+	if (output_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, output_fd, STDERR_FILENO);
+	}
+	for (size_t i = 0; i < n_inherit_fds; ++i) {
+		// Duplicating an fd onto itself clears its close-on-exec flag
+		posix_spawn_file_actions_adddup2(&actions, inherit_fds[i], inherit_fds[i]);
+	}
+
+	int error = posix_spawnp(
+		&pid,
+		argv[0],
+		&actions,
+		&attr,
+		(char *const *)argv,
+		environ
+	);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (error != 0) {
+		fprintf(stderr, "Could not run %s: %s\n", argv[0], strerror(error));
+		return -1;
+	}
+	return pid;
+}
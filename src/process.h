@@ -0,0 +1,22 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Starts argv with posix_spawn, which neither copies the daemon's page tables
+ * nor runs daemon code in the child. stdin_fd, if not -1, becomes the child's
+ * stdin, output_fd its stdout and stderr, and the inherit_fds are kept open
+ * under the same numbers. If new_group is nonzero the child leads a process
+ * group of its own, so that everything it starts can be killed with it.
+ * Returns the pid, or -1 after reporting why the command could not be run. */
+pid_t spawn_process(
+	const char *const *argv,
+	int stdin_fd,
+	int output_fd,
+	int new_group,
+	const int *inherit_fds,
+	size_t n_inherit_fds
+);
+
+#endif
@@ -0,0 +1,88 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <glib.h>
+#include "reload.h"
+
+/* Editors write a file in several steps, so changes are only acted on once
+ * they have settled. */
+#define SETTLE_MS 200
+
+struct ConfigWatch {
+	struct Loop *loop;
+	gchar *path;
+	gchar *basename;
+	ReloadFunction fn;
+	void *data;
+	unsigned timeout;
+};
+
+static void reload(void *data) {
+	struct ConfigWatch *watch = data;
+	watch->timeout = 0;
+
+	json_object *options = json_object_from_file(watch->path);
+	if (!json_object_is_type(options, json_type_object)) {
+		fprintf(
+			stderr,
+			"Not reloading %s: %s\n",
+			watch->path,
+			options == NULL ? json_util_get_last_err() : "not a JSON object"
+		);
+		json_object_put(options);
+		return;
+	}
+	struct Config *config = config_compile(options);
+	if (config->n_errors > 0) {
+		fprintf(stderr, "Not reloading %s: it has invalid hooks or settings.\n", watch->path);
+		config_free(config);
+		return;
+	}
+	fprintf(stderr, "Reloaded %s.\n", watch->path);
+	watch->fn(config, watch->data);
+}
+
+static void on_events(int fd, short revents, void *data) {
+	struct ConfigWatch *watch = data;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t length;
+	dbus_bool_t changed = FALSE;
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (char *p = buffer; p < buffer + length;) {
+			const struct inotify_event *event = (const struct inotify_event *)p;
+			if (event->len > 0 && !strcmp(event->name, watch->basename)) changed = TRUE;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	if (!changed) return;
+	if (watch->timeout != 0) loop_remove_timeout(watch->loop, watch->timeout);
+	watch->timeout = loop_add_timeout(watch->loop, SETTLE_MS, reload, watch);
+}
+
+dbus_bool_t watch_config(struct Loop *loop, const char *path, ReloadFunction fn, void *data) {
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		perror("inotify_init1");
+		return FALSE;
+	}
+	gchar *directory = g_path_get_dirname(path);
+	if (inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+		fprintf(stderr, "Cannot watch %s for changes: %s\n", directory, strerror(errno));
+		g_free(directory);
+		close(fd);
+		return FALSE;
+	}
+	g_free(directory);
+
+	struct ConfigWatch *watch = g_new0(struct ConfigWatch, 1);
+	watch->loop = loop;
+	watch->path = g_strdup(path);
+	watch->basename = g_path_get_basename(path);
+	watch->fn = fn;
+	watch->data = data;
+	loop_add_fd(loop, fd, POLLIN, on_events, watch);
+	return TRUE;
+}
@@ -0,0 +1,15 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "config.h"
+#include "loop.h"
+
+/* Takes ownership of a newly compiled config. */
+typedef void (*ReloadFunction)(struct Config *config, void *data);
+
+/* Loads and compiles path whenever it changes, and passes the result to fn if
+ * it is valid. Editors that save by renaming over the file are handled by
+ * watching its directory. */
+dbus_bool_t watch_config(struct Loop *loop, const char *path, ReloadFunction fn, void *data);
+
+#endif
@@ -0,0 +1,280 @@
+#include "stats.h"
+
+/* Histograms are HDR-style: values below SUB_BUCKETS get a bucket each, and
+ * every power of two above that is split into SUB_BUCKETS, so a bucket's
+ * bounds are within about 6% of any value in it. */
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+/* Values from 2^MAX_BITS us, about 13 days, share the last bucket */
+#define MAX_BITS 40
+#define N_BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS)
+/* Prometheus gets coarser buckets, every power of four from 16 us to 16 s.
+ * Values are whole microseconds, so the bucket of those below 2^bits us has an
+ * le of 2^bits - 1 us. */
+#define PROMETHEUS_MIN_BITS 4
+#define PROMETHEUS_MAX_BITS 24
+
+static const char *const STAGE_NAMES[N_STAGES] = {
+	[STAGE_DISPATCH] = "dispatch",
+	[STAGE_QUEUE] = "queue",
+	[STAGE_DECODE] = "decode",
+	[STAGE_ICON] = "icon",
+	[STAGE_ENCODE] = "encode",
+	[STAGE_ORDER] = "order",
+	[STAGE_HOOK_QUEUE] = "hook_queue",
+	[STAGE_SPAWN] = "spawn",
+	[STAGE_HOOK] = "hook",
+	[STAGE_PLUGIN] = "plugin",
+};
+
+static const char *const COUNTER_NAMES[N_COUNTERS] = {
+	[COUNTER_MESSAGES_RECEIVED] = "messages_received",
+	[COUNTER_MESSAGES_PROCESSED] = "messages_processed",
+	[COUNTER_NOTIFICATIONS] = "notifications",
+	[COUNTER_DROPPED] = "dropped",
+	[COUNTER_SPAWNS] = "spawns",
+	[COUNTER_SPAWN_FAILURES] = "spawn_failures",
+	[COUNTER_CACHE_HITS] = "cache_hits",
+	[COUNTER_CACHE_MISSES] = "cache_misses",
+	[COUNTER_PLUGIN_OVERRUNS] = "plugin_overruns",
+	[COUNTER_RUNS_DROPPED_LOW] = "runs_dropped_low",
+	[COUNTER_RUNS_DROPPED_NORMAL] = "runs_dropped_normal",
+	[COUNTER_RUNS_DROPPED_CRITICAL] = "runs_dropped_critical",
+	[COUNTER_HOOK_TIMEOUTS] = "hook_timeouts",
+};
+
+static const char *const GAUGE_NAMES[N_GAUGES] = {
+	[GAUGE_CACHE_BYTES] = "cache_bytes",
+	[GAUGE_DECODING] = "decoding",
+	[GAUGE_HOOKS_QUEUED] = "hooks_queued",
+	[GAUGE_HOOKS_RUNNING] = "hooks_running",
+};
+
+struct Histogram {
+	guint64 buckets[N_BUCKETS];
+	guint64 sum;
+	guint64 max;
+};
+
+struct Stats {
+	struct Histogram stages[N_STAGES];
+	guint64 counters[N_COUNTERS];
+	guint64 gauges[N_GAUGES];
+};
+
+static struct Stats stats;
+
+static int get_bucket(guint64 value) {
+	if (value < SUB_BUCKETS) return value;
+	int bits = 63 - __builtin_clzll(value);
+	if (bits >= MAX_BITS) return N_BUCKETS - 1;
+	int shift = bits - SUB_BITS;
+	return (shift + 1) * SUB_BUCKETS + (int)(value >> shift) - SUB_BUCKETS;
+}
+
+/* The first value past the bucket. */
+static guint64 get_bucket_end(int bucket) {
+	int shift = bucket / SUB_BUCKETS - 1;
+	if (shift < 0) return bucket + 1;
+	return (guint64)(bucket % SUB_BUCKETS + SUB_BUCKETS + 1) << shift;
+}
+
+gint64 stats_record(enum Stage stage, gint64 start) {
+	gint64 now = g_get_monotonic_time();
+	guint64 value = now > start ? now - start : 0;
+	struct Histogram *histogram = &stats.stages[stage];
+	__atomic_fetch_add(&histogram->buckets[get_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+	guint64 max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(
+		&histogram->max, &max, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+	));
+	return now;
+}
+
+void stats_count(enum Counter counter) {
+	__atomic_fetch_add(&stats.counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void stats_set(enum Gauge gauge, guint64 value) {
+	__atomic_store_n(&stats.gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/* Copies the statistics out. Values recorded meanwhile may be half in it. */
+static void take_snapshot(struct Stats *snapshot) {
+	for (int i = 0; i < N_STAGES; ++i) {
+		struct Histogram *from = &stats.stages[i];
+		struct Histogram *to = &snapshot->stages[i];
+		for (int j = 0; j < N_BUCKETS; ++j) {
+			to->buckets[j] = __atomic_load_n(&from->buckets[j], __ATOMIC_RELAXED);
+		}
+		to->sum = __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+		to->max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < N_COUNTERS; ++i) {
+		snapshot->counters[i] = __atomic_load_n(&stats.counters[i], __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < N_GAUGES; ++i) {
+		snapshot->gauges[i] = __atomic_load_n(&stats.gauges[i], __ATOMIC_RELAXED);
+	}
+}
+
+static guint64 get_count(const struct Histogram *histogram) {
+	guint64 count = 0;
+	for (int i = 0; i < N_BUCKETS; ++i) count += histogram->buckets[i];
+	return count;
+}
+
+/* Returns the highest value in the bucket holding the given fraction of the
+ * values, which is never more than the largest value recorded. */
+static guint64 get_percentile(const struct Histogram *histogram, guint64 count, double fraction) {
+	guint64 rank = (guint64)(count * fraction);
+	guint64 seen = 0;
+	for (int i = 0; i < N_BUCKETS; ++i) {
+		seen += histogram->buckets[i];
+		if (seen > rank) return MIN(get_bucket_end(i) - 1, histogram->max);
+	}
+	return histogram->max;
+}
+
+void stats_print(FILE *file) {
+	struct Stats *snapshot = g_new(struct Stats, 1);
+	take_snapshot(snapshot);
+	for (int i = 0; i < N_COUNTERS; ++i) {
+		fprintf(file, "%-21s %" G_GUINT64_FORMAT "\n", COUNTER_NAMES[i], snapshot->counters[i]);
+	}
+	for (int i = 0; i < N_GAUGES; ++i) {
+		fprintf(file, "%-21s %" G_GUINT64_FORMAT "\n", GAUGE_NAMES[i], snapshot->gauges[i]);
+	}
+	fprintf(file, "%-10s %10s %10s %10s %10s %10s  (us)\n", "stage", "count", "p50", "p90", "p99", "max");
+	for (int i = 0; i < N_STAGES; ++i) {
+		const struct Histogram *histogram = &snapshot->stages[i];
+		guint64 count = get_count(histogram);
+		fprintf(
+			file,
+			"%-10s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+			" %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT "\n",
+			STAGE_NAMES[i],
+			count,
+			get_percentile(histogram, count, 0.5),
+			get_percentile(histogram, count, 0.9),
+			get_percentile(histogram, count, 0.99),
+			histogram->max
+		);
+	}
+	g_free(snapshot);
+}
+
+static void append_values(DBusMessageIter *iter, const char *const *names, const guint64 *values, int n) {
+	DBusMessageIter array;
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "{st}", &array);
+	for (int i = 0; i < n; ++i) {
+		DBusMessageIter entry;
+		dbus_message_iter_open_container(&array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &names[i]);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_UINT64, &values[i]);
+		dbus_message_iter_close_container(&array, &entry);
+	}
+	dbus_message_iter_close_container(iter, &array);
+}
+
+static void append_histogram(DBusMessageIter *iter, const struct Histogram *histogram) {
+	DBusMessageIter fields;
+	DBusMessageIter buckets;
+	dbus_uint64_t count = get_count(histogram);
+	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL, &fields);
+	dbus_message_iter_append_basic(&fields, DBUS_TYPE_UINT64, &count);
+	dbus_message_iter_append_basic(&fields, DBUS_TYPE_UINT64, &histogram->sum);
+	dbus_message_iter_append_basic(&fields, DBUS_TYPE_UINT64, &histogram->max);
+	dbus_message_iter_open_container(&fields, DBUS_TYPE_ARRAY, "(tt)", &buckets);
+	for (int i = 0; i < N_BUCKETS; ++i) {
+		if (histogram->buckets[i] == 0) continue;
+		DBusMessageIter bucket;
+		dbus_uint64_t end = get_bucket_end(i);
+		dbus_message_iter_open_container(&buckets, DBUS_TYPE_STRUCT, NULL, &bucket);
+		dbus_message_iter_append_basic(&bucket, DBUS_TYPE_UINT64, &end);
+		dbus_message_iter_append_basic(&bucket, DBUS_TYPE_UINT64, &histogram->buckets[i]);
+		dbus_message_iter_close_container(&buckets, &bucket);
+	}
+	dbus_message_iter_close_container(&fields, &buckets);
+	dbus_message_iter_close_container(iter, &fields);
+}
+
+void stats_append_to_message(DBusMessage *message) {
+	struct Stats *snapshot = g_new(struct Stats, 1);
+	DBusMessageIter iter;
+	DBusMessageIter stages;
+	take_snapshot(snapshot);
+	dbus_message_iter_init_append(message, &iter);
+	append_values(&iter, COUNTER_NAMES, snapshot->counters, N_COUNTERS);
+	append_values(&iter, GAUGE_NAMES, snapshot->gauges, N_GAUGES);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{s(ttta(tt))}", &stages);
+	for (int i = 0; i < N_STAGES; ++i) {
+		DBusMessageIter entry;
+		dbus_message_iter_open_container(&stages, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &STAGE_NAMES[i]);
+		append_histogram(&entry, &snapshot->stages[i]);
+		dbus_message_iter_close_container(&stages, &entry);
+	}
+	dbus_message_iter_close_container(&iter, &stages);
+	g_free(snapshot);
+}
+
+void stats_write_prometheus(FILE *file) {
+	struct Stats *snapshot = g_new(struct Stats, 1);
+	take_snapshot(snapshot);
+	for (int i = 0; i < N_COUNTERS; ++i) {
+		fprintf(
+			file,
+			"# TYPE i_spy_notify_%s_total counter\n"
+			"i_spy_notify_%s_total %" G_GUINT64_FORMAT "\n",
+			COUNTER_NAMES[i],
+			COUNTER_NAMES[i],
+			snapshot->counters[i]
+		);
+	}
+	for (int i = 0; i < N_GAUGES; ++i) {
+		fprintf(
+			file,
+			"# TYPE i_spy_notify_%s gauge\n"
+			"i_spy_notify_%s %" G_GUINT64_FORMAT "\n",
+			GAUGE_NAMES[i],
+			GAUGE_NAMES[i],
+			snapshot->gauges[i]
+		);
+	}
+	fprintf(file, "# TYPE i_spy_notify_stage_seconds histogram\n");
+	for (int i = 0; i < N_STAGES; ++i) {
+		const struct Histogram *histogram = &snapshot->stages[i];
+		guint64 seen = 0;
+		int bucket = 0;
+		for (int bits = PROMETHEUS_MIN_BITS; bits <= PROMETHEUS_MAX_BITS; bits += 2) {
+			// Powers of two are bucket boundaries, so the counts are exact
+			while (bucket < N_BUCKETS && get_bucket_end(bucket) <= G_GUINT64_CONSTANT(1) << bits) {
+				seen += histogram->buckets[bucket++];
+			}
+			fprintf(
+				file,
+				// Enough digits that le is never rounded up past the bound
+				"i_spy_notify_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %" G_GUINT64_FORMAT "\n",
+				STAGE_NAMES[i],
+				(double)((G_GUINT64_CONSTANT(1) << bits) - 1) / G_USEC_PER_SEC,
+				seen
+			);
+		}
+		guint64 count = get_count(histogram);
+		fprintf(
+			file,
+			"i_spy_notify_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" G_GUINT64_FORMAT "\n"
+			"i_spy_notify_stage_seconds_sum{stage=\"%s\"} %.6f\n"
+			"i_spy_notify_stage_seconds_count{stage=\"%s\"} %" G_GUINT64_FORMAT "\n",
+			STAGE_NAMES[i],
+			count,
+			STAGE_NAMES[i],
+			(double)histogram->sum / G_USEC_PER_SEC,
+			STAGE_NAMES[i],
+			count
+		);
+	}
+	g_free(snapshot);
+}
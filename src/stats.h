@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <dbus/dbus.h>
+#include <glib.h>
+
+/* Where a notification spends its time, each timed into its own histogram. */
+enum Stage {
+	/* The handler, from a Notify arriving to it being replied to and queued */
+	STAGE_DISPATCH,
+	/* Waiting for a decode worker */
+	STAGE_QUEUE,
+	STAGE_DECODE,
+	/* Icon theme lookups and loads, part of decoding */
+	STAGE_ICON,
+	/* PNG and base64 encoding of images, part of decoding */
+	STAGE_ENCODE,
+	/* Decoded, waiting for the notifications before it to be */
+	STAGE_ORDER,
+	/* A hook run waiting in its urgency's queue */
+	STAGE_HOOK_QUEUE,
+	STAGE_SPAWN,
+	/* A hook run, from being spawned to exiting */
+	STAGE_HOOK,
+	/* A plugin hook's call */
+	STAGE_PLUGIN,
+	N_STAGES,
+};
+
+enum Counter {
+	COUNTER_MESSAGES_RECEIVED,
+	/* Messages on the Notifications interface */
+	COUNTER_MESSAGES_PROCESSED,
+	COUNTER_NOTIFICATIONS,
+	/* Notifications that were malformed, or that a stream or plugin hook had
+	 * no room for */
+	COUNTER_DROPPED,
+	COUNTER_SPAWNS,
+	COUNTER_SPAWN_FAILURES,
+	COUNTER_CACHE_HITS,
+	COUNTER_CACHE_MISSES,
+	/* Plugin calls that took longer than their hook's budget_ms */
+	COUNTER_PLUGIN_OVERRUNS,
+	/* Hook runs dropped by the overflow policy of a full queue */
+	COUNTER_RUNS_DROPPED_LOW,
+	COUNTER_RUNS_DROPPED_NORMAL,
+	COUNTER_RUNS_DROPPED_CRITICAL,
+	/* Hook runs killed for going over their timeout_ms */
+	COUNTER_HOOK_TIMEOUTS,
+	N_COUNTERS,
+};
+
+enum Gauge {
+	GAUGE_CACHE_BYTES,
+	/* Notify calls in the pipeline */
+	GAUGE_DECODING,
+	GAUGE_HOOKS_QUEUED,
+	GAUGE_HOOKS_RUNNING,
+	N_GAUGES,
+};
+
+/* Daemon-wide statistics. Any thread may record them with a few relaxed
+ * atomic operations, without taking a lock. */
+
+/* Adds the time since start, from g_get_monotonic_time, to stage and returns
+ * the current time, so that the next stage can start from it. */
+gint64 stats_record(enum Stage stage, gint64 start);
+void stats_count(enum Counter counter);
+void stats_set(enum Gauge gauge, guint64 value);
+
+/* Prints the counters and the percentiles of each stage. */
+void stats_print(FILE *file);
+/* Appends the counters and the gauges as a{st}, and the stages as
+ * a{s(ttta(tt))}: the count, total and maximum in microseconds, and the end
+ * and count of each nonempty bucket. */
+void stats_append_to_message(DBusMessage *message);
+/* Writes the statistics in the Prometheus text format. */
+void stats_write_prometheus(FILE *file);
+
+#endif
@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "process.h"
+#include "stats.h"
+#include "stream.h"
+
+#define MIN_BACKOFF_MS 100
+#define MAX_BACKOFF_MS 30000
+
+struct StreamHook {
+	struct Loop *loop;
+	gchar **argv;
+	struct HookLog *log;
+	size_t hook_id;
+	pid_t pid;
+	int fd;
+	GString *buffer;
+	size_t max_buffered;
+	size_t dropped;
+	int backoff_ms;
+	gint64 started_at;
+	unsigned restart_timeout;
+	dbus_bool_t freed;
+};
+
+static void start_process(void *data);
+
+static void close_pipe(struct StreamHook *hook) {
+	if (hook->fd < 0) return;
+	loop_remove_fd(hook->loop, hook->fd);
+	close(hook->fd);
+	hook->fd = -1;
+}
+
+static void flush_buffer(struct StreamHook *hook) {
+	while (hook->buffer->len > 0) {
+		ssize_t written = write(hook->fd, hook->buffer->str, hook->buffer->len);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN) {
+				// The process is gone; it is restarted once it has been reaped
+				close_pipe(hook);
+				return;
+			}
+			break;
+		}
+		g_string_erase(hook->buffer, 0, written);
+	}
+	loop_set_fd_events(hook->loop, hook->fd, hook->buffer->len > 0 ? POLLOUT : 0);
+}
+
+static void on_writable(int fd, short revents, void *data) {
+	struct StreamHook *hook = data;
+	if (revents & (POLLERR | POLLHUP)) {
+		close_pipe(hook);
+		return;
+	}
+	flush_buffer(hook);
+}
+
+static void schedule_restart(struct StreamHook *hook) {
+	hook->restart_timeout = loop_add_timeout(hook->loop, hook->backoff_ms, start_process, hook);
+	hook->backoff_ms = MIN(hook->backoff_ms * 2, MAX_BACKOFF_MS);
+}
+
+static void on_process_exit(pid_t pid, int status, void *data) {
+	struct StreamHook *hook = data;
+	hook->pid = 0;
+	if (hook->freed) {
+		g_strfreev(hook->argv);
+		g_string_free(hook->buffer, TRUE);
+		g_free(hook);
+		return;
+	}
+	close_pipe(hook);
+
+	// A hook that stayed up for a while is assumed healthy again
+	if (g_get_monotonic_time() - hook->started_at > (gint64)MAX_BACKOFF_MS * 1000) {
+		hook->backoff_ms = MIN_BACKOFF_MS;
+	}
+	fprintf(
+		stderr,
+		"Stream hook %s exited with status %d, restarting in %d ms.\n",
+		hook->argv[0],
+		status,
+		hook->backoff_ms
+	);
+	schedule_restart(hook);
+}
+
+static void start_process(void *data) {
+	struct StreamHook *hook = data;
+	int fds[2];
+	hook->restart_timeout = 0;
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		// Usually out of descriptors, which may pass
+		schedule_restart(hook);
+		return;
+	}
+	struct HookOutput *output = hook_output_open(hook->log, hook->hook_id, 0);
+	pid_t pid = spawn_process(
+		(const char *const *)hook->argv,
+		fds[0],
+		output != NULL ? hook_output_get_fd(output) : -1,
+		0,
+		NULL,
+		0
+	);
+	if (output != NULL) hook_output_start(output, pid);
+	close(fds[0]);
+	if (pid < 0) {
+		close(fds[1]);
+		schedule_restart(hook);
+		return;
+	}
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	hook->pid = pid;
+	hook->fd = fds[1];
+	hook->started_at = g_get_monotonic_time();
+	loop_watch_child(hook->loop, pid, on_process_exit, hook);
+	loop_add_fd(hook->loop, hook->fd, 0, on_writable, hook);
+	// Lines queued while the hook was down
+	flush_buffer(hook);
+}
+
+struct StreamHook *stream_hook_new(
+	struct Loop *loop,
+	const char *const *argv,
+	size_t max_buffered,
+	struct HookLog *log,
+	size_t hook_id
+) {
+	struct StreamHook *hook = g_new0(struct StreamHook, 1);
+	hook->loop = loop;
+	hook->argv = g_strdupv((gchar **)argv);
+	hook->log = log;
+	hook->hook_id = hook_id;
+	hook->fd = -1;
+	hook->buffer = g_string_new(NULL);
+	hook->max_buffered = max_buffered;
+	hook->backoff_ms = MIN_BACKOFF_MS;
+	start_process(hook);
+	return hook;
+}
+
+void stream_hook_send(struct StreamHook *hook, json_object *notification) {
+	size_t length;
+	const char *line = json_object_to_json_string_length(
+		notification,
+		JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE,
+		&length
+	);
+	// Backpressure: once the hook stops draining its pipe, lines are held up
+	// to max_buffered bytes and anything beyond that is dropped
+	if (hook->buffer->len + length + 1 > hook->max_buffered) {
+		stats_count(COUNTER_DROPPED);
+		if (hook->dropped++ % 100 == 0) {
+			fprintf(
+				stderr,
+				"Stream hook %s is not keeping up, %zu notifications dropped.\n",
+				hook->argv[0],
+				hook->dropped
+			);
+		}
+		return;
+	}
+	g_string_append_len(hook->buffer, line, length);
+	g_string_append_c(hook->buffer, '\n');
+	if (hook->fd >= 0) flush_buffer(hook);
+}
+
+void stream_hook_free(struct StreamHook *hook) {
+	if (hook->restart_timeout) loop_remove_timeout(hook->loop, hook->restart_timeout);
+	close_pipe(hook);
+	if (hook->pid > 0) {
+		// Freed once the process exits, since the child watch still refers to it
+		hook->freed = TRUE;
+		return;
+	}
+	g_strfreev(hook->argv);
+	g_string_free(hook->buffer, TRUE);
+	g_free(hook);
+}
@@ -0,0 +1,24 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <json-c/json.h>
+#include "hook-log.h"
+#include "loop.h"
+
+/* A hook that is started once and receives every notification as a line of
+ * JSON on its stdin. It is restarted with backoff whenever it exits. */
+struct StreamHook;
+
+/* The process's output goes to log, as that of the hook with hook_id. */
+struct StreamHook *stream_hook_new(
+	struct Loop *loop,
+	const char *const *argv,
+	size_t max_buffered,
+	struct HookLog *log,
+	size_t hook_id
+);
+void stream_hook_send(struct StreamHook *hook, json_object *notification);
+/* Closes the hook's stdin and forgets it; the process is left to exit. */
+void stream_hook_free(struct StreamHook *hook);
+
+#endif
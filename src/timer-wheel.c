@@ -0,0 +1,200 @@
+#include "timer-wheel.h"
+
+#define TICK_US 10000
+#define LEVEL_BITS 6
+#define N_SLOTS (1 << LEVEL_BITS)
+#define N_LEVELS 4
+/* Timers further out wait in the last level and are placed again */
+#define MAX_DELTA ((G_GUINT64_CONSTANT(1) << (LEVEL_BITS * N_LEVELS)) - 1)
+
+struct TimerWheel {
+	struct Loop *loop;
+	gint64 start;
+	/* The last tick whose timers have run */
+	guint64 current;
+	GQueue slots[N_LEVELS][N_SLOTS];
+	size_t counts[N_LEVELS];
+	size_t n_timers;
+	unsigned timeout;
+	guint64 wake_tick;
+};
+
+static void schedule(struct TimerWheel *wheel);
+
+static guint64 get_now_tick(struct TimerWheel *wheel) {
+	return (g_get_monotonic_time() - wheel->start) / TICK_US;
+}
+
+static int get_level(struct TimerWheel *wheel, GQueue *slot) {
+	return (slot - &wheel->slots[0][0]) / N_SLOTS;
+}
+
+/* A timer in level l is in the slot for bits l * LEVEL_BITS and up of its
+ * expiry, and moves down when the wheel's tick reaches that slot. */
+static void place(struct TimerWheel *wheel, struct Timer *timer) {
+	guint64 expires = MAX(timer->expires, wheel->current);
+	guint64 delta = MIN(expires - wheel->current, MAX_DELTA);
+	int level = 0;
+	while (level < N_LEVELS - 1 && delta >> (LEVEL_BITS * (level + 1)) != 0) ++level;
+	guint64 index = ((wheel->current + delta) >> (LEVEL_BITS * level)) & (N_SLOTS - 1);
+	timer->slot = &wheel->slots[level][index];
+	g_queue_push_tail_link(timer->slot, &timer->link);
+	++wheel->counts[level];
+	++wheel->n_timers;
+}
+
+static void unplace(struct TimerWheel *wheel, struct Timer *timer) {
+	g_queue_unlink(timer->slot, &timer->link);
+	--wheel->counts[get_level(wheel, timer->slot)];
+	--wheel->n_timers;
+	timer->slot = NULL;
+}
+
+static void cascade(struct TimerWheel *wheel, int level) {
+	GQueue *slot = &wheel->slots[level][(wheel->current >> (LEVEL_BITS * level)) & (N_SLOTS - 1)];
+	GList *link;
+	while ((link = slot->head) != NULL) {
+		struct Timer *timer = link->data;
+		unplace(wheel, timer);
+		place(wheel, timer);
+	}
+}
+
+static void run_tick(struct TimerWheel *wheel) {
+	int top = 0;
+	while (
+		top < N_LEVELS - 1 &&
+		(wheel->current & ((G_GUINT64_CONSTANT(1) << (LEVEL_BITS * (top + 1))) - 1)) == 0
+	) {
+		++top;
+	}
+	for (int level = top; level > 0; --level) cascade(wheel, level);
+
+	// Timers armed by these callbacks expire after this tick, so they land
+	// in other slots
+	GQueue *slot = &wheel->slots[0][wheel->current & (N_SLOTS - 1)];
+	GList *link;
+	while ((link = slot->head) != NULL) {
+		struct Timer *timer = link->data;
+		unplace(wheel, timer);
+		timer->fn(timer->data);
+	}
+}
+
+/* Runs every tick up to target, skipping stretches where the levels that
+ * would be touched are empty. */
+static void advance(struct TimerWheel *wheel, guint64 target) {
+	while (wheel->current < target) {
+		if (wheel->n_timers == 0) {
+			wheel->current = target;
+			break;
+		}
+		int level = 0;
+		while (wheel->counts[level] == 0) ++level;
+		if (level > 0) {
+			int bits = LEVEL_BITS * level;
+			guint64 boundary = ((wheel->current >> bits) + 1) << bits;
+			if (boundary - 1 > wheel->current) {
+				wheel->current = MIN(boundary - 1, target);
+				continue;
+			}
+		}
+		++wheel->current;
+		run_tick(wheel);
+	}
+}
+
+/* The first tick at which something has to happen: a timer in the first
+ * level runs, or the lowest other level that has timers cascades. */
+static guint64 get_next_tick(struct TimerWheel *wheel) {
+	guint64 next = G_MAXUINT64;
+	int level = 1;
+	while (level < N_LEVELS && wheel->counts[level] == 0) ++level;
+	if (level < N_LEVELS) {
+		int bits = LEVEL_BITS * level;
+		next = ((wheel->current >> bits) + 1) << bits;
+	}
+	if (wheel->counts[0] > 0) {
+		for (guint64 tick = wheel->current + 1; tick < next; ++tick) {
+			if (!g_queue_is_empty(&wheel->slots[0][tick & (N_SLOTS - 1)])) return tick;
+		}
+	}
+	return next;
+}
+
+static void on_timeout(void *data) {
+	struct TimerWheel *wheel = data;
+	wheel->timeout = 0;
+	advance(wheel, get_now_tick(wheel));
+	schedule(wheel);
+}
+
+static void schedule(struct TimerWheel *wheel) {
+	if (wheel->n_timers == 0) {
+		if (wheel->timeout != 0) loop_remove_timeout(wheel->loop, wheel->timeout);
+		wheel->timeout = 0;
+		return;
+	}
+	guint64 tick = get_next_tick(wheel);
+	if (wheel->timeout != 0) {
+		if (wheel->wake_tick == tick) return;
+		loop_remove_timeout(wheel->loop, wheel->timeout);
+	}
+	gint64 wake = wheel->start + (gint64)tick * TICK_US;
+	gint64 ms = (wake - g_get_monotonic_time() + 999) / 1000;
+	wheel->wake_tick = tick;
+	wheel->timeout = loop_add_timeout(wheel->loop, ms > G_MAXINT ? G_MAXINT : (int)ms, on_timeout, wheel);
+}
+
+struct TimerWheel *timer_wheel_new(struct Loop *loop) {
+	struct TimerWheel *wheel = g_new0(struct TimerWheel, 1);
+	wheel->loop = loop;
+	wheel->start = g_get_monotonic_time();
+	for (int level = 0; level < N_LEVELS; ++level) {
+		for (int i = 0; i < N_SLOTS; ++i) g_queue_init(&wheel->slots[level][i]);
+	}
+	return wheel;
+}
+
+void timer_wheel_free(struct TimerWheel *wheel) {
+	if (wheel->timeout != 0) loop_remove_timeout(wheel->loop, wheel->timeout);
+	for (int level = 0; level < N_LEVELS; ++level) {
+		for (int i = 0; i < N_SLOTS; ++i) {
+			GList *link;
+			while ((link = wheel->slots[level][i].head) != NULL) unplace(wheel, link->data);
+		}
+	}
+	g_free(wheel);
+}
+
+void timer_init(struct Timer *timer, TimerFunction fn, void *data) {
+	timer->link.data = timer;
+	timer->link.prev = NULL;
+	timer->link.next = NULL;
+	timer->slot = NULL;
+	timer->expires = 0;
+	timer->fn = fn;
+	timer->data = data;
+}
+
+void timer_wheel_arm(struct TimerWheel *wheel, struct Timer *timer, guint ms) {
+	if (timer->slot != NULL) unplace(wheel, timer);
+	guint64 now = get_now_tick(wheel);
+	// Nothing is due, so the ticks slept through can be skipped
+	if (wheel->n_timers == 0) wheel->current = MAX(wheel->current, now);
+	// Rounded up, since the current tick has partly gone by
+	timer->expires = now + 1 + ((guint64)ms * 1000 + TICK_US - 1) / TICK_US;
+	place(wheel, timer);
+	schedule(wheel);
+}
+
+void timer_wheel_cancel(struct TimerWheel *wheel, struct Timer *timer) {
+	if (timer->slot == NULL) return;
+	unplace(wheel, timer);
+	// A wakeup that finds nothing to do is cheaper than finding the next one
+	if (wheel->n_timers == 0) schedule(wheel);
+}
+
+gboolean timer_is_armed(const struct Timer *timer) {
+	return timer->slot != NULL;
+}
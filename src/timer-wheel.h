@@ -0,0 +1,33 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <glib.h>
+#include "loop.h"
+
+typedef void (*TimerFunction)(void *data);
+
+/* A timer kept in a TimerWheel. It is embedded in whatever it times, so that
+ * arming and cancelling it never allocate. */
+struct Timer {
+	GList link;
+	GQueue *slot;
+	guint64 expires;
+	TimerFunction fn;
+	void *data;
+};
+
+/* Hierarchical timing wheel driven by a single loop timeout. Arming and
+ * cancelling take constant time however many timers there are, and expiries
+ * are rounded up to the wheel's tick. */
+struct TimerWheel;
+
+struct TimerWheel *timer_wheel_new(struct Loop *loop);
+/* Frees the wheel without calling the timers still in it. */
+void timer_wheel_free(struct TimerWheel *wheel);
+void timer_init(struct Timer *timer, TimerFunction fn, void *data);
+/* Calls the timer's function once after ms, replacing any earlier arming. */
+void timer_wheel_arm(struct TimerWheel *wheel, struct Timer *timer, guint ms);
+void timer_wheel_cancel(struct TimerWheel *wheel, struct Timer *timer);
+gboolean timer_is_armed(const struct Timer *timer);
+
+#endif
@@ -0,0 +1,81 @@
+/* Checks that every block encoder the CPU can run gives the same output as the
+ * scalar one and as g_base64_encode, for every length up to MAX_LENGTH. */
+
+#include <string.h>
+// Included rather than linked, to reach the encoders base64_encode picks from
+#include "../src/base64.c"
+
+#define MAX_LENGTH 5000
+
+static guchar *make_data(void) {
+	guchar *data = g_malloc(MAX_LENGTH);
+	guint32 state = 1;
+	for (gsize i = 0; i < MAX_LENGTH; ++i) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 24;
+	}
+	return data;
+}
+
+static void check_encoder(EncodeBlocksFunction encode_blocks) {
+	guchar *data = make_data();
+	gchar *expected = g_malloc(base64_encoded_length(MAX_LENGTH) + 1);
+	gchar *out = g_malloc(base64_encoded_length(MAX_LENGTH) + 1);
+	for (gsize size = 0; size < MAX_LENGTH; ++size) {
+		// A copy of exactly size bytes, so that reading past it is caught by
+		// the sanitizers
+		guchar *input = g_malloc(size);
+		memcpy(input, data, size);
+		encode_with(encode_blocks_scalar, input, size, expected);
+		encode_with(encode_blocks, input, size, out);
+		g_assert_cmpuint(strlen(out), ==, base64_encoded_length(size));
+		g_assert_cmpstr(out, ==, expected);
+		g_free(input);
+	}
+	g_free(out);
+	g_free(expected);
+	g_free(data);
+}
+
+static void test_scalar(void) {
+	guchar *data = make_data();
+	gchar *out = g_malloc(base64_encoded_length(MAX_LENGTH) + 1);
+	for (gsize size = 0; size < MAX_LENGTH; ++size) {
+		gchar *expected = g_base64_encode(data, size);
+		encode_with(encode_blocks_scalar, data, size, out);
+		g_assert_cmpstr(out, ==, expected);
+		g_free(expected);
+	}
+	g_free(out);
+	g_free(data);
+}
+
+static void test_ssse3(void) {
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		check_encoder(encode_blocks_ssse3);
+		return;
+	}
+#endif
+	g_test_skip("SSSE3 is not available");
+}
+
+static void test_avx2(void) {
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		check_encoder(encode_blocks_avx2);
+		return;
+	}
+#endif
+	g_test_skip("AVX2 is not available");
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/base64/scalar", test_scalar);
+	g_test_add_func("/base64/ssse3", test_ssse3);
+	g_test_add_func("/base64/avx2", test_avx2);
+	return g_test_run();
+}
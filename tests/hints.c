@@ -0,0 +1,110 @@
+/* Checks the perfect hash that hints are looked up with: every hint the
+ * specification defines is found in its slot, and nothing else is. */
+
+#include <string.h>
+#include "hints.h"
+
+struct KnownHint {
+	const char *name;
+	int slot;
+	/* Set for the name a slot is reported under */
+	gboolean current;
+};
+
+static const struct KnownHint KNOWN[] = {
+	{ "action-icons", SLOT_ACTION_ICONS, TRUE },
+	{ "category", SLOT_CATEGORY, TRUE },
+	{ "desktop-entry", SLOT_DESKTOP_ENTRY, TRUE },
+	{ "image-data", SLOT_IMAGE_DATA_PNG, TRUE },
+	{ "image_data", SLOT_IMAGE_DATA_PNG, FALSE },
+	{ "icon_data", SLOT_IMAGE_DATA_PNG, FALSE },
+	{ "image-path", SLOT_IMAGE_PATH_HINT, TRUE },
+	{ "image_path", SLOT_IMAGE_PATH_HINT, FALSE },
+	{ "resident", SLOT_RESIDENT, TRUE },
+	{ "sender-pid", SLOT_SENDER_PID, TRUE },
+	{ "sound-file", SLOT_SOUND_FILE, TRUE },
+	{ "sound-name", SLOT_SOUND_NAME, TRUE },
+	{ "suppress-sound", SLOT_SUPPRESS_SOUND, TRUE },
+	{ "transient", SLOT_TRANSIENT, TRUE },
+	{ "urgency", SLOT_URGENCY, TRUE },
+	{ "x", SLOT_X, TRUE },
+	{ "y", SLOT_Y, TRUE },
+};
+
+static void test_known(void) {
+	for (gsize i = 0; i < G_N_ELEMENTS(KNOWN); ++i) {
+		const struct HintInfo *hint = hints_find(KNOWN[i].name);
+		g_assert_nonnull(hint);
+		g_assert_cmpstr(hint->name, ==, KNOWN[i].name);
+		g_assert_cmpint(hint->slot, ==, KNOWN[i].slot);
+		// The current name wins over older ones sent with it
+		for (gsize j = 0; j < G_N_ELEMENTS(KNOWN); ++j) {
+			if (j == i || KNOWN[j].slot != KNOWN[i].slot) continue;
+			g_assert_true(hint != hints_find(KNOWN[j].name));
+			if (KNOWN[i].current) g_assert_cmpint(hint->rank, >, hints_find(KNOWN[j].name)->rank);
+		}
+	}
+}
+
+static void test_names(void) {
+	for (int slot = SLOT_FIRST_HINT; slot < N_SLOTS; ++slot) {
+		const char *name = hints_get_name(slot);
+		g_assert_nonnull(name);
+		const struct HintInfo *hint = hints_find(name);
+		g_assert_nonnull(hint);
+		g_assert_cmpint(hint->slot, ==, slot);
+	}
+	g_assert_null(hints_get_name(SLOT_FIRST_HINT - 1));
+	g_assert_null(hints_get_name(N_SLOTS));
+	g_assert_null(hints_get_name(SLOT_OTHER_HINT));
+}
+
+/* Names that share a hash with a hint, or differ from one in a byte the hash
+ * does not read, must still be told apart. */
+static void test_unknown(void) {
+	static const char *const names[] = {
+		"", "z", "X", "xx", "urgenc", "urgencyy", "Urgency", "image-dat", "image-data ",
+		"sound-nam", "sound_name", "category\x80", "x-vendor-hint", "desktop-entries",
+	};
+	for (gsize i = 0; i < G_N_ELEMENTS(names); ++i) g_assert_null(hints_find(names[i]));
+
+	// Every name of up to three of the characters hints use, with the NUL
+	// at the end of chars standing for a shorter name
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz-_";
+	char name[4] = { 0 };
+	for (gsize a = 0; a < sizeof(chars) - 1; ++a) {
+		for (gsize b = 0; b < sizeof(chars); ++b) {
+			for (gsize c = 0; c < sizeof(chars); ++c) {
+				name[0] = chars[a];
+				name[1] = chars[b];
+				name[2] = chars[c];
+				const struct HintInfo *hint = hints_find(name);
+				if (hint != NULL) g_assert_cmpstr(hint->name, ==, name);
+			}
+		}
+	}
+	for (gsize i = 0; i < G_N_ELEMENTS(KNOWN); ++i) {
+		// Each hint with one byte changed, which keeps most of its hash
+		gsize length = strlen(KNOWN[i].name);
+		gchar *copy = g_strdup(KNOWN[i].name);
+		for (gsize j = 0; j < length; ++j) {
+			char saved = copy[j];
+			for (int byte = 1; byte < 256; ++byte) {
+				if (byte == saved) continue;
+				copy[j] = byte;
+				const struct HintInfo *hint = hints_find(copy);
+				if (hint != NULL) g_assert_cmpstr(hint->name, ==, copy);
+			}
+			copy[j] = saved;
+		}
+		g_free(copy);
+	}
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/hints/known", test_known);
+	g_test_add_func("/hints/names", test_names);
+	g_test_add_func("/hints/unknown", test_unknown);
+	return g_test_run();
+}
@@ -0,0 +1,172 @@
+/* Checks how hook "match" objects are compiled and evaluated against
+ * notifications. */
+
+#include <string.h>
+#include "match.h"
+
+struct Fixture {
+	DBusMessage *message;
+	struct Notification *notification;
+	GPtrArray *predicates;
+};
+
+static void fixture_set_up(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	fixture->message = dbus_message_new_method_call(NULL, "/", NULL, "Notify");
+	fixture->notification = notification_new(fixture->message);
+	fixture->predicates = g_ptr_array_new_with_free_func((GDestroyNotify)predicate_free);
+	notification_set_string(fixture->notification, SLOT_APP_NAME, "Element");
+	notification_set_string(fixture->notification, SLOT_SUMMARY, "Build failed on main");
+	notification_set_string(fixture->notification, SLOT_BODY, "ping @channel now");
+	notification_set_string(fixture->notification, SLOT_CATEGORY, "im.received");
+	notification_set_boolean(fixture->notification, SLOT_TRANSIENT, TRUE);
+	struct Value vendor = { .type = VALUE_BOOLEAN, .boolean = TRUE };
+	notification_add_other_hint(fixture->notification, "x-vendor-pinned", vendor);
+}
+
+static void fixture_tear_down(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	g_ptr_array_unref(fixture->predicates);
+	notification_unref(fixture->notification);
+	dbus_message_unref(fixture->message);
+}
+
+static dbus_bool_t compile(struct Fixture *fixture, const char *spec, struct Match *match) {
+	json_object *json = spec != NULL ? json_tokener_parse(spec) : NULL;
+	g_assert_true(spec == NULL || json != NULL);
+	dbus_bool_t ok = match_compile(json, fixture->predicates, match);
+	json_object_put(json);
+	return ok;
+}
+
+static gboolean matches(struct Fixture *fixture, const char *spec) {
+	struct Match match;
+	g_assert_true(compile(fixture, spec, &match));
+	signed char *results = g_new(signed char, fixture->predicates->len + 1);
+	memset(results, -1, fixture->predicates->len);
+	gboolean passed = match_evaluate(
+		&match,
+		(struct Predicate *const *)fixture->predicates->pdata,
+		fixture->notification,
+		results
+	);
+	g_free(results);
+	match_clear(&match);
+	return passed;
+}
+
+static void test_empty(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	g_assert_true(matches(fixture, NULL));
+	g_assert_true(matches(fixture, "{}"));
+}
+
+static void test_strings(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	g_assert_true(matches(fixture, "{\"app_name\": \"Element\"}"));
+	g_assert_false(matches(fixture, "{\"app_name\": \"element\"}"));
+	g_assert_true(matches(fixture, "{\"app_name\": {\"equals\": \"Element\"}}"));
+	g_assert_true(matches(fixture, "{\"summary\": {\"prefix\": \"Build failed\"}}"));
+	g_assert_false(matches(fixture, "{\"summary\": {\"prefix\": \"failed\"}}"));
+	g_assert_true(matches(fixture, "{\"body\": {\"regex\": \"@(here|channel)\\\\b\"}}"));
+	g_assert_false(matches(fixture, "{\"body\": {\"regex\": \"^@channel\"}}"));
+	g_assert_true(matches(fixture, "{\"category\": {\"prefix\": \"im.\"}}"));
+	// Fields that were not sent match nothing, not even an empty prefix
+	fixture->notification->slots[SLOT_BODY].type = VALUE_NONE;
+	g_assert_false(matches(fixture, "{\"body\": {\"prefix\": \"\"}}"));
+}
+
+static void test_clauses(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	// Any of a field's tests, and every field
+	g_assert_true(matches(fixture, "{\"app_name\": [\"Slack\", \"Element\"]}"));
+	g_assert_false(matches(fixture, "{\"app_name\": [\"Slack\", \"Signal\"]}"));
+	g_assert_true(matches(fixture, "{\"app_name\": [\"Slack\", \"Element\"], \"summary\": {\"prefix\": \"Build\"}}"));
+	g_assert_false(matches(fixture, "{\"app_name\": [\"Slack\", \"Element\"], \"summary\": {\"prefix\": \"Deploy\"}}"));
+}
+
+static void test_urgency(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	// Notifications without an urgency are normal
+	g_assert_true(matches(fixture, "{\"urgency\": 1}"));
+	g_assert_false(matches(fixture, "{\"urgency\": 2}"));
+	notification_set_int(fixture->notification, SLOT_URGENCY, 2);
+	g_assert_true(matches(fixture, "{\"urgency\": 2}"));
+	g_assert_true(matches(fixture, "{\"urgency\": {\"min\": 1}}"));
+	g_assert_false(matches(fixture, "{\"urgency\": {\"max\": 1}}"));
+	g_assert_true(matches(fixture, "{\"urgency\": [0, {\"min\": 2, \"max\": 2}]}"));
+}
+
+static void test_hints(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	g_assert_true(matches(fixture, "{\"hints\": {\"transient\": true}}"));
+	g_assert_false(matches(fixture, "{\"hints\": {\"transient\": false}}"));
+	// Hints that were not sent are false
+	g_assert_true(matches(fixture, "{\"hints\": {\"resident\": false}}"));
+	g_assert_false(matches(fixture, "{\"hints\": {\"resident\": true}}"));
+	g_assert_true(matches(fixture, "{\"hints\": {\"x-vendor-pinned\": true, \"transient\": true}}"));
+	g_assert_false(matches(fixture, "{\"hints\": {\"x-vendor-pinned\": true, \"transient\": false}}"));
+	g_assert_true(matches(fixture, "{\"hints\": {\"x-vendor-other\": false}}"));
+}
+
+static void test_invalid(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	static const char *const specs[] = {
+		"[]",
+		"\"summary\"",
+		"{\"hints\": 1}",
+		"{\"hints\": [\"transient\"]}",
+		"{\"hints\": {\"transient\": \"yes\"}}",
+		"{\"summary\": []}",
+		"{\"summary\": 5}",
+		"{\"summary\": null}",
+		"{\"summary\": {\"suffix\": \"main\"}}",
+		"{\"body\": {\"regex\": \"(\"}}",
+		"{\"urgency\": \"low\"}",
+		"{\"urgency\": {}}",
+		"{\"urgency\": {\"min\": 2, \"max\": 1}}",
+		"{\"urgency\": {\"min\": \"1\"}}",
+		"{\"id\": 1}",
+	};
+	for (gsize i = 0; i < G_N_ELEMENTS(specs); ++i) {
+		struct Match match;
+		g_assert_false(compile(fixture, specs[i], &match));
+		g_assert_null(match.clauses);
+		g_assert_cmpuint(match.n_clauses, ==, 0);
+	}
+}
+
+/* Hooks testing the same thing share its predicate, so it is evaluated once
+ * per notification. */
+static void test_shared(struct Fixture *fixture, gconstpointer data) {
+	(void)data;
+	struct Match first;
+	struct Match second;
+	g_assert_true(compile(fixture, "{\"app_name\": \"Element\", \"hints\": {\"transient\": true}}", &first));
+	g_assert_true(compile(fixture, "{\"app_name\": [\"Slack\", \"Element\"], \"hints\": {\"transient\": true}}", &second));
+	g_assert_cmpuint(fixture->predicates->len, ==, 3);
+
+	signed char results[3] = { -1, -1, -1 };
+	struct Predicate *const *predicates = (struct Predicate *const *)fixture->predicates->pdata;
+	g_assert_true(match_evaluate(&first, predicates, fixture->notification, results));
+	// The result for "Element" is kept from the first hook rather than
+	// evaluated again, so the second passes on it
+	notification_set_string(fixture->notification, SLOT_APP_NAME, "Signal");
+	g_assert_true(match_evaluate(&second, predicates, fixture->notification, results));
+	g_assert_cmpint(results[0], ==, 1);
+	g_assert_cmpint(results[2], ==, 0);
+	match_clear(&first);
+	match_clear(&second);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add("/match/empty", struct Fixture, NULL, fixture_set_up, test_empty, fixture_tear_down);
+	g_test_add("/match/strings", struct Fixture, NULL, fixture_set_up, test_strings, fixture_tear_down);
+	g_test_add("/match/clauses", struct Fixture, NULL, fixture_set_up, test_clauses, fixture_tear_down);
+	g_test_add("/match/urgency", struct Fixture, NULL, fixture_set_up, test_urgency, fixture_tear_down);
+	g_test_add("/match/hints", struct Fixture, NULL, fixture_set_up, test_hints, fixture_tear_down);
+	g_test_add("/match/invalid", struct Fixture, NULL, fixture_set_up, test_invalid, fixture_tear_down);
+	g_test_add("/match/shared", struct Fixture, NULL, fixture_set_up, test_shared, fixture_tear_down);
+	return g_test_run();
+}
@@ -0,0 +1,162 @@
+/* Drives the timer wheel tick by tick, without a loop or a clock, and checks
+ * that every timer runs exactly at its expiry, also when it has to cascade
+ * down from the upper levels or starts out beyond the last one. */
+
+// Included rather than linked, to set the wheel's tick directly
+#include "../src/timer-wheel.c"
+
+/* The wheel only asks the loop to wake it, which these tests do themselves */
+unsigned loop_add_timeout(struct Loop *loop, int ms, LoopTimeoutFunction fn, void *data) {
+	(void)loop;
+	(void)ms;
+	(void)fn;
+	(void)data;
+	return 1;
+}
+
+void loop_remove_timeout(struct Loop *loop, unsigned id) {
+	(void)loop;
+	(void)id;
+}
+
+struct TestTimer {
+	struct Timer timer;
+	struct TimerWheel *wheel;
+	/* The tick it ran at, and how many times */
+	guint64 ran_at;
+	int runs;
+	/* Armed again this many ticks after running, or 0 */
+	guint64 repeat;
+};
+
+static void on_expired(void *data) {
+	struct TestTimer *test = data;
+	test->ran_at = test->wheel->current;
+	++test->runs;
+	if (test->repeat > 0 && test->runs < 3) {
+		test->timer.expires = test->wheel->current + test->repeat;
+		place(test->wheel, &test->timer);
+	}
+}
+
+static void add_timer(struct TimerWheel *wheel, struct TestTimer *test, guint64 expires) {
+	timer_init(&test->timer, on_expired, test);
+	test->wheel = wheel;
+	test->ran_at = 0;
+	test->runs = 0;
+	test->repeat = 0;
+	test->timer.expires = expires;
+	place(wheel, &test->timer);
+}
+
+static struct TimerWheel *new_wheel(guint64 current) {
+	struct TimerWheel *wheel = timer_wheel_new(NULL);
+	wheel->current = current;
+	return wheel;
+}
+
+/* Starts and distances on either side of where the levels roll over. */
+static void test_boundaries(void) {
+	static const guint64 starts[] = {
+		0, 1, N_SLOTS - 1, N_SLOTS, N_SLOTS * N_SLOTS - 1, N_SLOTS * N_SLOTS,
+		N_SLOTS * N_SLOTS * N_SLOTS - 1, N_SLOTS * N_SLOTS * N_SLOTS, MAX_DELTA, 12345678,
+	};
+	static const guint64 deltas[] = {
+		1, 2, N_SLOTS - 1, N_SLOTS, N_SLOTS + 1, N_SLOTS * N_SLOTS - 1, N_SLOTS * N_SLOTS,
+		N_SLOTS * N_SLOTS + 1, N_SLOTS * N_SLOTS * N_SLOTS - 1, N_SLOTS * N_SLOTS * N_SLOTS,
+		N_SLOTS * N_SLOTS * N_SLOTS + 1, MAX_DELTA - 1, MAX_DELTA, MAX_DELTA + 1, 3 * MAX_DELTA + 7,
+	};
+	for (gsize i = 0; i < G_N_ELEMENTS(starts); ++i) {
+		for (gsize j = 0; j < G_N_ELEMENTS(deltas); ++j) {
+			struct TimerWheel *wheel = new_wheel(starts[i]);
+			struct TestTimer test;
+			guint64 expires = starts[i] + deltas[j];
+			add_timer(wheel, &test, expires);
+			advance(wheel, expires - 1);
+			g_assert_cmpint(test.runs, ==, 0);
+			g_assert_cmpuint(wheel->n_timers, ==, 1);
+			advance(wheel, expires);
+			g_assert_cmpint(test.runs, ==, 1);
+			g_assert_cmpuint(test.ran_at, ==, expires);
+			g_assert_cmpuint(wheel->n_timers, ==, 0);
+			timer_wheel_free(wheel);
+		}
+	}
+}
+
+/* The tick the loop would be woken at is never past the next expiry, and
+ * advancing to each one in turn runs every timer on time. */
+static void test_next_tick(void) {
+	static const guint64 deltas[] = { 5, N_SLOTS, N_SLOTS * 3 + 2, N_SLOTS * N_SLOTS + 9, MAX_DELTA + 100 };
+	struct TimerWheel *wheel = new_wheel(N_SLOTS * N_SLOTS - 3);
+	struct TestTimer tests[G_N_ELEMENTS(deltas)];
+	for (gsize i = 0; i < G_N_ELEMENTS(deltas); ++i) add_timer(wheel, &tests[i], wheel->current + deltas[i]);
+	gsize wakeups = 0;
+	while (wheel->n_timers > 0) {
+		guint64 next = get_next_tick(wheel);
+		g_assert_cmpuint(next, >, wheel->current);
+		for (gsize i = 0; i < G_N_ELEMENTS(deltas); ++i) {
+			if (tests[i].runs == 0) g_assert_cmpuint(next, <=, tests[i].timer.expires);
+		}
+		advance(wheel, next);
+		++wakeups;
+	}
+	for (gsize i = 0; i < G_N_ELEMENTS(deltas); ++i) {
+		g_assert_cmpint(tests[i].runs, ==, 1);
+		g_assert_cmpuint(tests[i].ran_at, ==, tests[i].timer.expires);
+	}
+	// A timer beyond the last level is placed again once per turn of it, but
+	// the wheel never wakes for each of the millions of ticks in between
+	g_assert_cmpuint(wakeups, <, 2 * N_SLOTS);
+	timer_wheel_free(wheel);
+}
+
+/* Timers armed, cancelled and armed again from callbacks, spread over every
+ * level and reached with jumps of varying size. */
+static void test_many(void) {
+	enum { N_TIMERS = 2000 };
+	struct TimerWheel *wheel = new_wheel(1000);
+	struct TestTimer *tests = g_new0(struct TestTimer, N_TIMERS);
+	guint32 state = 7;
+	for (gsize i = 0; i < N_TIMERS; ++i) {
+		state = state * 1103515245 + 12345;
+		// Distances of every magnitude up to past the last level
+		guint64 delta = 1 + ((guint64)state << 7) % (G_GUINT64_CONSTANT(1) << (1 + i % 26));
+		add_timer(wheel, &tests[i], wheel->current + delta);
+		if (i % 5 == 0) tests[i].repeat = 1 + i % 70;
+	}
+	for (gsize i = 3; i < N_TIMERS; i += 7) timer_wheel_cancel(wheel, &tests[i].timer);
+	guint64 target = wheel->current;
+	while (wheel->n_timers > 0) {
+		state = state * 1103515245 + 12345;
+		target += 1 + (state >> 8) % 5000;
+		guint64 before = wheel->current;
+		advance(wheel, target);
+		for (gsize i = 0; i < N_TIMERS; ++i) {
+			if (tests[i].runs > 0 && tests[i].ran_at > before) {
+				g_assert_cmpuint(tests[i].ran_at, <=, target);
+			}
+			if (timer_is_armed(&tests[i].timer)) {
+				g_assert_cmpuint(tests[i].timer.expires, >, target);
+			}
+		}
+	}
+	for (gsize i = 0; i < N_TIMERS; ++i) {
+		if (i >= 3 && (i - 3) % 7 == 0) {
+			g_assert_cmpint(tests[i].runs, ==, 0);
+		} else {
+			g_assert_cmpint(tests[i].runs, ==, tests[i].repeat > 0 ? 3 : 1);
+			g_assert_cmpuint(tests[i].ran_at, ==, tests[i].timer.expires);
+		}
+	}
+	g_free(tests);
+	timer_wheel_free(wheel);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/timer-wheel/boundaries", test_boundaries);
+	g_test_add_func("/timer-wheel/next-tick", test_next_tick);
+	g_test_add_func("/timer-wheel/many", test_many);
+	return g_test_run();
+}